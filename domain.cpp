@@ -0,0 +1,199 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or
+ * distribute this software, either in source code form or as a compiled
+ * binary, for any purpose, commercial or non-commercial, and by any
+ * means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors
+ * of this software dedicate any and all copyright interest in the
+ * software to the public domain. We make this dedication for the benefit
+ * of the public at large and to the detriment of our heirs and
+ * successors. We intend this dedication to be an overt act of
+ * relinquishment in perpetuity of all present and future rights to this
+ * software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+#include "domain.h"
+
+const char *decomposition_name(const Decomposition decomposition) {
+	switch (decomposition) {
+	case Decomposition::index: return "index";
+	case Decomposition::morton: return "morton";
+	}
+
+	return "unknown";
+}
+
+bool parse_decomposition(const std::string_view name, Decomposition &decomposition) {
+	for (const auto d : { Decomposition::index, Decomposition::morton }) {
+		if (name == decomposition_name(d)) {
+			decomposition = d;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+const char *balance_name(const Balance balance) {
+	switch (balance) {
+	case Balance::even: return "even";
+	case Balance::throughput: return "throughput";
+	}
+
+	return "unknown";
+}
+
+bool parse_balance(const std::string_view name, Balance &balance) {
+	for (const auto b : { Balance::even, Balance::throughput }) {
+		if (name == balance_name(b)) {
+			balance = b;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+DomainOrder::DomainOrder(const std::size_t count) {
+	this->body.resize(count);
+	this->slot.resize(count);
+	std::iota(this->body.begin(), this->body.end(), 0u);
+	std::iota(this->slot.begin(), this->slot.end(), 0u);
+}
+
+// spreads the low 10 bits of v two zero bits apart
+static std::uint32_t morton_expand(std::uint32_t v) {
+	v &= 0x3ffu;
+	v = (v | (v << 16)) & 0x030000ffu;
+	v = (v | (v << 8)) & 0x0300f00fu;
+	v = (v | (v << 4)) & 0x030c30c3u;
+	v = (v | (v << 2)) & 0x09249249u;
+	return v;
+}
+
+// device whose range holds slot
+static std::size_t domain_owner(const std::vector<std::uint32_t> &owned_first, const std::size_t slot) {
+	return static_cast<std::size_t>(std::upper_bound(owned_first.begin(), owned_first.end(), slot) - owned_first.begin()) - 1;
+}
+
+std::size_t domain_reorder_morton(Particle *particles, const std::size_t count, DomainOrder &order, const std::vector<std::uint32_t> &owned_first, std::vector<std::uint32_t> &moved) {
+	float lo[3] = { INFINITY, INFINITY, INFINITY };
+	float hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+
+	for (std::size_t i = 0; i < count; i++) {
+		for (int a = 0; a < 3; a++) {
+			lo[a] = std::min(lo[a], particles[i].position.data[a]);
+			hi[a] = std::max(hi[a], particles[i].position.data[a]);
+		}
+	}
+
+	// the key in the upper word and the current slot in the lower, so equal keys keep their order
+	std::vector<std::uint64_t> keys(count);
+	for (std::size_t i = 0; i < count; i++) {
+		std::uint32_t key = 0;
+		for (int a = 0; a < 3; a++) {
+			const float extent = hi[a] - lo[a];
+			const float t = extent > 0.f ? (particles[i].position.data[a] - lo[a]) / extent : 0.f;
+			key |= morton_expand(static_cast<std::uint32_t>(std::clamp(t * 1024.f, 0.f, 1023.f))) << a;
+		}
+
+		keys[i] = static_cast<std::uint64_t>(key) << 32 | i;
+	}
+
+	std::sort(keys.begin(), keys.end());
+
+	// a body belongs to the device whose range its place in the sorted order falls in. every range
+	// loses as many bodies as it gains, so the ones arriving take the slots of the ones leaving
+	std::vector<std::vector<std::uint32_t>> vacated(owned_first.size()), arriving(owned_first.size());
+
+	for (std::size_t i = 0; i < count; i++) {
+		const auto from = static_cast<std::uint32_t>(keys[i] & 0xffffffffu);
+		const std::size_t owner = domain_owner(owned_first, from);
+		const std::size_t target = domain_owner(owned_first, i);
+
+		if (owner != target) {
+			vacated[owner].push_back(from);
+			arriving[target].push_back(from);
+		}
+	}
+
+	std::vector<Particle> moving;
+	std::vector<std::uint32_t> moving_body;
+	moved.clear();
+
+	for (std::size_t d = 0; d < owned_first.size(); d++) {
+		std::sort(vacated[d].begin(), vacated[d].end());
+		moved.insert(moved.end(), vacated[d].begin(), vacated[d].end());
+
+		for (const std::uint32_t from : arriving[d]) {
+			moving.push_back(particles[from]);
+			moving_body.push_back(order.body[from]);
+		}
+	}
+
+	// moved is ascending since the ranges are
+	for (std::size_t k = 0; k < moved.size(); k++) {
+		particles[moved[k]] = moving[k];
+		order.body[moved[k]] = moving_body[k];
+		order.slot[moving_body[k]] = moved[k];
+	}
+
+	return moved.size();
+}
+
+double domain_imbalance(const std::vector<double> &busy) {
+	double busy_max = 0.0, busy_sum = 0.0;
+	for (const double b : busy) {
+		busy_max = std::max(busy_max, b);
+		busy_sum += b;
+	}
+
+	return busy_sum > 0.0 ? busy_max / (busy_sum / busy.size()) - 1.0 : 0.0;
+}
+
+std::vector<std::uint32_t> domain_balance(const std::vector<std::uint32_t> &owned_count, const std::vector<double> &busy, const std::size_t count, const std::uint32_t min_count) {
+	std::vector<double> rate(owned_count.size());
+	double rate_sum = 0.0;
+
+	for (std::size_t i = 0; i < owned_count.size(); i++) {
+		if (busy[i] <= 0.0)
+			return owned_count;
+
+		rate[i] = owned_count[i] / busy[i];
+		rate_sum += rate[i];
+	}
+
+	// the floors come off the top first, the rest is shared out by rate and rounded on the
+	// running total so the shares add up to count
+	const std::size_t spare = count - std::min(count, static_cast<std::size_t>(min_count) * owned_count.size());
+	std::vector<std::uint32_t> shares(owned_count.size());
+	double running = 0.0;
+	std::size_t given = 0;
+
+	for (std::size_t i = 0; i < owned_count.size(); i++) {
+		running += rate[i];
+		const std::size_t total = i + 1 == owned_count.size() ? spare : static_cast<std::size_t>(std::llround(spare * (running / rate_sum)));
+
+		shares[i] = static_cast<std::uint32_t>(total - given) + min_count;
+		given = total;
+	}
+
+	return shares;
+}
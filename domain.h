@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+#include "particle.h"
+
+// how the bodies of a -multi-gpu system are laid out in the particle buffer, and so what the
+// contiguous owned range of every device covers
+enum class Decomposition {
+	index, // the order they were loaded in
+	morton // grouped along a Morton curve, so every owned range is a compact region of space
+};
+
+const char *decomposition_name(Decomposition decomposition);
+bool parse_decomposition(std::string_view name, Decomposition &decomposition);
+
+// which body sits in which slot of the particle buffer once it has been reordered. the
+// outputs map the slots back so a body keeps its index across reorders
+struct DomainOrder {
+	std::vector<std::uint32_t> body; // body in every slot
+	std::vector<std::uint32_t> slot; // slot of every body
+
+	explicit DomainOrder(std::size_t count);
+};
+
+// sorts the bodies by the Morton key of their position in the bounding box of all of them,
+// 10 bits per axis, and moves the ones that fall into another device's share of that order
+// into the slots the others left there. bodies that stay on their device keep their slot, so
+// only the moved slots, ascending, have to be exchanged. owned_first holds the first slot of
+// every device's range in ascending order, the return value is how many bodies moved
+std::size_t domain_reorder_morton(Particle *particles, std::size_t count, DomainOrder &order, const std::vector<std::uint32_t> &owned_first, std::vector<std::uint32_t> &moved);
+
+// how the owned ranges of a -multi-gpu system are sized
+enum class Balance {
+	even,      // the same share on every device
+	throughput // shares follow the rate each device was measured at
+};
+
+const char *balance_name(Balance balance);
+bool parse_balance(std::string_view name, Balance &balance);
+
+// slowest device's time over the mean of them, less 1. busy is the time each took per submit
+double domain_imbalance(const std::vector<double> &busy);
+
+// shares of count bodies in proportion to the rate each device ran its owned_count at, busy
+// being the time it took per submit. no device is left with less than min_count
+std::vector<std::uint32_t> domain_balance(const std::vector<std::uint32_t> &owned_count, const std::vector<double> &busy, std::size_t count, std::uint32_t min_count);
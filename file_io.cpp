@@ -0,0 +1,650 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or
+ * distribute this software, either in source code form or as a compiled
+ * binary, for any purpose, commercial or non-commercial, and by any
+ * means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors
+ * of this software dedicate any and all copyright interest in the
+ * software to the public domain. We make this dedication for the benefit
+ * of the public at large and to the detriment of our heirs and
+ * successors. We intend this dedication to be an overt act of
+ * relinquishment in perpetuity of all present and future rights to this
+ * software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ */
+
+#ifndef _CRT_SECURE_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <array>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include "file_io.h"
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+void *io_buffer_alloc(std::size_t size) {
+#ifdef _WIN32
+	void *ptr = _aligned_malloc(io_align_up(size), io_alignment);
+#else
+	void *ptr = std::aligned_alloc(io_alignment, io_align_up(size));
+#endif
+
+	if (ptr == nullptr)
+		throw std::runtime_error("Cannot allocate aligned I/O buffer!");
+
+	return ptr;
+}
+
+void io_buffer_free(void *ptr) {
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else
+	std::free(ptr);
+#endif
+}
+
+bool map_file(const std::string &path, std::size_t alignment, MappedFile &file) {
+#ifdef _WIN32
+	(void)path;
+	(void)alignment;
+	(void)file;
+	return false;
+#else
+	const int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (::fstat(fd, &st) != 0 || st.st_size <= 0) {
+		::close(fd);
+		return false;
+	}
+
+	const std::size_t page_size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+	alignment = std::max(alignment, page_size);
+
+	file.size = static_cast<std::size_t>(st.st_size);
+	file.mapped_size = (file.size + alignment - 1) / alignment * alignment;
+
+	// reserve enough anonymous zero pages to align the start, then map the file over them. the
+	// pages between the end of the file and mapped_size stay anonymous so they can be touched
+	file.reserved_size = file.mapped_size + alignment - page_size;
+	void *base = ::mmap(nullptr, file.reserved_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED) {
+		::close(fd);
+		file = MappedFile {};
+		return false;
+	}
+
+	const std::uintptr_t aligned = (reinterpret_cast<std::uintptr_t>(base) + alignment - 1) & ~static_cast<std::uintptr_t>(alignment - 1);
+	void *data = ::mmap(reinterpret_cast<void *>(aligned), file.size, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0);
+	::close(fd);
+
+	if (data == MAP_FAILED) {
+		::munmap(base, file.reserved_size);
+		file = MappedFile {};
+		return false;
+	}
+
+	file.base = base;
+	file.data = data;
+
+	// start reading ahead, the whole file is about to be copied to the device
+	::madvise(file.data, file.size, MADV_WILLNEED);
+
+	return true;
+#endif
+}
+
+void unmap_file(MappedFile &file) {
+#ifndef _WIN32
+	if (file.base != nullptr)
+		::munmap(file.base, file.reserved_size);
+#endif
+
+	file = MappedFile {};
+}
+
+void *hugepage_alloc(std::size_t size, std::size_t &mapped_size) {
+#if defined(__linux__) && defined(MAP_HUGETLB)
+	// the default huge page size on x86-64 and arm64
+	static const std::size_t hugepage_size = 2 << 20;
+
+	mapped_size = (size + hugepage_size - 1) & ~(hugepage_size - 1);
+	void *ptr = ::mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+	return ptr == MAP_FAILED ? nullptr : ptr;
+#else
+	(void)size;
+	mapped_size = 0;
+	return nullptr;
+#endif
+}
+
+void hugepage_free(void *ptr, std::size_t mapped_size) {
+#if defined(__linux__) && defined(MAP_HUGETLB)
+	if (ptr != nullptr)
+		::munmap(ptr, mapped_size);
+#else
+	(void)ptr;
+	(void)mapped_size;
+#endif
+}
+
+const char *io_backend_name(IoBackend backend) {
+	switch (backend) {
+	case IoBackend::stdio: return "stdio";
+	case IoBackend::pwrite: return "pwrite";
+	case IoBackend::io_uring: return "io_uring";
+	}
+
+	return "unknown";
+}
+
+bool parse_io_backend(const std::string &name, IoBackend &backend) {
+	if (name == "stdio")
+		backend = IoBackend::stdio;
+	else if (name == "pwrite")
+		backend = IoBackend::pwrite;
+	else if (name == "uring" || name == "io_uring")
+		backend = IoBackend::io_uring;
+	else
+		return false;
+
+	return true;
+}
+
+// writes complete synchronously in submit(), wait() only hands the buffers back
+struct StdioQueue : IoQueue {
+	~StdioQueue() override {
+		for (auto file : this->files)
+			std::fclose(file);
+	}
+
+	std::size_t open(const std::string &path) override {
+		std::FILE *file = std::fopen(path.c_str(), "wb");
+
+		if (file == nullptr)
+			throw std::runtime_error("Cannot open " + path);
+
+		this->files.push_back(file);
+		return this->files.size() - 1;
+	}
+
+	// every caller appends sequentially, so the offset is implied by the stream position
+	void submit(std::size_t file, const void *data, std::size_t size, std::uint64_t offset, void *user_data) override {
+		(void)offset;
+
+		const bool failed = std::fwrite(data, size, 1, this->files[file]) != 1;
+		if (failed)
+			std::printf("! Write of %zu bytes failed\n", size);
+
+		this->completed.push_back(IoCompletion { .user_data = user_data, .failed = failed });
+	}
+
+	IoCompletion wait() override {
+		if (this->completed.empty())
+			return IoCompletion { .user_data = nullptr, .failed = false };
+
+		const IoCompletion completion = this->completed.front();
+		this->completed.pop_front();
+		return completion;
+	}
+
+	std::size_t in_flight() const override { return this->completed.size(); }
+
+	void sync() override {
+		for (auto file : this->files) {
+			std::fflush(file);
+#ifndef _WIN32
+			::fsync(fileno(file));
+#endif
+		}
+	}
+
+	IoBackend backend() const override { return IoBackend::stdio; }
+	bool direct() const override { return false; }
+
+	std::vector<std::FILE *> files;
+	std::deque<IoCompletion> completed;
+};
+
+#ifndef _WIN32
+// direct is cleared when the file had to be opened buffered
+static int open_output_file(const std::string &path, bool &direct) {
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+#ifdef O_DIRECT
+	if (direct) {
+		const int fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+		if (fd >= 0)
+			return fd;
+
+		std::printf("! O_DIRECT refused for %s (%s), using buffered I/O\n", path.c_str(), std::strerror(errno));
+	}
+#endif
+
+	direct = false;
+
+	const int fd = ::open(path.c_str(), flags, 0644);
+	if (fd < 0)
+		throw std::runtime_error("Cannot open " + path);
+
+	return fd;
+}
+
+struct PwriteQueue : IoQueue {
+	explicit PwriteQueue(const bool direct) : is_direct(direct) {}
+
+	~PwriteQueue() override {
+		for (auto fd : this->fds)
+			::close(fd);
+	}
+
+	std::size_t open(const std::string &path) override {
+		this->fds.push_back(open_output_file(path, this->is_direct));
+		return this->fds.size() - 1;
+	}
+
+	void submit(std::size_t file, const void *data, std::size_t size, std::uint64_t offset, void *user_data) override {
+		const auto *bytes = static_cast<const unsigned char *>(data);
+		bool failed = false;
+
+		while (size > 0) {
+			const ssize_t ret = ::pwrite(this->fds[file], bytes, size, static_cast<off_t>(offset));
+
+			if (ret < 0 && errno == EINTR)
+				continue;
+
+			if (ret <= 0) {
+				std::printf("! pwrite of %zu bytes failed (%s)\n", size, std::strerror(errno));
+				failed = true;
+				break;
+			}
+
+			bytes += ret;
+			size -= static_cast<std::size_t>(ret);
+			offset += static_cast<std::uint64_t>(ret);
+		}
+
+		this->completed.push_back(IoCompletion { .user_data = user_data, .failed = failed });
+	}
+
+	IoCompletion wait() override {
+		if (this->completed.empty())
+			return IoCompletion { .user_data = nullptr, .failed = false };
+
+		const IoCompletion completion = this->completed.front();
+		this->completed.pop_front();
+		return completion;
+	}
+
+	std::size_t in_flight() const override { return this->completed.size(); }
+
+	void sync() override {
+		for (auto fd : this->fds)
+			::fsync(fd);
+	}
+
+	IoBackend backend() const override { return IoBackend::pwrite; }
+	bool direct() const override { return this->is_direct; }
+
+	bool is_direct;
+	std::vector<int> fds;
+	std::deque<IoCompletion> completed;
+};
+#endif
+
+#ifdef __linux__
+// raw io_uring syscalls so we do not depend on liburing
+struct UringQueue : IoQueue {
+	UringQueue(const bool direct, const unsigned queue_depth) : is_direct(direct) {
+		io_uring_params params;
+		std::memset(&params, 0, sizeof(params));
+
+		this->ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, queue_depth, &params));
+		if (this->ring_fd < 0)
+			throw std::runtime_error(std::string("io_uring_setup failed: ") + std::strerror(errno));
+
+		// kernels before 5.6 set up a ring but fail every IORING_OP_WRITE, and cannot be probed either
+		std::vector<unsigned char> probe_storage(sizeof(io_uring_probe) + probe_ops * sizeof(io_uring_probe_op), 0);
+		auto *probe = reinterpret_cast<io_uring_probe *>(probe_storage.data());
+		if (syscall(__NR_io_uring_register, this->ring_fd, IORING_REGISTER_PROBE, probe, probe_ops) < 0 || probe->last_op < IORING_OP_WRITE || (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED) == 0) {
+			::close(this->ring_fd);
+			throw std::runtime_error("io_uring has no IORING_OP_WRITE");
+		}
+
+		this->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		this->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		this->single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+
+		if (this->single_mmap)
+			this->sq_ring_size = this->cq_ring_size = std::max(this->sq_ring_size, this->cq_ring_size);
+
+		this->sq_ring = mmap(nullptr, this->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ring_fd, IORING_OFF_SQ_RING);
+		if (this->sq_ring == MAP_FAILED) {
+			::close(this->ring_fd);
+			throw std::runtime_error("Cannot map io_uring submission ring!");
+		}
+
+		if (this->single_mmap) {
+			this->cq_ring = this->sq_ring;
+		} else {
+			this->cq_ring = mmap(nullptr, this->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ring_fd, IORING_OFF_CQ_RING);
+			if (this->cq_ring == MAP_FAILED) {
+				munmap(this->sq_ring, this->sq_ring_size);
+				::close(this->ring_fd);
+				throw std::runtime_error("Cannot map io_uring completion ring!");
+			}
+		}
+
+		this->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+		this->sqes = static_cast<io_uring_sqe *>(mmap(nullptr, this->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ring_fd, IORING_OFF_SQES));
+		if (this->sqes == MAP_FAILED) {
+			if (!this->single_mmap)
+				munmap(this->cq_ring, this->cq_ring_size);
+			munmap(this->sq_ring, this->sq_ring_size);
+			::close(this->ring_fd);
+			throw std::runtime_error("Cannot map io_uring submission entries!");
+		}
+
+		auto *sq = static_cast<unsigned char *>(this->sq_ring);
+		auto *cq = static_cast<unsigned char *>(this->cq_ring);
+
+		this->sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+		this->sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+		this->sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+		this->cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+		this->cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+		this->cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+		this->cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+		this->depth = params.sq_entries;
+		this->writes.resize(this->depth);
+		for (std::size_t i = 0; i < this->writes.size(); i++)
+			this->free_slots.push_back(i);
+	}
+
+	~UringQueue() override {
+		while (this->in_flight() > 0)
+			this->wait();
+
+		munmap(this->sqes, this->sqes_size);
+		if (!this->single_mmap)
+			munmap(this->cq_ring, this->cq_ring_size);
+		munmap(this->sq_ring, this->sq_ring_size);
+		::close(this->ring_fd);
+
+		for (auto fd : this->fds)
+			::close(fd);
+	}
+
+	std::size_t open(const std::string &path) override {
+		this->fds.push_back(open_output_file(path, this->is_direct));
+		return this->fds.size() - 1;
+	}
+
+	void submit(std::size_t file, const void *data, std::size_t size, std::uint64_t offset, void *user_data) override {
+		while (this->free_slots.empty())
+			this->completed.push_back(this->reap());
+
+		const std::size_t slot = this->free_slots.back();
+		this->free_slots.pop_back();
+
+		this->writes[slot] = Write {
+			.fd = this->fds[file],
+			.data = static_cast<const unsigned char *>(data),
+			.size = size,
+			.offset = offset,
+			.user_data = user_data
+		};
+
+		this->push_sqe(slot);
+	}
+
+	IoCompletion wait() override {
+		if (!this->completed.empty()) {
+			const IoCompletion completion = this->completed.front();
+			this->completed.pop_front();
+			return completion;
+		}
+
+		if (this->free_slots.size() == this->writes.size())
+			return IoCompletion { .user_data = nullptr, .failed = false };
+
+		return this->reap();
+	}
+
+	std::size_t in_flight() const override { return this->writes.size() - this->free_slots.size() + this->completed.size(); }
+
+	void sync() override {
+		for (auto fd : this->fds)
+			::fsync(fd);
+	}
+
+	IoBackend backend() const override { return IoBackend::io_uring; }
+	bool direct() const override { return this->is_direct; }
+
+private:
+	// the opcode table handed to IORING_REGISTER_PROBE, IORING_OP_WRITE is well within it
+	static const unsigned probe_ops = 64;
+
+	struct Write {
+		int fd;
+		const unsigned char *data;
+		std::size_t size;
+		std::uint64_t offset;
+		void *user_data;
+	};
+
+	void push_sqe(const std::size_t slot) {
+		const Write &write = this->writes[slot];
+		const unsigned tail = *this->sq_tail;
+		const unsigned idx = tail & this->sq_mask;
+
+		io_uring_sqe *sqe = &this->sqes[idx];
+		std::memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->fd = write.fd;
+		sqe->addr = reinterpret_cast<std::uint64_t>(write.data);
+		sqe->len = static_cast<std::uint32_t>(write.size);
+		sqe->off = write.offset;
+		sqe->user_data = slot;
+
+		this->sq_array[idx] = idx;
+		__atomic_store_n(this->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+		while (syscall(__NR_io_uring_enter, this->ring_fd, 1, 0, 0, nullptr, 0) < 0) {
+			if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+				throw std::runtime_error(std::string("io_uring_enter failed: ") + std::strerror(errno));
+		}
+	}
+
+	// waits for one completion, resubmitting the remainder of short writes
+	IoCompletion reap() {
+		while (true) {
+			const unsigned head = *this->cq_head;
+
+			if (head == __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE)) {
+				if (syscall(__NR_io_uring_enter, this->ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR)
+					throw std::runtime_error(std::string("io_uring_enter failed: ") + std::strerror(errno));
+
+				continue;
+			}
+
+			const io_uring_cqe cqe = this->cqes[head & this->cq_mask];
+			__atomic_store_n(this->cq_head, head + 1, __ATOMIC_RELEASE);
+
+			const std::size_t slot = static_cast<std::size_t>(cqe.user_data);
+			Write &write = this->writes[slot];
+
+			if (cqe.res > 0 && static_cast<std::size_t>(cqe.res) < write.size) {
+				write.data += cqe.res;
+				write.size -= static_cast<std::size_t>(cqe.res);
+				write.offset += static_cast<std::uint64_t>(cqe.res);
+				this->push_sqe(slot);
+				continue;
+			}
+
+			// a write that moved no bytes would never finish either
+			const bool failed = cqe.res <= 0;
+			if (cqe.res < 0)
+				std::printf("! io_uring write of %zu bytes failed (%s)\n", write.size, std::strerror(-cqe.res));
+			else if (cqe.res == 0)
+				std::printf("! io_uring write of %zu bytes wrote nothing\n", write.size);
+
+			this->free_slots.push_back(slot);
+			return IoCompletion { .user_data = write.user_data, .failed = failed };
+		}
+	}
+
+	bool is_direct;
+	int ring_fd;
+	bool single_mmap;
+	void *sq_ring, *cq_ring;
+	std::size_t sq_ring_size, cq_ring_size, sqes_size;
+	io_uring_sqe *sqes;
+	io_uring_cqe *cqes;
+	unsigned *sq_tail, *sq_array, *cq_head, *cq_tail;
+	unsigned sq_mask, cq_mask, depth;
+
+	std::vector<Write> writes;
+	std::vector<std::size_t> free_slots;
+	std::deque<IoCompletion> completed;
+	std::vector<int> fds;
+};
+#endif
+
+std::unique_ptr<IoQueue> create_io_queue(IoBackend backend, bool direct, unsigned queue_depth) {
+#ifdef __linux__
+	if (backend == IoBackend::io_uring) {
+		try {
+			return std::make_unique<UringQueue>(direct, queue_depth);
+		} catch (const std::exception &e) {
+			std::printf("! %s, falling back to pwrite\n", e.what());
+			backend = IoBackend::pwrite;
+		}
+	}
+#else
+	(void)queue_depth;
+
+	if (backend == IoBackend::io_uring) {
+		std::printf("! io_uring is not available on this platform, falling back to pwrite\n");
+		backend = IoBackend::pwrite;
+	}
+#endif
+
+#ifndef _WIN32
+	if (backend == IoBackend::pwrite)
+		return std::make_unique<PwriteQueue>(direct);
+#else
+	if (backend == IoBackend::pwrite)
+		std::printf("! pwrite is not available on this platform, falling back to stdio\n");
+#endif
+
+	return std::make_unique<StdioQueue>();
+}
+
+void run_io_benchmark(const std::string &path, std::size_t total_mb) {
+	static const std::size_t chunk_size = 4 << 20;
+	static const unsigned queue_depth = 8;
+
+	struct Config {
+		IoBackend backend;
+		bool direct;
+	};
+
+	static const std::array<Config, 4> configs = {
+		Config { IoBackend::stdio, false },
+		Config { IoBackend::pwrite, false },
+		Config { IoBackend::pwrite, true },
+		Config { IoBackend::io_uring, true }
+	};
+
+	const std::size_t num_chunks = std::max<std::size_t>(1, (total_mb << 20) / chunk_size);
+
+	std::vector<unsigned char *> bufs(queue_depth);
+	for (std::size_t i = 0; i < bufs.size(); i++) {
+		bufs[i] = static_cast<unsigned char *>(io_buffer_alloc(chunk_size));
+		std::memset(bufs[i], static_cast<int>(i + 1), chunk_size);
+	}
+
+	std::printf("I/O benchmark: %zu MB in %zu MB writes to %s\n", (num_chunks * chunk_size) >> 20, chunk_size >> 20, path.c_str());
+
+	for (const auto &config : configs) {
+		const auto start = std::chrono::steady_clock::now();
+
+		{
+			auto queue = create_io_queue(config.backend, config.direct, queue_depth);
+
+			// the queue may have fallen back, in which case this row would repeat an earlier one
+			if (queue->backend() != config.backend)
+				continue;
+
+			const std::size_t file = queue->open(path);
+
+			// the filesystem refused O_DIRECT, the row would measure the page cache
+			if (queue->direct() != config.direct) {
+				queue.reset();
+				std::remove(path.c_str());
+				continue;
+			}
+
+			std::vector<unsigned char *> idle(bufs.rbegin(), bufs.rend());
+
+			for (std::size_t i = 0; i < num_chunks; i++) {
+				while (idle.empty())
+					idle.push_back(static_cast<unsigned char *>(queue->wait().user_data));
+
+				unsigned char *buf = idle.back();
+				idle.pop_back();
+				queue->submit(file, buf, chunk_size, static_cast<std::uint64_t>(i) * chunk_size, buf);
+			}
+
+			while (queue->wait().user_data != nullptr);
+			queue->sync();
+		}
+
+		const double elapsed = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start).count();
+		std::printf("%-8s %-8s %.02f MB/s\n", io_backend_name(config.backend), config.direct ? "direct" : "buffered", static_cast<double>(num_chunks * chunk_size) / (1024.0 * 1024.0) / elapsed);
+
+		std::remove(path.c_str());
+	}
+
+	for (auto buf : bufs)
+		io_buffer_free(buf);
+}
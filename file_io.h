@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <memory>
+
+enum class IoBackend {
+	stdio,   // buffered fwrite, available everywhere
+	pwrite,  // positional writes, optionally O_DIRECT (POSIX only)
+	io_uring // several writes in flight through an io_uring, optionally O_DIRECT (Linux only)
+};
+
+// O_DIRECT needs buffer addresses, sizes and file offsets aligned to the logical block size.
+// 4096 covers every device we run on.
+static constexpr std::size_t io_alignment = 4096;
+
+static constexpr std::size_t io_align_up(const std::size_t size) {
+	return (size + io_alignment - 1) & ~(io_alignment - 1);
+}
+
+void *io_buffer_alloc(std::size_t size);
+void io_buffer_free(void *ptr);
+
+// a finished write. failed is set when any part of it could not be written
+struct IoCompletion {
+	void *user_data;
+	bool failed;
+};
+
+// a set of output files sharing one submission queue. writes are queued with submit() and
+// the buffer must stay untouched until wait() hands back its user_data.
+struct IoQueue {
+	virtual ~IoQueue() = default;
+
+	virtual std::size_t open(const std::string &path) = 0;
+	virtual void submit(std::size_t file, const void *data, std::size_t size, std::uint64_t offset, void *user_data) = 0;
+
+	// blocks until a write finishes and returns it, user_data is nullptr if nothing is in flight
+	virtual IoCompletion wait() = 0;
+	virtual std::size_t in_flight() const = 0;
+
+	// flushes every file to stable storage, call once nothing is in flight
+	virtual void sync() = 0;
+
+	virtual IoBackend backend() const = 0;
+
+	// whether the files opened so far all bypass the page cache, false once one was refused O_DIRECT
+	virtual bool direct() const = 0;
+};
+
+// falls back to pwrite if io_uring or its write opcode is unavailable and to buffered I/O if the filesystem refuses O_DIRECT
+std::unique_ptr<IoQueue> create_io_queue(IoBackend backend, bool direct, unsigned queue_depth);
+
+const char *io_backend_name(IoBackend backend);
+bool parse_io_backend(const std::string &name, IoBackend &backend);
+
+// writes total_mb of data next to path with each backend and prints the throughput
+void run_io_benchmark(const std::string &path, std::size_t total_mb);
+
+// read only view of a whole file, for handing a large input to the GPU without copying it.
+// data is aligned to alignment (at least the page size) and mapped_size is the file size rounded
+// up to it, the bytes past the end of the file read as zero. POSIX only, false elsewhere
+struct MappedFile {
+	void *data;
+	std::size_t size;
+	std::size_t mapped_size;
+
+	// the reservation data was placed in, released as a whole
+	void *base;
+	std::size_t reserved_size;
+};
+
+bool map_file(const std::string &path, std::size_t alignment, MappedFile &file);
+void unmap_file(MappedFile &file);
+
+// anonymous memory backed by huge pages, size is rounded up to mapped_size. nullptr where the
+// system has none reserved (Linux only)
+void *hugepage_alloc(std::size_t size, std::size_t &mapped_size);
+void hugepage_free(void *ptr, std::size_t mapped_size);
@@ -0,0 +1,182 @@
+// shared by the force and integrate passes, included with GL_GOOGLE_include_directive
+
+struct Particle {
+	vec4 position;
+	vec4 velocity;
+};
+
+#ifdef NBODY_BDA
+#extension GL_EXT_buffer_reference : require
+
+// -bda builds: no descriptor set, the buffers are reached through device addresses pushed
+// along with the step constants. the macros below keep the kernels source compatible
+layout(buffer_reference, std430, buffer_reference_align = 16) buffer BodyRef {
+	Particle particles[];
+};
+
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer UBORef {
+	float delta_time;
+	uint particle_count;
+	float gravity;
+	float softening;
+	float unit_scale;
+};
+
+layout(buffer_reference, std430, buffer_reference_align = 16) buffer AccelRef {
+	vec4 accel[];
+};
+
+layout(buffer_reference, std430, buffer_reference_align = 4) buffer DispatchRef {
+	uint active_count;
+	uint force_groups[3];
+	uint integrate_groups[3];
+	uint owned_first;
+	uint owned_count;
+	uint j_first;
+	uint j_count;
+	uint accel_slot;
+};
+
+// matches StepAddressConstants
+layout(push_constant) uniform StepConstants {
+	float delta_time;
+	uint step;
+	BodyRef bodies;
+	UBORef uniforms;
+	AccelRef accels;
+	DispatchRef dispatch_args;
+} pc;
+
+#define buf pc.bodies
+#define ubo pc.uniforms
+#define acc pc.accels
+#define dispatch pc.dispatch_args
+#else
+// defined as coherent by nbody_persistent.comp, whose workgroups read each other's writes
+#ifndef NBODY_COHERENT
+#define NBODY_COHERENT
+#endif
+
+layout(set = 0, binding = 0, std430) NBODY_COHERENT buffer bodybuf {
+	Particle particles[];
+} buf;
+
+// delta_time in the UBO is only read by particle_attraction.comp, see StepConstants
+layout(binding = 1) uniform UBO {
+	float delta_time;
+	uint particle_count;
+	float gravity;    // G
+	float softening;  // Plummer epsilon or spline kernel radius, in length units
+	float unit_scale; // multiplies G * m, converts the mass unit
+} ubo;
+
+// recorded into every step's command buffer
+layout(push_constant) uniform StepConstants {
+	float delta_time;
+	uint step;
+} pc;
+
+// written by the force pass, consumed by the integrate pass
+layout(set = 0, binding = 2, std430) buffer accelbuf {
+	vec4 accel[];
+} acc;
+
+// bodies the force and integrate passes cover and the indirect dispatch arguments
+// nbody_dispatch_args.comp derives from them, see DispatchArgs
+layout(set = 0, binding = 4, std430) buffer dispatchbuf {
+	uint active_count;
+	uint force_groups[3];
+	uint integrate_groups[3];
+	uint owned_first;
+	uint owned_count;
+	uint j_first;
+	uint j_count;
+	uint accel_slot;
+} dispatch;
+#endif
+
+// the i-range this device computes forces for and integrates, every active body unless
+// -multi-gpu gave the rest to other devices
+uint owned_first() {
+	return min(dispatch.owned_first, dispatch.active_count);
+}
+
+uint owned_end() {
+	return min(dispatch.owned_first + dispatch.owned_count, dispatch.active_count);
+}
+
+// the j-range the tiled and subgroup kernels sum over and the partial slot they write. the
+// whole active set into slot 0, except for the stages of -multi-gpu ring which each cover
+// the block resident on the device
+uint j_first() {
+	return min(dispatch.j_first, dispatch.active_count);
+}
+
+uint j_end() {
+	return min(dispatch.j_first + dispatch.j_count, dispatch.active_count);
+}
+
+// force laws, picked by the host
+const uint force_law_legacy = 0u;
+const uint force_law_plummer = 1u;
+const uint force_law_spline = 2u;
+
+layout(constant_id = 2) const uint force_law = force_law_legacy;
+
+// acceleration of a body at pi caused by pj. pj.w is the weight of pj, 0 for the padding past
+// particle_count. every body has unit mass
+vec3 body_accel(vec3 pi, vec4 pj) {
+	vec3 len = pj.xyz - pi;
+	float r2 = dot(len, len);
+	float gm = ubo.gravity * ubo.unit_scale * pj.w;
+
+	if (force_law == force_law_plummer) {
+		// inverse cube softened by epsilon^2, one inversesqrt instead of pow
+		float inv_r = inversesqrt(r2 + ubo.softening * ubo.softening);
+		return len * (gm * inv_r * inv_r * inv_r);
+	} else if (force_law == force_law_spline) {
+		// cubic spline softening (Monaghan & Lattanzio), exact Newtonian beyond the kernel radius
+		float h = ubo.softening;
+		float r = sqrt(r2);
+
+		if (r >= h)
+			return len * (gm / (r2 * r));
+
+		float h_inv3 = 1.0 / (h * h * h);
+		float u = r / h;
+		float f = u < 0.5
+			? 10.666666666667 + u * u * (32.0 * u - 38.4)
+			: 21.333333333333 - 48.0 * u + 38.4 * u * u - 10.666666666667 * u * u * u - 0.066666666667 / (u * u * u);
+		return len * (gm * h_inv3 * f);
+	}
+
+	// same law as particle_attraction.comp without its delta_time factor. not physical, the
+	// denominator goes as r^1.5
+	return len * gm / pow(r2 + ubo.softening * ubo.softening, 0.75);
+}
+
+// potential of a body at pi due to pj, weighted like body_accel. the gradient of each law is
+// the matching branch of body_accel, pair_potential in nbody_cpu.cpp is the host copy
+float body_potential(vec3 pi, vec4 pj) {
+	vec3 len = pj.xyz - pi;
+	float r2 = dot(len, len);
+	float gm = ubo.gravity * ubo.unit_scale * pj.w;
+	float eps = ubo.softening;
+
+	if (force_law == force_law_plummer)
+		return -gm * inversesqrt(r2 + eps * eps);
+
+	if (force_law == force_law_spline) {
+		float r = sqrt(r2);
+		if (r >= eps)
+			return -gm / r;
+
+		float u = r / eps;
+		float w = u < 0.5
+			? -2.8 + u * u * (5.333333333333 + u * u * (6.4 * u - 9.6))
+			: -3.2 + 0.066666666667 / u + u * u * (10.666666666667 + u * (-16.0 + u * (9.6 - 2.133333333333 * u)));
+		return gm / eps * w;
+	}
+
+	return 2.0 * gm * sqrt(sqrt(r2 + eps * eps));
+}
@@ -0,0 +1,206 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or
+ * distribute this software, either in source code form or as a compiled
+ * binary, for any purpose, commercial or non-commercial, and by any
+ * means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors
+ * of this software dedicate any and all copyright interest in the
+ * software to the public domain. We make this dedication for the benefit
+ * of the public at large and to the detriment of our heirs and
+ * successors. We intend this dedication to be an overt act of
+ * relinquishment in perpetuity of all present and future rights to this
+ * software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "nbody_cpu.h"
+#include "thread_pool.h"
+
+// rows are dealt out round robin so the triangular pair loop balances across the pool
+static const std::size_t energy_jobs = 256;
+static const std::size_t step_jobs = 256;
+
+const char *force_law_name(const ForceLaw law) {
+	switch (law) {
+	case ForceLaw::legacy: return "legacy";
+	case ForceLaw::plummer: return "plummer";
+	case ForceLaw::spline: return "spline";
+	}
+
+	return "unknown";
+}
+
+bool parse_force_law(const std::string_view name, ForceLaw &law) {
+	for (const auto l : { ForceLaw::legacy, ForceLaw::plummer, ForceLaw::spline }) {
+		if (name == force_law_name(l)) {
+			law = l;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// potential of one pair, gm is G * unit scale * m. the gradient of each is the matching law in body_accel
+static double pair_potential(const double r2, const double gm, const ForceParams &params) {
+	const double eps = params.softening;
+
+	switch (params.law) {
+	case ForceLaw::plummer:
+		return -gm / std::sqrt(r2 + eps * eps);
+	case ForceLaw::spline: {
+		// Monaghan & Lattanzio cubic spline, Newtonian beyond the kernel radius
+		const double r = std::sqrt(r2);
+		if (r >= eps)
+			return -gm / r;
+
+		const double u = r / eps;
+		const double w = u < 0.5
+			? -2.8 + u * u * (5.333333333333 + u * u * (6.4 * u - 9.6))
+			: -3.2 + 0.066666666667 / u + u * u * (10.666666666667 + u * (-16.0 + u * (9.6 - 2.133333333333 * u)));
+		return gm / eps * w;
+	}
+	case ForceLaw::legacy:
+		break;
+	}
+
+	// the force goes as len / (r^2 + eps^2)^0.75, the potential as the fourth root
+	return 2.0 * gm * std::sqrt(std::sqrt(r2 + eps * eps));
+}
+
+double nbody_total_energy(const Particle *particles, const std::size_t count, const ForceParams &params, ThreadPool &pool) {
+	const double gm = static_cast<double>(params.gravity) * params.unit_scale;
+	std::vector<double> partial(energy_jobs, 0.0);
+
+	pool.parallel_for(energy_jobs, [&](const std::size_t job) {
+		double sum = 0.0;
+
+		for (std::size_t i = job; i < count; i += energy_jobs) {
+			const auto &pi = particles[i].position.components;
+			const auto &vi = particles[i].velocity.components;
+
+			sum += 0.5 * (static_cast<double>(vi.x) * vi.x + static_cast<double>(vi.y) * vi.y + static_cast<double>(vi.z) * vi.z);
+
+			for (std::size_t j = i + 1; j < count; j++) {
+				const auto &pj = particles[j].position.components;
+				const double dx = static_cast<double>(pj.x) - pi.x;
+				const double dy = static_cast<double>(pj.y) - pi.y;
+				const double dz = static_cast<double>(pj.z) - pi.z;
+
+				sum += pair_potential(dx * dx + dy * dy + dz * dz, gm, params);
+			}
+		}
+
+		partial[job] = sum;
+	});
+
+	double energy = 0.0;
+	for (const double sum : partial)
+		energy += sum;
+
+	return energy;
+}
+
+// body_accel of nbody_common.glsl
+static void body_accel(const float *pi, const float *pj, const ForceParams &params, float *a) {
+	const float len[3] = { pj[0] - pi[0], pj[1] - pi[1], pj[2] - pi[2] };
+	const float r2 = len[0] * len[0] + len[1] * len[1] + len[2] * len[2];
+	const float gm = params.gravity * params.unit_scale;
+	const float eps = params.softening;
+	float f;
+
+	switch (params.law) {
+	case ForceLaw::plummer: {
+		const float inv_r = 1.f / std::sqrt(r2 + eps * eps);
+		f = gm * inv_r * inv_r * inv_r;
+		break;
+	}
+	case ForceLaw::spline: {
+		const float r = std::sqrt(r2);
+		if (r >= eps) {
+			f = gm / (r2 * r);
+			break;
+		}
+
+		const float u = r / eps;
+		const float w = u < 0.5f
+			? 10.666666666667f + u * u * (32.f * u - 38.4f)
+			: 21.333333333333f - 48.f * u + 38.4f * u * u - 10.666666666667f * u * u * u - 0.066666666667f / (u * u * u);
+		f = gm / (eps * eps * eps) * w;
+		break;
+	}
+	default:
+		f = gm / std::pow(r2 + eps * eps, 0.75f);
+		break;
+	}
+
+	a[0] += len[0] * f;
+	a[1] += len[1] * f;
+	a[2] += len[2] * f;
+}
+
+// hi + lo += b with Knuth's two-sum, the same sequence as ds_add in nbody_integrate_ds.comp
+static void ds_add(float &hi, float &lo, const float b) {
+	const float s = hi + b;
+	const float v = s - hi;
+	float e = (hi - (s - v)) + (b - v);
+	e += lo;
+
+	hi = s + e;
+	lo = e - (hi - s);
+}
+
+void nbody_cpu_step(Particle *particles, vec4 *position_lo, const std::size_t count, const float delta_time, const ForceParams &params, ThreadPool &pool) {
+	std::vector<float> accel(count * 3, 0.f);
+
+	// every body sums its j-bodies in index order, as the tiled kernel does
+	pool.parallel_for(step_jobs, [&](const std::size_t job) {
+		for (std::size_t i = job; i < count; i += step_jobs) {
+			for (std::size_t j = 0; j < count; j++)
+				body_accel(particles[i].position.data, particles[j].position.data, params, &accel[i * 3]);
+		}
+	});
+
+	for (std::size_t i = 0; i < count; i++) {
+		float *x = particles[i].position.data;
+		float *v = particles[i].velocity.data;
+
+		for (std::size_t k = 0; k < 3; k++) {
+			v[k] += accel[i * 3 + k] * delta_time;
+
+			if (position_lo != nullptr)
+				ds_add(x[k], position_lo[i].data[k], v[k] * delta_time);
+			else
+				x[k] += v[k] * delta_time;
+		}
+	}
+}
+
+NbodyDifference nbody_max_difference(const Particle *a, const Particle *b, const std::size_t count) {
+	NbodyDifference diff = { 0.0, 0.0 };
+
+	for (std::size_t i = 0; i < count; i++) {
+		for (std::size_t k = 0; k < 3; k++) {
+			diff.position = std::max(diff.position, std::abs(static_cast<double>(a[i].position.data[k]) - b[i].position.data[k]));
+			diff.velocity = std::max(diff.velocity, std::abs(static_cast<double>(a[i].velocity.data[k]) - b[i].velocity.data[k]));
+		}
+	}
+
+	return diff;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+
+#include "particle.h"
+
+struct ThreadPool;
+
+// host side mirror of the two-pass GPU kernels, used for diagnostics and validation
+
+// force_law values of nbody_common.glsl
+enum class ForceLaw : std::uint32_t {
+	legacy,  // particle_attraction.comp
+	plummer, // Plummer softened inverse cube
+	spline   // cubic spline softened
+};
+
+struct ForceParams {
+	ForceLaw law;
+	float gravity;
+	float softening;
+	float unit_scale;
+};
+
+const char *force_law_name(ForceLaw law);
+bool parse_force_law(std::string_view name, ForceLaw &law);
+
+// kinetic plus potential energy of the unit mass bodies, accumulated in double. the potential
+// is the pairwise sum, O(N^2), split across the pool
+double nbody_total_energy(const Particle *particles, std::size_t count, const ForceParams &params, ThreadPool &pool);
+
+// one step of the force and integrate passes, forces in fp32 like the GPU. position_lo is
+// null for fp32 positions, otherwise the low words of the double-single positions, kept the
+// way nbody_integrate_ds.comp keeps them
+void nbody_cpu_step(Particle *particles, vec4 *position_lo, std::size_t count, float delta_time, const ForceParams &params, ThreadPool &pool);
+
+// largest per component difference between two states, positions and velocities
+struct NbodyDifference {
+	double position;
+	double velocity;
+};
+
+NbodyDifference nbody_max_difference(const Particle *a, const Particle *b, std::size_t count);
@@ -0,0 +1,30 @@
+// fp16 copy of the positions read by the half force kernels, include after nbody_common.glsl.
+// positions are stored relative to the centre of the bounding box of the step and divided by
+// its largest half extent, so every coordinate lands in [-1, 1] where halves are densest.
+// the bounds come from snapshot_bounds.comp, which sees this buffer at binding 2
+layout(set = 0, binding = 3, std430) buffer halfbuf {
+	uint bounds_min[4];
+	uint bounds_max[4];
+	uvec2 position[]; // packHalf2x16 of x, y and of z, weight
+} hbuf;
+
+float unorder_float(uint u) {
+	return uintBitsToFloat((u & 0x80000000u) != 0u ? u & 0x7fffffffu : ~u);
+}
+
+vec3 half_bounds_min() {
+	return vec3(unorder_float(hbuf.bounds_min[0]), unorder_float(hbuf.bounds_min[1]), unorder_float(hbuf.bounds_min[2]));
+}
+
+vec3 half_bounds_max() {
+	return vec3(unorder_float(hbuf.bounds_max[0]), unorder_float(hbuf.bounds_max[1]), unorder_float(hbuf.bounds_max[2]));
+}
+
+vec3 half_origin() {
+	return 0.5 * (half_bounds_min() + half_bounds_max());
+}
+
+float half_scale() {
+	vec3 extent = 0.5 * (half_bounds_max() - half_bounds_min());
+	return max(max(extent.x, extent.y), max(extent.z, 1e-30));
+}
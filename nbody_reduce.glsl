@@ -0,0 +1,38 @@
+// conserved quantity reductions, include after nbody_common.glsl. nbody_reduce.comp leaves one
+// partial sum per workgroup, nbody_reduce_final.comp adds them up into result, which is all
+// the host reads back. every body has unit mass
+struct Reduction {
+	float kinetic;
+	float potential;
+	float padding[2];
+	vec4 momentum;
+	vec4 angular_momentum;
+	vec4 center_of_mass; // sum of the positions until the final pass divides it by the body count
+};
+
+layout(set = 0, binding = 3, std430) buffer reducebuf {
+	Reduction result;
+	Reduction partials[];
+} red;
+
+// both passes run 256 invocations per workgroup
+shared vec2 group_energy[256];
+shared vec3 group_momentum[256];
+shared vec3 group_angular_momentum[256];
+shared vec3 group_center[256];
+
+// tree reduction of the shared arrays, the sums end up in slot 0
+void reduce_group(uint lid) {
+	barrier();
+
+	for (uint stride = 128u; stride > 0u; stride >>= 1) {
+		if (lid < stride) {
+			group_energy[lid] += group_energy[lid + stride];
+			group_momentum[lid] += group_momentum[lid + stride];
+			group_angular_momentum[lid] += group_angular_momentum[lid + stride];
+			group_center[lid] += group_center[lid + stride];
+		}
+
+		barrier();
+	}
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+union vec4 {
+	float data[4];
+
+	struct {
+		float x, y, z, w;
+	} components;
+};
+
+// matches the std430 Particle in the compute shaders
+struct Particle {
+	vec4 position;
+	vec4 velocity;
+};
+
+static_assert(sizeof(Particle) == 32, "Particle must match the shader layout");
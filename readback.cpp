@@ -0,0 +1,69 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or
+ * distribute this software, either in source code form or as a compiled
+ * binary, for any purpose, commercial or non-commercial, and by any
+ * means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors
+ * of this software dedicate any and all copyright interest in the
+ * software to the public domain. We make this dedication for the benefit
+ * of the public at large and to the detriment of our heirs and
+ * successors. We intend this dedication to be an overt act of
+ * relinquishment in perpetuity of all present and future rights to this
+ * software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ */
+
+#include <algorithm>
+
+#include "readback.h"
+
+ReadbackPlan::ReadbackPlan() {
+	this->consumers = 0;
+}
+
+void ReadbackPlan::request(const ReadbackConsumer consumer, const std::uint64_t offset, const std::uint64_t size) {
+	this->consumers |= 1u << static_cast<std::uint32_t>(consumer);
+	this->requested.push_back(ReadbackRange { .offset = offset, .size = size });
+}
+
+void ReadbackPlan::clear() {
+	this->consumers = 0;
+	this->requested.clear();
+}
+
+std::vector<ReadbackRange> ReadbackPlan::ranges() const {
+	std::vector<ReadbackRange> sorted = this->requested;
+	std::sort(sorted.begin(), sorted.end(), [](const ReadbackRange &a, const ReadbackRange &b) { return a.offset < b.offset; });
+
+	std::vector<ReadbackRange> merged;
+	for (const auto &range : sorted) {
+		if (!merged.empty() && range.offset <= merged.back().offset + merged.back().size) {
+			const std::uint64_t end = std::max(merged.back().offset + merged.back().size, range.offset + range.size);
+			merged.back().size = end - merged.back().offset;
+		} else {
+			merged.push_back(range);
+		}
+	}
+
+	return merged;
+}
+
+std::uint64_t ReadbackPlan::bytes() const {
+	std::uint64_t total = 0;
+	for (const auto &range : this->ranges())
+		total += range.size;
+
+	return total;
+}
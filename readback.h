@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// the consumers of the particle buffer on the host. each registers the byte ranges it needs
+// ahead of a submit, and the DEV->HOST copy of that submit covers only their union
+enum class ReadbackConsumer : std::uint32_t {
+	snapshot, // full buffer on snapshot steps
+	dump,     // particle 0, one shot from the dump command
+	energy,   // full buffer, one shot when a stats line asks for the CPU energy
+	validate, // full buffer on every step the CPU mirror runs
+	gather    // owned range on every submit of -multi-gpu, for the other devices
+};
+
+struct ReadbackRange {
+	std::uint64_t offset;
+	std::uint64_t size;
+};
+
+// collects the requests for one submit of one device
+struct ReadbackPlan {
+	ReadbackPlan();
+
+	void request(ReadbackConsumer consumer, std::uint64_t offset, std::uint64_t size);
+	void clear();
+
+	bool empty() const { return this->consumers == 0; }
+	bool wants(ReadbackConsumer consumer) const { return (this->consumers & (1u << static_cast<std::uint32_t>(consumer))) != 0; }
+
+	// the requested ranges sorted by offset, overlapping and adjacent ones merged
+	std::vector<ReadbackRange> ranges() const;
+	std::uint64_t bytes() const;
+
+private:
+	std::uint32_t consumers;
+	std::vector<ReadbackRange> requested;
+};
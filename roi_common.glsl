@@ -0,0 +1,75 @@
+// region of interest selection, shared by roi_select.comp, roi_scan.comp and roi_compact.comp.
+// the host writes the predicate and clears the counts with vkCmdUpdateBuffer before the first
+// pass, see RoiParams
+struct Particle {
+	vec4 position;
+	vec4 velocity;
+};
+
+layout(set = 0, binding = 0, std430) readonly buffer bodybuf {
+	Particle particles[];
+} buf;
+
+layout(binding = 1) uniform UBO {
+	float delta_time;
+	uint particle_count;
+} ubo;
+
+const uint roi_box = 0u;
+const uint roi_sphere = 1u;
+const uint roi_speed = 2u;
+
+// the id is the index of the particle in bodybuf
+struct RoiParticle {
+	Particle particle;
+	uint id;
+	uint padding[3];
+};
+
+layout(set = 0, binding = 2, std430) buffer roibuf {
+	uint kind;
+	uint capacity;
+	uint count;  // particles matching, may exceed capacity
+	uint stored; // min(count, capacity)
+	vec4 a;      // box min, sphere centre with the radius in w, speed threshold in x
+	vec4 b;      // box max
+	RoiParticle selected[];
+} roi;
+
+// matching particles per workgroup, turned into offsets by roi_scan.comp
+layout(set = 0, binding = 3, std430) buffer scanbuf {
+	uint group_offset[];
+} scan;
+
+bool roi_match(uint i) {
+	if (i >= ubo.particle_count)
+		return false;
+
+	Particle p = buf.particles[i];
+
+	if (roi.kind == roi_box)
+		return all(greaterThanEqual(p.position.xyz, roi.a.xyz)) && all(lessThanEqual(p.position.xyz, roi.b.xyz));
+	else if (roi.kind == roi_sphere)
+		return distance(p.position.xyz, roi.a.xyz) <= roi.a.w;
+
+	return length(p.velocity.xyz) > roi.a.x;
+}
+
+// every pass runs 256 invocations per workgroup
+shared uint group_scan[256];
+
+// inclusive scan of value across the workgroup, returns the exclusive prefix of lid. the total
+// is left in group_scan[255]
+uint scan_group(uint lid, uint value) {
+	group_scan[lid] = value;
+	barrier();
+
+	for (uint offset = 1u; offset < 256u; offset <<= 1) {
+		uint v = lid >= offset ? group_scan[lid - offset] : 0u;
+		barrier();
+		group_scan[lid] += v;
+		barrier();
+	}
+
+	return group_scan[lid] - value;
+}
@@ -0,0 +1,132 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or
+ * distribute this software, either in source code form or as a compiled
+ * binary, for any purpose, commercial or non-commercial, and by any
+ * means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors
+ * of this software dedicate any and all copyright interest in the
+ * software to the public domain. We make this dedication for the benefit
+ * of the public at large and to the detriment of our heirs and
+ * successors. We intend this dedication to be an overt act of
+ * relinquishment in perpetuity of all present and future rights to this
+ * software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ */
+
+#include <vector>
+#include <cstring>
+
+#include "snapshot_codec.h"
+
+// token byte: 0x00-0x7f literal run of token+1 bytes follows, 0x80-0xff run of (token&0x7f)+1 zero bytes
+static const std::size_t max_run = 128;
+
+std::size_t snapshot_codec_bound(std::size_t size) {
+	return size + (size + max_run - 1) / max_run;
+}
+
+std::size_t snapshot_codec_encode(const unsigned char *src, const unsigned char *prev, std::size_t size, std::size_t element_size, unsigned char *dst) {
+	thread_local std::vector<unsigned char> shuffled;
+	shuffled.resize(size);
+
+	const std::size_t num_elements = size / element_size;
+
+	for (std::size_t lane = 0; lane < element_size; lane++) {
+		unsigned char *plane = shuffled.data() + lane * num_elements;
+
+		if (prev != nullptr) {
+			for (std::size_t k = 0; k < num_elements; k++)
+				plane[k] = src[k * element_size + lane] ^ prev[k * element_size + lane];
+		} else {
+			for (std::size_t k = 0; k < num_elements; k++)
+				plane[k] = src[k * element_size + lane];
+		}
+	}
+
+	const unsigned char *in = shuffled.data();
+	std::size_t i = 0, out = 0;
+
+	while (i < size) {
+		std::size_t run = 0;
+
+		if (in[i] == 0) {
+			while (i + run < size && run < max_run && in[i + run] == 0)
+				run++;
+
+			dst[out++] = static_cast<unsigned char>(0x80 | (run - 1));
+		} else {
+			// single zeros stay inside the literal, splitting it would cost more than they save
+			while (i + run < size && run < max_run && (in[i + run] != 0 || (i + run + 1 < size && in[i + run + 1] != 0)))
+				run++;
+
+			dst[out++] = static_cast<unsigned char>(run - 1);
+			std::memcpy(dst + out, in + i, run);
+			out += run;
+		}
+
+		i += run;
+
+		if (out >= size)
+			return 0;
+	}
+
+	return out;
+}
+
+bool snapshot_codec_decode(const unsigned char *src, std::size_t src_size, const unsigned char *prev, std::size_t size, std::size_t element_size, unsigned char *dst) {
+	thread_local std::vector<unsigned char> shuffled;
+	shuffled.resize(size);
+
+	std::size_t i = 0, out = 0;
+
+	while (i < src_size) {
+		const unsigned char token = src[i++];
+		const std::size_t run = (token & 0x7f) + 1;
+
+		if (out + run > size)
+			return false;
+
+		if (token & 0x80) {
+			std::memset(shuffled.data() + out, 0, run);
+		} else {
+			if (i + run > src_size)
+				return false;
+
+			std::memcpy(shuffled.data() + out, src + i, run);
+			i += run;
+		}
+
+		out += run;
+	}
+
+	if (out != size)
+		return false;
+
+	const std::size_t num_elements = size / element_size;
+
+	for (std::size_t lane = 0; lane < element_size; lane++) {
+		const unsigned char *plane = shuffled.data() + lane * num_elements;
+
+		if (prev != nullptr) {
+			for (std::size_t k = 0; k < num_elements; k++)
+				dst[k * element_size + lane] = plane[k] ^ prev[k * element_size + lane];
+		} else {
+			for (std::size_t k = 0; k < num_elements; k++)
+				dst[k * element_size + lane] = plane[k];
+		}
+	}
+
+	return true;
+}
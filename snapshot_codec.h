@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// lossless float codec for snapshot chunks. the input is XORed against the same chunk of the
+// previous snapshot (when there is one) so that unchanged bits become zero, byte-shuffled so the
+// slowly changing sign/exponent bytes of every element end up next to each other, and then
+// zero-run-length coded. no external dependencies, roughly memcpy speed.
+
+// largest encoded size for size input bytes
+std::size_t snapshot_codec_bound(std::size_t size);
+
+// returns the encoded size, or 0 when encoding would not make the chunk smaller.
+// prev may be null, size must be a multiple of element_size
+std::size_t snapshot_codec_encode(const unsigned char *src, const unsigned char *prev, std::size_t size, std::size_t element_size, unsigned char *dst);
+
+// prev must be the same reference that was given to the encoder
+bool snapshot_codec_decode(const unsigned char *src, std::size_t src_size, const unsigned char *prev, std::size_t size, std::size_t element_size, unsigned char *dst);
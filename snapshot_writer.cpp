@@ -0,0 +1,309 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or
+ * distribute this software, either in source code form or as a compiled
+ * binary, for any purpose, commercial or non-commercial, and by any
+ * means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors
+ * of this software dedicate any and all copyright interest in the
+ * software to the public domain. We make this dedication for the benefit
+ * of the public at large and to the detriment of our heirs and
+ * successors. We intend this dedication to be an overt act of
+ * relinquishment in perpetuity of all present and future rights to this
+ * software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ */
+
+#ifndef _CRT_SECURE_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "snapshot_writer.h"
+
+// each write is split so that io_uring can keep several of them in flight
+static const std::size_t write_chunk_size = 1 << 20;
+static const unsigned io_queue_depth = 16;
+
+SnapshotWriter::SnapshotWriter(const std::string &path_prefix, std::size_t num_devices, std::size_t queue_capacity, std::uint32_t particle_count, SnapshotPolicy policy, IoBackend backend, bool direct, bool compress, std::uint32_t keyframe_interval, std::uint32_t quantize_bits) {
+	this->policy = policy;
+	this->compress = compress;
+	this->stop = false;
+	this->bytes_written.assign(num_devices, 0);
+	this->bytes_written_at_last_stats.assign(num_devices, 0);
+	this->written.assign(num_devices, 0);
+	this->failed.assign(num_devices, 0);
+	this->last_stats_time.assign(num_devices, std::chrono::steady_clock::now());
+	this->dropped = 0;
+	this->raw_bytes = 0;
+	this->encoded_bytes = 0;
+	this->encode_seconds = 0.0;
+
+	this->io = create_io_queue(backend, direct, io_queue_depth);
+	if (compress)
+		this->encode_pool = std::make_unique<ThreadPool>(std::max(std::thread::hardware_concurrency(), 1u));
+
+	// every file starts with the same header block, which has to outlive its writes
+	this->file_header = static_cast<unsigned char *>(io_buffer_alloc(io_alignment));
+	trajectory_encode_file_header(this->file_header);
+
+	for (std::size_t i = 0; i < num_devices; i++) {
+		this->files.push_back(this->io->open(path_prefix + "-gpu" + std::to_string(i) + ".traj"));
+		this->file_offsets.push_back(io_alignment);
+		this->file_index.emplace_back();
+		this->encoders.emplace_back(particle_count, compress, keyframe_interval, this->encode_pool.get());
+		this->file_tags.push_back(i);
+	}
+
+	// file_tags is not resized again, its entries keep their addresses until the index is written
+	for (std::size_t i = 0; i < num_devices; i++)
+		this->io->submit(this->files[i], this->file_header, io_alignment, 0, &this->file_tags[i]);
+
+	// after the files are open, O_DIRECT may have been refused for them
+	std::printf("Snapshot writer: %s%s", io_backend_name(this->io->backend()), this->io->direct() ? " O_DIRECT" : "");
+	if (compress)
+		std::printf(", compressed on %zu threads, keyframe every %u", this->encode_pool->size(), std::max(keyframe_interval, 1u));
+	if (quantize_bits != 0)
+		std::printf(", quantized to %u bits on the GPU", quantize_bits);
+	std::printf("\n");
+
+	this->pool.resize(queue_capacity);
+	for (auto &buf : this->pool) {
+		if (quantize_bits != 0)
+			buf.quantized.resize(trajectory_quantized_size(particle_count, quantize_bits));
+		else
+			buf.particles.resize(particle_count);
+
+		buf.position_bits = quantize_bits;
+		buf.capacity = this->encoders.front().capacity();
+		buf.data = static_cast<unsigned char *>(io_buffer_alloc(buf.capacity));
+		buf.record_size = 0;
+		buf.pending_writes = 0;
+		buf.write_failed = false;
+
+		this->free_bufs.push_back(&buf);
+	}
+
+	this->thread = std::thread(&SnapshotWriter::thread_func, this);
+}
+
+SnapshotWriter::~SnapshotWriter() {
+	// drain whatever is still queued before shutting down
+	{
+		std::unique_lock<std::mutex> lock(this->mtx);
+		this->stop = true;
+	}
+
+	this->pending_cv.notify_one();
+	this->thread.join();
+
+	this->write_index();
+	this->io->sync();
+	this->io.reset();
+
+	for (auto &buf : this->pool)
+		io_buffer_free(buf.data);
+
+	io_buffer_free(this->file_header);
+}
+
+SnapshotBuffer *SnapshotWriter::acquire() {
+	std::unique_lock<std::mutex> lock(this->mtx);
+
+	if (this->free_bufs.empty()) {
+		if (this->policy == SnapshotPolicy::drop) {
+			this->dropped++;
+			return nullptr;
+		}
+
+		this->free_cv.wait(lock, [this] { return !this->free_bufs.empty(); });
+	}
+
+	SnapshotBuffer *buf = this->free_bufs.back();
+	this->free_bufs.pop_back();
+
+	return buf;
+}
+
+void SnapshotWriter::submit(SnapshotBuffer *buf) {
+	{
+		std::unique_lock<std::mutex> lock(this->mtx);
+		this->pending_bufs.push_back(buf);
+	}
+
+	this->pending_cv.notify_one();
+}
+
+SnapshotStats SnapshotWriter::get_stats(const std::size_t device) {
+	std::unique_lock<std::mutex> lock(this->mtx);
+
+	const auto now = std::chrono::steady_clock::now();
+	const double elapsed = std::chrono::duration_cast<std::chrono::duration<double>>(now - this->last_stats_time[device]).count();
+	const std::uint64_t bytes = this->bytes_written[device] - this->bytes_written_at_last_stats[device];
+
+	this->last_stats_time[device] = now;
+	this->bytes_written_at_last_stats[device] = this->bytes_written[device];
+
+	return SnapshotStats {
+		.mb_per_sec = elapsed > 0.0 ? static_cast<double>(bytes) / (1024.0 * 1024.0) / elapsed : 0.0,
+		.queue_depth = this->pending_bufs.size(),
+		.queue_capacity = this->pool.size(),
+		.written = this->written[device],
+		.failed = this->failed[device],
+		.dropped = this->dropped,
+		.compression_ratio = this->encoded_bytes > 0 ? static_cast<double>(this->raw_bytes) / static_cast<double>(this->encoded_bytes) : 0.0,
+		.encode_mb_per_sec = this->encode_seconds > 0.0 ? static_cast<double>(this->raw_bytes) / (1024.0 * 1024.0) / this->encode_seconds : 0.0
+	};
+}
+
+void SnapshotWriter::thread_func() {
+	while (true) {
+		SnapshotBuffer *buf = nullptr;
+
+		{
+			std::unique_lock<std::mutex> lock(this->mtx);
+
+			// only sleep when there are no writes left to reap
+			if (this->io->in_flight() == 0)
+				this->pending_cv.wait(lock, [this] { return this->stop || !this->pending_bufs.empty(); });
+
+			if (!this->pending_bufs.empty()) {
+				buf = this->pending_bufs.front();
+				this->pending_bufs.pop_front();
+			} else if (this->io->in_flight() == 0) {
+				return;
+			}
+		}
+
+		if (buf != nullptr)
+			this->write(*buf);
+		else
+			this->reap();
+	}
+}
+
+void SnapshotWriter::write(SnapshotBuffer &buf) {
+	TrajectoryEncoder &encoder = this->encoders[buf.device];
+	if (buf.position_bits != 0)
+		buf.record_size = encoder.encode_quantized(buf.quantized.data(), buf.position_bits, static_cast<std::uint32_t>(buf.device), buf.step, buf.sim_time, buf.data);
+	else
+		buf.record_size = encoder.encode(buf.particles.data(), nullptr, static_cast<std::uint32_t>(buf.device), buf.step, buf.sim_time, buf.data);
+
+	{
+		std::unique_lock<std::mutex> lock(this->mtx);
+		this->raw_bytes = 0;
+		this->encoded_bytes = 0;
+		this->encode_seconds = 0.0;
+
+		for (const auto &enc : this->encoders) {
+			this->raw_bytes += enc.raw_bytes;
+			this->encoded_bytes += enc.encoded_bytes;
+			this->encode_seconds += enc.encode_seconds;
+		}
+	}
+
+	const std::size_t file = this->files[buf.device];
+	const std::uint64_t file_offset = this->file_offsets[buf.device];
+	this->file_offsets[buf.device] += buf.record_size;
+
+	this->file_index[buf.device].push_back(TrajectoryIndexEntry {
+		.step = buf.step,
+		.sim_time = buf.sim_time,
+		.offset = file_offset,
+		.size = buf.record_size
+	});
+
+	// set the count up front, earlier chunks may complete while later ones are being queued
+	buf.pending_writes = (buf.record_size + write_chunk_size - 1) / write_chunk_size;
+	buf.write_failed = false;
+
+	for (std::size_t offset = 0; offset < buf.record_size; offset += write_chunk_size) {
+		while (this->io->in_flight() >= io_queue_depth)
+			this->reap();
+
+		this->io->submit(file, buf.data + offset, std::min(write_chunk_size, buf.record_size - offset), file_offset + offset, &buf);
+	}
+}
+
+// files.size() for a record write
+std::size_t SnapshotWriter::tagged_file(const void *user_data) const {
+	for (std::size_t i = 0; i < this->file_tags.size(); i++) {
+		if (user_data == &this->file_tags[i])
+			return i;
+	}
+
+	return this->files.size();
+}
+
+void SnapshotWriter::reap() {
+	const IoCompletion completion = this->io->wait();
+
+	// file header and index writes carry a file tag instead of a buffer. without the header the
+	// file cannot be read at all, without the index only by scanning its records
+	const std::size_t file = this->tagged_file(completion.user_data);
+	if (file < this->files.size()) {
+		if (completion.failed) {
+			std::unique_lock<std::mutex> lock(this->mtx);
+			this->failed[file]++;
+			std::printf("! Snapshot writer: a file header or index write failed on GPU:%zu\n", file);
+		}
+
+		return;
+	}
+
+	auto *buf = static_cast<SnapshotBuffer *>(completion.user_data);
+	if (buf == nullptr)
+		return;
+
+	buf->write_failed = buf->write_failed || completion.failed;
+	if (--buf->pending_writes > 0)
+		return;
+
+	{
+		std::unique_lock<std::mutex> lock(this->mtx);
+		this->free_bufs.push_back(buf);
+
+		if (buf->write_failed) {
+			this->failed[buf->device]++;
+		} else {
+			this->bytes_written[buf->device] += buf->record_size;
+			this->written[buf->device]++;
+		}
+	}
+
+	this->free_cv.notify_one();
+}
+
+// runs after the writer thread has drained, so the io queue is ours
+void SnapshotWriter::write_index() {
+	std::vector<unsigned char *> index_bufs;
+
+	for (std::size_t i = 0; i < this->files.size(); i++) {
+		const std::size_t size = trajectory_index_size(this->file_index[i].size());
+		auto *index = static_cast<unsigned char *>(io_buffer_alloc(size));
+
+		trajectory_encode_index(this->file_index[i], this->file_offsets[i], index);
+		this->io->submit(this->files[i], index, size, this->file_offsets[i], &this->file_tags[i]);
+		index_bufs.push_back(index);
+	}
+
+	while (this->io->in_flight() > 0)
+		this->reap();
+
+	for (auto index : index_bufs)
+		io_buffer_free(index);
+}
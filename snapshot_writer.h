@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <deque>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <memory>
+
+#include "particle.h"
+#include "file_io.h"
+#include "thread_pool.h"
+#include "trajectory.h"
+
+// what to do when the writer falls behind and every queue slot is in use
+enum class SnapshotPolicy {
+	block, // stall the caller until a slot frees up (back-pressure)
+	drop   // skip the snapshot and count it as dropped
+};
+
+struct SnapshotBuffer {
+	std::size_t device;
+	std::uint64_t step;
+	double sim_time;
+	std::uint32_t particle_count;
+
+	// filled by the main loop straight from host_buf, or with the output of the GPU quantize
+	// pass when position_bits is not 0
+	std::vector<Particle> particles;
+	std::vector<unsigned char> quantized;
+	std::uint32_t position_bits;
+
+	// trajectory record encoded by the writer thread, io_alignment aligned
+	unsigned char *data;
+	std::size_t capacity;
+	std::size_t record_size;
+	std::size_t pending_writes;
+	bool write_failed;
+};
+
+// mb_per_sec, written and failed are the device's own, the queue and dropped are shared
+struct SnapshotStats {
+	double mb_per_sec;
+	std::size_t queue_depth;
+	std::size_t queue_capacity;
+	std::uint64_t written;
+	std::uint64_t failed;
+	std::uint64_t dropped;
+
+	// only meaningful with compression or quantization on
+	double compression_ratio;
+	double encode_mb_per_sec;
+};
+
+// owns a fixed pool of readback-sized buffers and a thread that drains them to disk.
+// the main loop acquires a free buffer, fills it from host_buf and submits it; the
+// pool size bounds the queue so a slow disk can never grow memory without limit.
+// the writer thread transposes each snapshot into a trajectory record and appends the
+// time index to every file when it shuts down. with compression on the chunks of a record
+// are encoded on a thread pool so the codec does not bound the snapshot rate.
+struct SnapshotWriter {
+	SnapshotWriter(const std::string &path_prefix, std::size_t num_devices, std::size_t queue_capacity, std::uint32_t particle_count, SnapshotPolicy policy, IoBackend backend, bool direct, bool compress, std::uint32_t keyframe_interval, std::uint32_t quantize_bits);
+	~SnapshotWriter();
+
+	SnapshotWriter(const SnapshotWriter &) = delete;
+	SnapshotWriter &operator=(const SnapshotWriter &) = delete;
+
+	// returns nullptr if the snapshot was dropped
+	SnapshotBuffer *acquire();
+	void submit(SnapshotBuffer *buf);
+	// the rate covers the time since the previous call for the same device
+	SnapshotStats get_stats(std::size_t device);
+
+private:
+	void thread_func();
+	void write(SnapshotBuffer &buf);
+	void reap();
+	void write_index();
+	std::size_t tagged_file(const void *user_data) const;
+
+	SnapshotPolicy policy;
+	bool compress;
+	std::unique_ptr<IoQueue> io;
+	std::unique_ptr<ThreadPool> encode_pool;
+	std::vector<TrajectoryEncoder> encoders;
+	std::vector<std::size_t> files;
+	std::vector<std::uint64_t> file_offsets;
+	std::vector<std::vector<TrajectoryIndexEntry>> file_index;
+	unsigned char *file_header;
+	std::vector<SnapshotBuffer> pool;
+
+	// user_data of the file header and index writes, one entry per file so a failure can be
+	// told apart from a record write and pinned on its device
+	std::vector<std::size_t> file_tags;
+
+	std::mutex mtx;
+	std::condition_variable free_cv, pending_cv;
+	std::vector<SnapshotBuffer *> free_bufs;
+	std::deque<SnapshotBuffer *> pending_bufs;
+	bool stop;
+
+	// per device, a record whose writes did not all succeed counts as failed, and so does a
+	// failed file header or index write
+	std::vector<std::uint64_t> bytes_written, bytes_written_at_last_stats;
+	std::vector<std::uint64_t> written, failed;
+	std::vector<std::chrono::steady_clock::time_point> last_stats_time;
+
+	std::uint64_t dropped;
+	std::uint64_t raw_bytes, encoded_bytes;
+	double encode_seconds;
+
+	std::thread thread;
+};
@@ -0,0 +1,101 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or
+ * distribute this software, either in source code form or as a compiled
+ * binary, for any purpose, commercial or non-commercial, and by any
+ * means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors
+ * of this software dedicate any and all copyright interest in the
+ * software to the public domain. We make this dedication for the benefit
+ * of the public at large and to the detriment of our heirs and
+ * successors. We intend this dedication to be an overt act of
+ * relinquishment in perpetuity of all present and future rights to this
+ * software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ */
+
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(std::size_t num_threads) {
+	this->job = nullptr;
+	this->job_count = 0;
+	this->next_idx = 0;
+	this->busy_workers = 0;
+	this->generation = 0;
+	this->stop = false;
+
+	// the thread calling parallel_for does its share of the work too
+	for (std::size_t i = 1; i < num_threads; i++)
+		this->threads.emplace_back(&ThreadPool::thread_func, this);
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::unique_lock<std::mutex> lock(this->mtx);
+		this->stop = true;
+	}
+
+	this->work_cv.notify_all();
+
+	for (auto &thread : this->threads)
+		thread.join();
+}
+
+void ThreadPool::run_job() {
+	for (std::size_t idx = this->next_idx++; idx < this->job_count; idx = this->next_idx++)
+		(*this->job)(idx);
+}
+
+void ThreadPool::parallel_for(std::size_t count, const std::function<void(std::size_t)> &func) {
+	{
+		std::unique_lock<std::mutex> lock(this->mtx);
+		this->job = &func;
+		this->job_count = count;
+		this->next_idx = 0;
+		this->busy_workers = this->threads.size();
+		this->generation++;
+	}
+
+	this->work_cv.notify_all();
+	this->run_job();
+
+	std::unique_lock<std::mutex> lock(this->mtx);
+	this->done_cv.wait(lock, [this] { return this->busy_workers == 0; });
+	this->job = nullptr;
+}
+
+void ThreadPool::thread_func() {
+	std::uint64_t seen_generation = 0;
+
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(this->mtx);
+			this->work_cv.wait(lock, [&] { return this->stop || this->generation != seen_generation; });
+
+			if (this->stop)
+				return;
+
+			seen_generation = this->generation;
+		}
+
+		this->run_job();
+
+		{
+			std::unique_lock<std::mutex> lock(this->mtx);
+			this->busy_workers--;
+		}
+
+		this->done_cv.notify_one();
+	}
+}
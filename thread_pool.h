@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+
+// fixed set of workers for data-parallel loops off the submission thread
+struct ThreadPool {
+	explicit ThreadPool(std::size_t num_threads);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	// runs func(i) for every i in [0, count) on the workers and the calling thread,
+	// returns once all of them are done
+	void parallel_for(std::size_t count, const std::function<void(std::size_t)> &func);
+
+	std::size_t size() const { return this->threads.size() + 1; }
+
+private:
+	void thread_func();
+	void run_job();
+
+	std::vector<std::thread> threads;
+
+	std::mutex mtx;
+	std::condition_variable work_cv, done_cv;
+	const std::function<void(std::size_t)> *job;
+	std::size_t job_count;
+	std::atomic<std::size_t> next_idx;
+	std::size_t busy_workers;
+	std::uint64_t generation;
+	bool stop;
+};
@@ -0,0 +1,909 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or
+ * distribute this software, either in source code form or as a compiled
+ * binary, for any purpose, commercial or non-commercial, and by any
+ * means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors
+ * of this software dedicate any and all copyright interest in the
+ * software to the public domain. We make this dedication for the benefit
+ * of the public at large and to the detriment of our heirs and
+ * successors. We intend this dedication to be an overt act of
+ * relinquishment in perpetuity of all present and future rights to this
+ * software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ */
+
+#ifndef _CRT_SECURE_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+#include "file_io.h"
+#include "snapshot_codec.h"
+#include "thread_pool.h"
+#include "trajectory.h"
+
+static const char file_magic[8] = { 'V', 'K', 'N', 'B', 'T', 'R', 'A', 'J' };
+static const char record_magic[8] = { 'V', 'K', 'N', 'B', 'S', 'N', 'A', 'P' };
+static const char footer_magic[8] = { 'V', 'K', 'N', 'B', 'T', 'I', 'D', 'X' };
+
+// chunks start on a cache line so readers can map them straight onto vec4 arrays
+static const std::size_t chunk_alignment = 64;
+
+static std::size_t align_up(const std::size_t size, const std::size_t alignment) {
+	return (size + alignment - 1) / alignment * alignment;
+}
+
+// inverse of the float to uint mapping the GPU bounds reduction uses for its atomics
+static float unorder_float(std::uint32_t bits) {
+	bits = (bits & 0x80000000u) != 0 ? bits & 0x7fffffffu : ~bits;
+
+	float value;
+	std::memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+static float half_to_float(std::uint16_t half) {
+	const std::uint32_t sign = static_cast<std::uint32_t>(half & 0x8000) << 16;
+	const std::uint32_t exponent = (half >> 10) & 0x1f;
+	std::uint32_t mantissa = half & 0x3ff;
+	std::uint32_t bits;
+
+	if (exponent == 0x1f) {
+		bits = sign | 0x7f800000u | (mantissa << 13);
+	} else if (exponent != 0) {
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+	} else if (mantissa != 0) {
+		// subnormal, renormalize
+		std::uint32_t e = 113;
+		while ((mantissa & 0x400) == 0) {
+			mantissa <<= 1;
+			e--;
+		}
+
+		bits = sign | (e << 23) | ((mantissa & 0x3ff) << 13);
+	} else {
+		bits = sign;
+	}
+
+	float value;
+	std::memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+// what the GPU bounds reduction stores, unorder_float's inverse
+static std::uint32_t order_float(float value) {
+	std::uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+
+	return (bits & 0x80000000u) != 0 ? ~bits : bits | 0x80000000u;
+}
+
+// round to nearest even like packHalf2x16, callers keep the value in the half range
+static std::uint16_t float_to_half(float value) {
+	std::uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+
+	const std::uint16_t sign = static_cast<std::uint16_t>((bits >> 16) & 0x8000);
+	bits &= 0x7fffffffu;
+
+	if (bits >= 0x47800000u)
+		return sign | 0x7c00;
+
+	std::uint32_t half, rest, halfway;
+
+	if (bits < 0x38800000u) {
+		// subnormal, 2^-25 and below round to zero
+		if (bits <= 0x33000000u)
+			return sign;
+
+		const std::uint32_t shift = 126 - (bits >> 23);
+		const std::uint32_t mantissa = (bits & 0x7fffffu) | 0x800000u;
+
+		half = mantissa >> shift;
+		rest = mantissa & ((1u << shift) - 1);
+		halfway = 1u << (shift - 1);
+	} else {
+		half = (bits >> 13) - (112u << 10);
+		rest = bits & 0x1fffu;
+		halfway = 0x1000u;
+	}
+
+	if (rest > halfway || (rest == halfway && (half & 1) != 0))
+		half++;
+
+	return static_cast<std::uint16_t>(sign | half);
+}
+
+std::uint32_t trajectory_chunk_count(std::uint32_t particle_count) {
+	return (particle_count + trajectory_chunk_particles - 1) / trajectory_chunk_particles;
+}
+
+std::size_t trajectory_column_element_size(TrajectoryColumn column) {
+	switch (column) {
+	case TrajectoryColumn::position: return sizeof(vec4);
+	case TrajectoryColumn::velocity: return sizeof(vec4);
+	case TrajectoryColumn::id: return sizeof(std::uint32_t);
+	case TrajectoryColumn::count: break;
+	}
+
+	return 0;
+}
+
+static std::size_t chunk_table_size(std::uint32_t particle_count) {
+	return align_up(sizeof(TrajectoryRecordHeader) + trajectory_column_count * trajectory_chunk_count(particle_count) * sizeof(TrajectoryChunk), chunk_alignment);
+}
+
+void trajectory_encode_file_header(unsigned char *out) {
+	TrajectoryFileHeader header = {
+		.magic = {},
+		.version = trajectory_version,
+		.header_size = static_cast<std::uint32_t>(io_alignment),
+		.chunk_particles = trajectory_chunk_particles,
+		.column_count = trajectory_column_count,
+		.column_element_size = {}
+	};
+
+	std::memcpy(header.magic, file_magic, sizeof(file_magic));
+	for (std::uint32_t column = 0; column < trajectory_column_count; column++)
+		header.column_element_size[column] = static_cast<std::uint32_t>(trajectory_column_element_size(static_cast<TrajectoryColumn>(column)));
+
+	std::memset(out, 0, io_alignment);
+	std::memcpy(out, &header, sizeof(header));
+}
+
+std::size_t trajectory_quantized_position_size(std::uint32_t particle_count, std::uint32_t position_bits) {
+	const std::size_t pairs = (particle_count + 1) / 2;
+	return pairs * (position_bits == 16 ? 3 : 4) * sizeof(std::uint32_t);
+}
+
+std::size_t trajectory_quantized_velocity_size(std::uint32_t particle_count) {
+	const std::size_t pairs = (particle_count + 1) / 2;
+	return pairs * 3 * sizeof(std::uint32_t);
+}
+
+std::size_t trajectory_quantized_size(std::uint32_t particle_count, std::uint32_t position_bits) {
+	return sizeof(QuantizedBounds) + trajectory_quantized_position_size(particle_count, position_bits) + trajectory_quantized_velocity_size(particle_count);
+}
+
+static std::size_t max_record_size(std::uint32_t particle_count, bool compress) {
+	std::size_t size = chunk_table_size(particle_count);
+
+	for (std::uint32_t column = 0; column < trajectory_column_count; column++) {
+		const std::size_t chunk_size = trajectory_column_element_size(static_cast<TrajectoryColumn>(column)) * trajectory_chunk_particles;
+		size += align_up(compress ? snapshot_codec_bound(chunk_size) : chunk_size, chunk_alignment) * trajectory_chunk_count(particle_count);
+	}
+
+	return io_align_up(size);
+}
+
+TrajectoryEncoder::TrajectoryEncoder(std::uint32_t particle_count, bool compress, std::uint32_t keyframe_interval, ThreadPool *pool) {
+	this->raw_bytes = 0;
+	this->encoded_bytes = 0;
+	this->encode_seconds = 0.0;
+	this->particle_count = particle_count;
+	this->chunk_count = trajectory_chunk_count(particle_count);
+	this->compress = compress;
+	this->keyframe_interval = std::max(keyframe_interval, 1u);
+	this->since_keyframe = 0;
+	this->pool = pool;
+	this->record_capacity = max_record_size(particle_count, compress);
+
+	std::size_t size = 0;
+	for (std::uint32_t column = 0; column < trajectory_column_count; column++) {
+		this->column_offsets.push_back(size);
+		size += trajectory_column_element_size(static_cast<TrajectoryColumn>(column)) * particle_count;
+	}
+
+	this->columns.resize(size);
+	if (compress)
+		this->previous_columns.resize(size);
+
+	this->chunk_data.resize(trajectory_column_count * this->chunk_count);
+	this->chunks.resize(trajectory_column_count * this->chunk_count);
+}
+
+std::size_t TrajectoryEncoder::encode(const Particle *particles, const std::uint32_t *ids, std::uint32_t device, std::uint64_t step, double sim_time, unsigned char *out) {
+	const auto start_time = std::chrono::steady_clock::now();
+
+	unsigned char *positions = this->columns.data() + this->column_offsets[static_cast<std::size_t>(TrajectoryColumn::position)];
+	unsigned char *velocities = this->columns.data() + this->column_offsets[static_cast<std::size_t>(TrajectoryColumn::velocity)];
+	unsigned char *id_column = this->columns.data() + this->column_offsets[static_cast<std::size_t>(TrajectoryColumn::id)];
+
+	for (std::uint32_t k = 0; k < this->particle_count; k++) {
+		const std::uint32_t id = ids != nullptr ? ids[k] : k;
+
+		std::memcpy(positions + k * sizeof(vec4), &particles[k].position, sizeof(vec4));
+		std::memcpy(velocities + k * sizeof(vec4), &particles[k].velocity, sizeof(vec4));
+		std::memcpy(id_column + k * sizeof(std::uint32_t), &id, sizeof(std::uint32_t));
+	}
+
+	// the first record and every keyframe_interval-th one after it decode on their own
+	const bool keyframe = !this->compress || this->since_keyframe == 0;
+	this->since_keyframe = (this->since_keyframe + 1) % this->keyframe_interval;
+
+	auto encode_chunk = [&](std::size_t idx) {
+		const std::uint32_t column = static_cast<std::uint32_t>(idx / this->chunk_count);
+		const std::uint32_t first = static_cast<std::uint32_t>(idx % this->chunk_count) * trajectory_chunk_particles;
+		const std::uint32_t count = std::min(trajectory_chunk_particles, this->particle_count - first);
+		const std::size_t element_size = trajectory_column_element_size(static_cast<TrajectoryColumn>(column));
+		const std::size_t src_offset = this->column_offsets[column] + first * element_size;
+		const std::size_t size = count * element_size;
+		auto &data = this->chunk_data[idx];
+
+		data.resize(snapshot_codec_bound(size));
+		const std::size_t encoded_size = snapshot_codec_encode(this->columns.data() + src_offset, keyframe ? nullptr : this->previous_columns.data() + src_offset, size, element_size, data.data());
+
+		// incompressible chunks are stored as they are
+		if (encoded_size == 0) {
+			std::memcpy(data.data(), this->columns.data() + src_offset, size);
+			this->chunks[idx] = TrajectoryChunk { .offset = 0, .size = static_cast<std::uint32_t>(size), .codec = TrajectoryCodec::raw };
+		} else {
+			this->chunks[idx] = TrajectoryChunk { .offset = 0, .size = static_cast<std::uint32_t>(encoded_size), .codec = keyframe ? TrajectoryCodec::shuffle : TrajectoryCodec::shuffle_xor };
+		}
+	};
+
+	if (this->compress) {
+		if (this->pool != nullptr)
+			this->pool->parallel_for(this->chunks.size(), encode_chunk);
+		else
+			for (std::size_t idx = 0; idx < this->chunks.size(); idx++)
+				encode_chunk(idx);
+	}
+
+	if (!this->compress) {
+		for (std::size_t idx = 0; idx < this->chunks.size(); idx++) {
+			const std::uint32_t column = static_cast<std::uint32_t>(idx / this->chunk_count);
+			const std::uint32_t first = static_cast<std::uint32_t>(idx % this->chunk_count) * trajectory_chunk_particles;
+			const std::uint32_t count = std::min(trajectory_chunk_particles, this->particle_count - first);
+			const std::size_t element_size = trajectory_column_element_size(static_cast<TrajectoryColumn>(column));
+
+			this->chunks[idx] = TrajectoryChunk { .offset = this->column_offsets[column] + first * element_size, .size = static_cast<std::uint32_t>(count * element_size), .codec = TrajectoryCodec::raw };
+		}
+	}
+
+	TrajectoryRecordHeader header = {};
+	header.device = device;
+	header.step = step;
+	header.sim_time = sim_time;
+	header.flags = keyframe ? trajectory_record_keyframe : 0;
+
+	const std::size_t record_size = this->pack(header, this->compress, out);
+
+	if (this->compress)
+		std::swap(this->columns, this->previous_columns);
+
+	this->raw_bytes += this->columns.size();
+	this->encoded_bytes += record_size;
+	this->encode_seconds += std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
+
+	return record_size;
+}
+
+std::size_t TrajectoryEncoder::encode_quantized(const unsigned char *quantized, std::uint32_t position_bits, std::uint32_t device, std::uint64_t step, double sim_time, unsigned char *out) {
+	const auto start_time = std::chrono::steady_clock::now();
+
+	QuantizedBounds bounds;
+	std::memcpy(&bounds, quantized, sizeof(bounds));
+
+	const unsigned char *positions = quantized + sizeof(QuantizedBounds);
+	const unsigned char *velocities = positions + trajectory_quantized_position_size(this->particle_count, position_bits);
+	const std::size_t position_size = position_bits == 16 ? 3 * sizeof(std::uint16_t) : sizeof(std::uint64_t);
+	const std::size_t velocity_size = 3 * sizeof(std::uint16_t);
+
+	TrajectoryRecordHeader header = {};
+	header.device = device;
+	header.step = step;
+	header.sim_time = sim_time;
+	header.flags = trajectory_record_keyframe;
+	header.position_bits = position_bits;
+
+	// half a quantization step, plus float rounding in the shader (a few ulp of the scaled value,
+	// which matters at 21 bits) and in the reader (a few ulp of the coordinate)
+	const float max_q = static_cast<float>((1u << position_bits) - 1);
+	const float float_eps = 1.f / static_cast<float>(1 << 22);
+	for (int axis = 0; axis < 3; axis++) {
+		header.bounds_min[axis] = unorder_float(bounds.min[axis]);
+		header.bounds_max[axis] = unorder_float(bounds.max[axis]);
+
+		const float quantize_step = (header.bounds_max[axis] - header.bounds_min[axis]) / max_q;
+		const float max_abs = std::max(std::fabs(header.bounds_min[axis]), std::fabs(header.bounds_max[axis]));
+		header.position_error = std::max(header.position_error, quantize_step * (0.5f + max_q * float_eps) + max_abs * float_eps);
+	}
+
+	// half a half ulp in the normal range, and the subnormal spacing, 2^-24, below it
+	header.velocity_error = 1.f / 2048.f;
+	header.velocity_error_floor = 1.f / static_cast<float>(1 << 24);
+	if (bounds.max[3] != 0)
+		header.flags |= trajectory_record_velocity_clamped;
+
+	unsigned char *id_column = this->columns.data() + this->column_offsets[static_cast<std::size_t>(TrajectoryColumn::id)];
+	for (std::uint32_t k = 0; k < this->particle_count; k++)
+		std::memcpy(id_column + k * sizeof(std::uint32_t), &k, sizeof(std::uint32_t));
+
+	for (std::size_t idx = 0; idx < this->chunks.size(); idx++) {
+		const auto column = static_cast<TrajectoryColumn>(idx / this->chunk_count);
+		const std::uint32_t first = static_cast<std::uint32_t>(idx % this->chunk_count) * trajectory_chunk_particles;
+		const std::uint32_t count = std::min(trajectory_chunk_particles, this->particle_count - first);
+		auto &data = this->chunk_data[idx];
+
+		switch (column) {
+		case TrajectoryColumn::position:
+			data.assign(positions + first * position_size, positions + (first + count) * position_size);
+			this->chunks[idx] = TrajectoryChunk { .offset = 0, .size = static_cast<std::uint32_t>(data.size()), .codec = TrajectoryCodec::quantized };
+			break;
+		case TrajectoryColumn::velocity:
+			data.assign(velocities + first * velocity_size, velocities + (first + count) * velocity_size);
+			this->chunks[idx] = TrajectoryChunk { .offset = 0, .size = static_cast<std::uint32_t>(data.size()), .codec = TrajectoryCodec::half };
+			break;
+		case TrajectoryColumn::id:
+			data.assign(id_column + first * sizeof(std::uint32_t), id_column + (first + count) * sizeof(std::uint32_t));
+			this->chunks[idx] = TrajectoryChunk { .offset = 0, .size = static_cast<std::uint32_t>(data.size()), .codec = TrajectoryCodec::raw };
+			break;
+		case TrajectoryColumn::count:
+			break;
+		}
+	}
+
+	const std::size_t record_size = this->pack(header, true, out);
+
+	// the next lossless record has no previous snapshot to be coded against
+	this->since_keyframe = 0;
+
+	this->raw_bytes += this->columns.size();
+	this->encoded_bytes += record_size;
+	this->encode_seconds += std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
+
+	return record_size;
+}
+
+// copies the chunks after the chunk table, from chunk_data when they were encoded and straight
+// from the columns otherwise, and fills in the rest of the header
+std::size_t TrajectoryEncoder::pack(TrajectoryRecordHeader &header, bool from_chunk_data, unsigned char *out) {
+	std::size_t offset = chunk_table_size(this->particle_count);
+
+	for (std::size_t idx = 0; idx < this->chunks.size(); idx++) {
+		auto &chunk = this->chunks[idx];
+		const unsigned char *src = from_chunk_data ? this->chunk_data[idx].data() : this->columns.data() + chunk.offset;
+
+		std::memcpy(out + offset, src, chunk.size);
+		chunk.offset = offset;
+		offset = align_up(offset + chunk.size, chunk_alignment);
+	}
+
+	const std::size_t record_size = io_align_up(offset);
+
+	std::memcpy(header.magic, record_magic, sizeof(record_magic));
+	header.particle_count = this->particle_count;
+	header.record_size = record_size;
+	header.chunk_count = this->chunk_count;
+	header.column_count = trajectory_column_count;
+
+	std::memcpy(out, &header, sizeof(header));
+	std::memcpy(out + sizeof(header), this->chunks.data(), this->chunks.size() * sizeof(TrajectoryChunk));
+	std::memset(out + offset, 0, record_size - offset);
+
+	return record_size;
+}
+
+std::size_t trajectory_index_size(std::size_t entry_count) {
+	return io_align_up(entry_count * sizeof(TrajectoryIndexEntry) + sizeof(TrajectoryFooter));
+}
+
+void trajectory_encode_index(const std::vector<TrajectoryIndexEntry> &entries, std::uint64_t index_offset, unsigned char *out) {
+	const std::size_t size = trajectory_index_size(entries.size());
+
+	TrajectoryFooter footer = {
+		.magic = {},
+		.index_offset = index_offset,
+		.entry_count = entries.size(),
+		.reserved = 0
+	};
+
+	std::memcpy(footer.magic, footer_magic, sizeof(footer_magic));
+
+	std::memset(out, 0, size);
+	if (!entries.empty())
+		std::memcpy(out, entries.data(), entries.size() * sizeof(TrajectoryIndexEntry));
+	std::memcpy(out + size - sizeof(footer), &footer, sizeof(footer));
+}
+
+TrajectoryReader::TrajectoryReader() {
+	this->file = nullptr;
+	this->file_size = 0;
+	std::memset(&this->header, 0, sizeof(this->header));
+}
+
+TrajectoryReader::~TrajectoryReader() {
+	if (this->file != nullptr)
+		std::fclose(this->file);
+}
+
+bool TrajectoryReader::read_at(std::uint64_t offset, void *data, std::size_t size) {
+#ifdef _WIN32
+	if (_fseeki64(this->file, static_cast<long long>(offset), SEEK_SET) != 0)
+		return false;
+#else
+	if (fseeko(this->file, static_cast<off_t>(offset), SEEK_SET) != 0)
+		return false;
+#endif
+
+	return std::fread(data, size, 1, this->file) == 1;
+}
+
+bool TrajectoryReader::open(const std::string &path) {
+	if (this->file != nullptr)
+		std::fclose(this->file);
+
+	this->entries.clear();
+	this->file_size = 0;
+
+	this->file = std::fopen(path.c_str(), "rb");
+	if (this->file == nullptr)
+		return false;
+
+#ifdef _WIN32
+	_fseeki64(this->file, 0, SEEK_END);
+	this->file_size = static_cast<std::uint64_t>(_ftelli64(this->file));
+#else
+	fseeko(this->file, 0, SEEK_END);
+	this->file_size = static_cast<std::uint64_t>(ftello(this->file));
+#endif
+
+	if (!this->read_at(0, &this->header, sizeof(this->header)) || std::memcmp(this->header.magic, file_magic, sizeof(file_magic)) != 0)
+		return false;
+
+	if (this->header.version != trajectory_version || this->header.column_count != trajectory_column_count)
+		return false;
+
+	if (!this->read_index())
+		this->scan_records();
+
+	return true;
+}
+
+bool TrajectoryReader::read_index() {
+	TrajectoryFooter footer;
+
+	if (this->file_size < this->header.header_size + sizeof(footer) || !this->read_at(this->file_size - sizeof(footer), &footer, sizeof(footer)))
+		return false;
+
+	if (std::memcmp(footer.magic, footer_magic, sizeof(footer_magic)) != 0 || footer.index_offset + footer.entry_count * sizeof(TrajectoryIndexEntry) > this->file_size)
+		return false;
+
+	this->entries.resize(footer.entry_count);
+	return this->entries.empty() || this->read_at(footer.index_offset, this->entries.data(), this->entries.size() * sizeof(TrajectoryIndexEntry));
+}
+
+// recovers the index of a file that was not closed cleanly
+void TrajectoryReader::scan_records() {
+	std::uint64_t offset = this->header.header_size;
+	TrajectoryRecordHeader record;
+
+	this->entries.clear();
+
+	while (offset + sizeof(record) <= this->file_size && this->read_at(offset, &record, sizeof(record))) {
+		if (std::memcmp(record.magic, record_magic, sizeof(record_magic)) != 0 || record.record_size == 0 || offset + record.record_size > this->file_size)
+			break;
+
+		this->entries.push_back(TrajectoryIndexEntry {
+			.step = record.step,
+			.sim_time = record.sim_time,
+			.offset = offset,
+			.size = record.record_size
+		});
+
+		offset += record.record_size;
+	}
+}
+
+std::size_t TrajectoryReader::find_step(std::uint64_t step) const {
+	const auto it = std::upper_bound(this->entries.begin(), this->entries.end(), step, [](std::uint64_t s, const TrajectoryIndexEntry &entry) { return s < entry.step; });
+
+	return it == this->entries.begin() ? 0 : static_cast<std::size_t>(it - this->entries.begin()) - 1;
+}
+
+bool TrajectoryReader::read_record_header(std::size_t snapshot, TrajectoryRecordHeader &record) {
+	return snapshot < this->entries.size() && this->read_at(this->entries[snapshot].offset, &record, sizeof(record)) && std::memcmp(record.magic, record_magic, sizeof(record_magic)) == 0;
+}
+
+bool TrajectoryReader::decode_column(std::size_t snapshot, TrajectoryColumn column, const std::vector<unsigned char> &previous, std::vector<unsigned char> &out) {
+	const TrajectoryIndexEntry &entry = this->entries[snapshot];
+	TrajectoryRecordHeader record;
+
+	if (!this->read_record_header(snapshot, record))
+		return false;
+
+	const std::size_t column_idx = static_cast<std::size_t>(column);
+	std::vector<TrajectoryChunk> chunks(record.chunk_count);
+
+	if (!chunks.empty() && !this->read_at(entry.offset + sizeof(record) + column_idx * record.chunk_count * sizeof(TrajectoryChunk), chunks.data(), chunks.size() * sizeof(TrajectoryChunk)))
+		return false;
+
+	const std::size_t element_size = this->header.column_element_size[column_idx];
+	out.resize(static_cast<std::size_t>(record.particle_count) * element_size);
+
+	std::vector<unsigned char> encoded;
+	std::size_t pos = 0;
+
+	for (std::uint32_t chunk_idx = 0; chunk_idx < record.chunk_count; chunk_idx++) {
+		const auto &chunk = chunks[chunk_idx];
+		const std::uint32_t first = chunk_idx * this->header.chunk_particles;
+		const std::size_t size = std::min<std::size_t>(this->header.chunk_particles, record.particle_count - first) * element_size;
+
+		if (pos + size > out.size())
+			return false;
+
+		switch (chunk.codec) {
+		case TrajectoryCodec::quantized:
+		case TrajectoryCodec::half:
+			encoded.resize(chunk.size);
+			if (!this->read_at(entry.offset + chunk.offset, encoded.data(), chunk.size))
+				return false;
+
+			if (!this->decode_quantized(record, chunk, encoded.data(), size / element_size, out.data() + pos))
+				return false;
+			break;
+		case TrajectoryCodec::raw:
+			if (chunk.size != size || !this->read_at(entry.offset + chunk.offset, out.data() + pos, size))
+				return false;
+			break;
+		case TrajectoryCodec::shuffle:
+		case TrajectoryCodec::shuffle_xor:
+			if (chunk.codec == TrajectoryCodec::shuffle_xor && previous.size() != out.size())
+				return false;
+
+			encoded.resize(chunk.size);
+			if (!this->read_at(entry.offset + chunk.offset, encoded.data(), chunk.size))
+				return false;
+
+			if (!snapshot_codec_decode(encoded.data(), chunk.size, chunk.codec == TrajectoryCodec::shuffle_xor ? previous.data() + pos : nullptr, size, element_size, out.data() + pos))
+				return false;
+			break;
+		default:
+			return false;
+		}
+
+		pos += size;
+	}
+
+	return pos == out.size();
+}
+
+bool TrajectoryReader::read_column(std::size_t snapshot, TrajectoryColumn column, std::vector<unsigned char> &out) {
+	if (snapshot >= this->entries.size() || column == TrajectoryColumn::count)
+		return false;
+
+	// delta records need every record back to the last keyframe
+	std::size_t keyframe = snapshot;
+	TrajectoryRecordHeader record;
+
+	while (true) {
+		if (!this->read_record_header(keyframe, record))
+			return false;
+
+		if ((record.flags & trajectory_record_keyframe) != 0 || keyframe == 0)
+			break;
+
+		keyframe--;
+	}
+
+	std::vector<unsigned char> previous;
+
+	for (std::size_t idx = keyframe; idx <= snapshot; idx++) {
+		if (!this->decode_column(idx, column, previous, out))
+			return false;
+
+		if (idx != snapshot)
+			std::swap(previous, out);
+	}
+
+	return true;
+}
+
+bool TrajectoryReader::decode_quantized(const TrajectoryRecordHeader &record, const TrajectoryChunk &chunk, const unsigned char *src, std::size_t count, unsigned char *dst) {
+	auto *values = reinterpret_cast<vec4 *>(dst);
+
+	if (chunk.codec == TrajectoryCodec::half) {
+		if (chunk.size != count * 3 * sizeof(std::uint16_t))
+			return false;
+
+		for (std::size_t k = 0; k < count; k++) {
+			for (std::size_t axis = 0; axis < 3; axis++) {
+				std::uint16_t half;
+				std::memcpy(&half, src + (k * 3 + axis) * sizeof(half), sizeof(half));
+				values[k].data[axis] = half_to_float(half);
+			}
+
+			values[k].data[3] = 0.f;
+		}
+
+		return true;
+	}
+
+	if (record.position_bits != 16 && record.position_bits != 21)
+		return false;
+
+	const std::size_t element_size = record.position_bits == 16 ? 3 * sizeof(std::uint16_t) : sizeof(std::uint64_t);
+	if (chunk.size != count * element_size)
+		return false;
+
+	const std::uint32_t max_q = (1u << record.position_bits) - 1;
+	float scale[3];
+	for (std::size_t axis = 0; axis < 3; axis++)
+		scale[axis] = (record.bounds_max[axis] - record.bounds_min[axis]) / static_cast<float>(max_q);
+
+	for (std::size_t k = 0; k < count; k++) {
+		std::uint32_t q[3];
+
+		if (record.position_bits == 16) {
+			std::uint16_t packed[3];
+			std::memcpy(packed, src + k * element_size, sizeof(packed));
+			q[0] = packed[0];
+			q[1] = packed[1];
+			q[2] = packed[2];
+		} else {
+			std::uint64_t packed;
+			std::memcpy(&packed, src + k * element_size, sizeof(packed));
+			q[0] = static_cast<std::uint32_t>(packed) & max_q;
+			q[1] = static_cast<std::uint32_t>(packed >> 21) & max_q;
+			q[2] = static_cast<std::uint32_t>(packed >> 42) & max_q;
+		}
+
+		for (std::size_t axis = 0; axis < 3; axis++)
+			values[k].data[axis] = record.bounds_min[axis] + static_cast<float>(q[axis]) * scale[axis];
+
+		values[k].data[3] = 0.f;
+	}
+
+	return true;
+}
+
+// does what snapshot_bounds.comp and snapshot_quantize.comp do, so the round trip can be checked
+// without a device
+static void quantize_snapshot(const std::vector<Particle> &particles, std::uint32_t position_bits, std::vector<unsigned char> &out) {
+	const std::uint32_t count = static_cast<std::uint32_t>(particles.size());
+	const std::size_t position_size = position_bits == 16 ? 3 * sizeof(std::uint16_t) : sizeof(std::uint64_t);
+
+	out.assign(trajectory_quantized_size(count, position_bits), 0);
+
+	unsigned char *positions = out.data() + sizeof(QuantizedBounds);
+	unsigned char *velocities = positions + trajectory_quantized_position_size(count, position_bits);
+
+	float lo[3], hi[3];
+	for (std::size_t axis = 0; axis < 3; axis++) {
+		lo[axis] = particles[0].position.data[axis];
+		hi[axis] = lo[axis];
+
+		for (const auto &particle : particles) {
+			lo[axis] = std::min(lo[axis], particle.position.data[axis]);
+			hi[axis] = std::max(hi[axis], particle.position.data[axis]);
+		}
+	}
+
+	// the host clears the bounds to these before the passes run
+	QuantizedBounds bounds = {
+		.min = { order_float(lo[0]), order_float(lo[1]), order_float(lo[2]), 0xffffffffu },
+		.max = { order_float(hi[0]), order_float(hi[1]), order_float(hi[2]), 0 }
+	};
+
+	const float max_q = static_cast<float>((1u << position_bits) - 1);
+
+	for (std::uint32_t k = 0; k < count; k++) {
+		std::uint32_t q[3];
+
+		for (std::size_t axis = 0; axis < 3; axis++) {
+			const float extent = hi[axis] - lo[axis];
+			const float scale = extent > 0.f ? max_q / extent : 0.f;
+			q[axis] = static_cast<std::uint32_t>(std::round(std::clamp((particles[k].position.data[axis] - lo[axis]) * scale, 0.f, max_q)));
+
+			const float velocity = particles[k].velocity.data[axis];
+			const float clamped = std::clamp(velocity, -65504.f, 65504.f);
+			if (clamped != velocity)
+				bounds.max[3] = 1;
+
+			const std::uint16_t half = float_to_half(clamped);
+			std::memcpy(velocities + (k * 3 + axis) * sizeof(half), &half, sizeof(half));
+		}
+
+		if (position_bits == 16) {
+			const std::uint16_t packed[3] = { static_cast<std::uint16_t>(q[0]), static_cast<std::uint16_t>(q[1]), static_cast<std::uint16_t>(q[2]) };
+			std::memcpy(positions + k * position_size, packed, sizeof(packed));
+		} else {
+			const std::uint64_t packed = q[0] | static_cast<std::uint64_t>(q[1]) << 21 | static_cast<std::uint64_t>(q[2]) << 42;
+			std::memcpy(positions + k * position_size, &packed, sizeof(packed));
+		}
+	}
+
+	std::memcpy(out.data(), &bounds, sizeof(bounds));
+}
+
+bool run_trajectory_check(const std::string &path) {
+	// three chunks, the last one partial, and an odd count so the quantized pairs are padded
+	static const std::uint32_t particle_count = 2 * trajectory_chunk_particles + 1001;
+	static const std::uint32_t snapshot_count = 6;
+	static const std::uint32_t keyframe_interval = 4;
+
+	struct Case {
+		const char *name;
+		bool compress;
+		std::uint32_t position_bits;
+	};
+
+	// position_bits 0 is lossless
+	static const Case cases[] = {
+		Case { "raw", false, 0 },
+		Case { "shuffle", true, 0 },
+		Case { "quant16", false, 16 },
+		Case { "quant21", false, 21 }
+	};
+
+	// a drifting cloud, so consecutive snapshots share most of their bits and compress against
+	// each other. velocities reach down into the half subnormals, and one is past the half range
+	std::default_random_engine rng(1);
+	std::uniform_real_distribution<float> dist(-1.f, 1.f);
+	std::vector<std::vector<Particle>> snapshots(snapshot_count, std::vector<Particle>(particle_count));
+
+	for (std::uint32_t k = 0; k < particle_count; k++) {
+		auto &particle = snapshots[0][k];
+
+		for (std::size_t axis = 0; axis < 3; axis++) {
+			particle.position.data[axis] = 100.f * dist(rng);
+			particle.velocity.data[axis] = dist(rng) * std::exp2(static_cast<float>(k % 40) - 26.f);
+		}
+
+		particle.position.data[3] = 1.f;
+		particle.velocity.data[3] = 0.f;
+	}
+
+	snapshots[0][0].velocity.data[0] = 1e5f;
+
+	for (std::uint32_t s = 1; s < snapshot_count; s++) {
+		for (std::uint32_t k = 0; k < particle_count; k++) {
+			auto &particle = snapshots[s][k];
+			particle = snapshots[s - 1][k];
+
+			for (std::size_t axis = 0; axis < 3; axis++) {
+				particle.position.data[axis] += 1e-3f * dist(rng);
+				particle.velocity.data[axis] *= 1.f + 1e-3f * dist(rng);
+			}
+		}
+	}
+
+	ThreadPool pool(4);
+	bool passed = true;
+
+	std::printf("Trajectory check: %u snapshots of %u particles through %s\n", snapshot_count, particle_count, path.c_str());
+
+	for (const auto &test : cases) {
+		TrajectoryEncoder encoder(particle_count, test.compress, keyframe_interval, &pool);
+		std::vector<unsigned char> file(io_alignment), record(encoder.capacity()), quantized;
+		std::vector<TrajectoryIndexEntry> entries;
+
+		trajectory_encode_file_header(file.data());
+
+		for (std::uint32_t s = 0; s < snapshot_count; s++) {
+			std::size_t size;
+
+			if (test.position_bits == 0) {
+				size = encoder.encode(snapshots[s].data(), nullptr, 0, s * 100, s * 0.1, record.data());
+			} else {
+				quantize_snapshot(snapshots[s], test.position_bits, quantized);
+				size = encoder.encode_quantized(quantized.data(), test.position_bits, 0, s * 100, s * 0.1, record.data());
+			}
+
+			entries.push_back(TrajectoryIndexEntry {
+				.step = s * 100u,
+				.sim_time = s * 0.1,
+				.offset = file.size(),
+				.size = size
+			});
+
+			file.insert(file.end(), record.begin(), record.begin() + static_cast<std::ptrdiff_t>(size));
+		}
+
+		const std::size_t index_offset = file.size();
+		file.resize(index_offset + trajectory_index_size(entries.size()));
+		trajectory_encode_index(entries, index_offset, file.data() + index_offset);
+
+		std::FILE *out = std::fopen(path.c_str(), "wb");
+		const bool written = out != nullptr && std::fwrite(file.data(), file.size(), 1, out) == 1;
+		if (out != nullptr)
+			std::fclose(out);
+
+		TrajectoryReader reader;
+		const char *error = nullptr;
+		std::uint32_t failed_snapshot = 0;
+		float max_position_error = 0.f, position_error = 0.f;
+
+		if (!written)
+			error = "could not write the file";
+		else if (!reader.open(path) || reader.snapshot_count() != snapshot_count)
+			error = "could not read the index";
+
+		for (std::uint32_t s = 0; s < snapshot_count && error == nullptr; s++) {
+			const auto &particles = snapshots[s];
+			TrajectoryRecordHeader header;
+			std::vector<unsigned char> positions, velocities, ids;
+
+			failed_snapshot = s;
+
+			if (!reader.read_record_header(s, header) || !reader.read_column(s, TrajectoryColumn::position, positions) || !reader.read_column(s, TrajectoryColumn::velocity, velocities) || !reader.read_column(s, TrajectoryColumn::id, ids)) {
+				error = "could not decode the record";
+				break;
+			}
+
+			// lossless records past the first keyframe go through the XOR chain
+			const bool keyframe = test.position_bits != 0 || !test.compress || s % keyframe_interval == 0;
+			const bool clamped = test.position_bits != 0;
+			if (((header.flags & trajectory_record_keyframe) != 0) != keyframe || ((header.flags & trajectory_record_velocity_clamped) != 0) != clamped) {
+				error = "wrong record flags";
+				break;
+			}
+
+			const auto *position_values = reinterpret_cast<const vec4 *>(positions.data());
+			const auto *velocity_values = reinterpret_cast<const vec4 *>(velocities.data());
+
+			for (std::uint32_t k = 0; k < particle_count && error == nullptr; k++) {
+				std::uint32_t id;
+				std::memcpy(&id, ids.data() + k * sizeof(id), sizeof(id));
+				if (id != k)
+					error = "ids differ";
+
+				if (test.position_bits == 0) {
+					if (std::memcmp(&position_values[k], &particles[k].position, sizeof(vec4)) != 0 || std::memcmp(&velocity_values[k], &particles[k].velocity, sizeof(vec4)) != 0)
+						error = "lossless record differs";
+
+					continue;
+				}
+
+				for (std::size_t axis = 0; axis < 3; axis++) {
+					const float velocity = std::clamp(particles[k].velocity.data[axis], -65504.f, 65504.f);
+					const float distance = std::fabs(position_values[k].data[axis] - particles[k].position.data[axis]);
+
+					max_position_error = std::max(max_position_error, distance);
+
+					if (distance > header.position_error)
+						error = "position outside the error bound";
+					else if (std::fabs(velocity_values[k].data[axis] - velocity) > std::max(header.velocity_error * std::fabs(velocity), header.velocity_error_floor))
+						error = "velocity outside the error bound";
+				}
+
+				if (position_values[k].data[3] != 0.f || velocity_values[k].data[3] != 0.f)
+					error = "w is not 0";
+			}
+
+			position_error = std::max(position_error, header.position_error);
+		}
+
+		std::remove(path.c_str());
+
+		if (error != nullptr) {
+			std::printf("%-8s FAILED at snapshot %u: %s\n", test.name, failed_snapshot, error);
+			passed = false;
+		} else if (test.position_bits != 0) {
+			std::printf("%-8s ok, %.02f:1, position error %g of %g\n", test.name, static_cast<double>(encoder.raw_bytes) / static_cast<double>(encoder.encoded_bytes), max_position_error, position_error);
+		} else {
+			std::printf("%-8s ok, %.02f:1\n", test.name, static_cast<double>(encoder.raw_bytes) / static_cast<double>(encoder.encoded_bytes));
+		}
+	}
+
+	return passed;
+}
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "particle.h"
+
+struct ThreadPool;
+
+// trajectory file layout, every section starts on an io_alignment boundary:
+//
+//   file header block
+//   record 0: TrajectoryRecordHeader, chunk table, column chunks
+//   record 1: ...
+//   index: TrajectoryIndexEntry per record, TrajectoryFooter in the last bytes of the file
+//
+// a record stores each column separately, split into chunks of trajectory_chunk_particles
+// particles, so a reader can pull a single column of a single snapshot without touching the
+// rest of the file. a file whose writer died before the index went out can still be read by
+// walking the records from the start.
+//
+// compressed chunks may be coded against the same chunk of the previous record, so decoding
+// a record starts at the closest keyframe before it.
+//
+// quantized records come packed from the GPU: positions as 16 or 21 bit integers relative to
+// the bounding box stored in the record header, velocities as half floats. velocities past the
+// half range are saturated to +-65504 and flag the record.
+
+static constexpr std::uint32_t trajectory_version = 3;
+static constexpr std::uint32_t trajectory_chunk_particles = 4096;
+
+enum class TrajectoryColumn : std::uint32_t {
+	position, // vec4 per particle
+	velocity, // vec4 per particle
+	id,       // uint32 per particle
+	count
+};
+
+static constexpr std::uint32_t trajectory_column_count = static_cast<std::uint32_t>(TrajectoryColumn::count);
+
+enum class TrajectoryCodec : std::uint32_t {
+	raw,
+	shuffle,    // snapshot_codec without a reference
+	shuffle_xor, // snapshot_codec against the previous record
+	quantized,   // position_bits per axis, see TrajectoryRecordHeader
+	half         // three half floats per particle
+};
+
+static constexpr std::uint32_t trajectory_record_keyframe = 1;
+
+// some velocity component was saturated to the half range, velocity_error does not hold for it
+static constexpr std::uint32_t trajectory_record_velocity_clamped = 2;
+
+struct TrajectoryFileHeader {
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t header_size;
+	std::uint32_t chunk_particles;
+	std::uint32_t column_count;
+	std::uint32_t column_element_size[trajectory_column_count];
+};
+
+struct TrajectoryRecordHeader {
+	char magic[8];
+	std::uint32_t device;
+	std::uint32_t particle_count;
+	std::uint64_t step;
+	double sim_time;
+	std::uint64_t record_size;
+	std::uint32_t chunk_count; // per column
+	std::uint32_t column_count;
+	std::uint32_t flags;
+
+	// lossy records only, 0 otherwise. position_error is absolute. a velocity component is off by
+	// at most the larger of velocity_error relative to it and velocity_error_floor, which covers
+	// the subnormal halfs below 6.1e-5
+	std::uint32_t position_bits;
+	float bounds_min[3];
+	float bounds_max[3];
+	float position_error;
+	float velocity_error;
+	float velocity_error_floor;
+	std::uint32_t reserved[8];
+};
+
+static_assert(sizeof(TrajectoryRecordHeader) == 128, "TrajectoryRecordHeader must stay 128 bytes");
+
+// chunk table entries follow the record header, column major. offsets are relative to the record start
+struct TrajectoryChunk {
+	std::uint64_t offset;
+	std::uint32_t size;
+	TrajectoryCodec codec;
+};
+
+struct TrajectoryIndexEntry {
+	std::uint64_t step;
+	double sim_time;
+	std::uint64_t offset;
+	std::uint64_t size;
+};
+
+struct TrajectoryFooter {
+	char magic[8];
+	std::uint64_t index_offset;
+	std::uint64_t entry_count;
+	std::uint64_t reserved;
+};
+
+std::uint32_t trajectory_chunk_count(std::uint32_t particle_count);
+std::size_t trajectory_column_element_size(TrajectoryColumn column);
+
+// the header block is io_alignment bytes
+void trajectory_encode_file_header(unsigned char *out);
+
+// layout of the buffer the GPU quantize pass writes: bounds as order preserving uints so the
+// reduction can use integer atomics, then the packed position column, then the velocity column.
+// particles are packed in pairs so every invocation writes whole words. max[3] is not a bound,
+// the quantize pass sets it to 1 when it saturated a velocity
+struct QuantizedBounds {
+	std::uint32_t min[4];
+	std::uint32_t max[4];
+};
+
+std::size_t trajectory_quantized_position_size(std::uint32_t particle_count, std::uint32_t position_bits);
+std::size_t trajectory_quantized_velocity_size(std::uint32_t particle_count);
+std::size_t trajectory_quantized_size(std::uint32_t particle_count, std::uint32_t position_bits);
+
+// turns the snapshots of one device into records. keeps the previous snapshot around as the
+// reference for the XOR delta, so every device needs its own encoder
+struct TrajectoryEncoder {
+	// pool may be null when compress is false
+	TrajectoryEncoder(std::uint32_t particle_count, bool compress, std::uint32_t keyframe_interval, ThreadPool *pool);
+
+	// bytes a record can occupy, padded to io_alignment
+	std::size_t capacity() const { return this->record_capacity; }
+
+	// transposes the particles into column chunks, returns the padded record size. ids may be
+	// null, in which case particle indices are stored
+	std::size_t encode(const Particle *particles, const std::uint32_t *ids, std::uint32_t device, std::uint64_t step, double sim_time, unsigned char *out);
+
+	// stores the output of the GPU quantize pass, see QuantizedBounds. always a keyframe
+	std::size_t encode_quantized(const unsigned char *quantized, std::uint32_t position_bits, std::uint32_t device, std::uint64_t step, double sim_time, unsigned char *out);
+
+	// column bytes before encoding and record bytes after, plus time spent
+	std::uint64_t raw_bytes;
+	std::uint64_t encoded_bytes;
+	double encode_seconds;
+
+private:
+	std::size_t pack(TrajectoryRecordHeader &header, bool from_chunk_data, unsigned char *out);
+
+	std::uint32_t particle_count;
+	std::uint32_t chunk_count;
+	bool compress;
+	std::uint32_t keyframe_interval, since_keyframe;
+	ThreadPool *pool;
+	std::size_t record_capacity;
+
+	// snapshot transposed into columns, one after another
+	std::vector<unsigned char> columns, previous_columns;
+	std::vector<std::size_t> column_offsets;
+
+	// per chunk encode output, filled in parallel then packed into the record
+	std::vector<std::vector<unsigned char>> chunk_data;
+	std::vector<TrajectoryChunk> chunks;
+};
+
+// the index block is padded to io_alignment with the footer in its last bytes
+std::size_t trajectory_index_size(std::size_t entry_count);
+void trajectory_encode_index(const std::vector<TrajectoryIndexEntry> &entries, std::uint64_t index_offset, unsigned char *out);
+
+struct TrajectoryReader {
+	TrajectoryReader();
+	~TrajectoryReader();
+
+	TrajectoryReader(const TrajectoryReader &) = delete;
+	TrajectoryReader &operator=(const TrajectoryReader &) = delete;
+
+	bool open(const std::string &path);
+
+	std::size_t snapshot_count() const { return this->entries.size(); }
+	const TrajectoryIndexEntry &snapshot(std::size_t idx) const { return this->entries[idx]; }
+
+	// index of the last snapshot taken at or before step
+	std::size_t find_step(std::uint64_t step) const;
+
+	// record header with the error bounds of lossy snapshots
+	bool read_record_header(std::size_t snapshot, TrajectoryRecordHeader &record);
+
+	// reads one column of one snapshot, particle_count * element size bytes. lossy records
+	// are expanded back to float, position w and velocity w read as 0
+	bool read_column(std::size_t snapshot, TrajectoryColumn column, std::vector<unsigned char> &out);
+
+private:
+	bool read_at(std::uint64_t offset, void *data, std::size_t size);
+	bool read_index();
+	void scan_records();
+	bool decode_column(std::size_t snapshot, TrajectoryColumn column, const std::vector<unsigned char> &previous, std::vector<unsigned char> &out);
+	bool decode_quantized(const TrajectoryRecordHeader &record, const TrajectoryChunk &chunk, const unsigned char *src, std::size_t count, unsigned char *dst);
+
+	std::FILE *file;
+	std::uint64_t file_size;
+	TrajectoryFileHeader header;
+	std::vector<TrajectoryIndexEntry> entries;
+};
+
+// encodes synthetic snapshots with every codec, writes them to path, reads them back and compares
+// against the input, exactly for lossless records and within the header's bounds for quantized
+// ones. prints a line per codec and returns false on any mismatch
+bool run_trajectory_check(const std::string &path);
@@ -32,6 +32,7 @@
 
 #include <array>
 #include <vector>
+#include <algorithm>
 #include <string>
 #include <random>
 #include <chrono>
@@ -40,9 +41,13 @@
 #include <atomic>
 #include <stdexcept>
 #include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <cstring>
+#include <cstddef>
+#include <cmath>
 #include <set>
+#include <memory>
 
 #include "volk.h"
 
@@ -57,13 +62,37 @@
 // glslangValidator --target-env vulkan1.0 --vn particle_attraction_code -V particle_attraction.comp -o particle_attraction.inc
 #include "particle_attraction.inc"
 
-union vec4 {
-	float data[4];
-
-	struct {
-		float x, y, z, w;
-	} components;
-};
+// generated at build time, see add_shader in CMakeLists.txt
+#include "nbody_dispatch_args.inc"
+#include "nbody_force_half.inc"
+#include "nbody_force_half_packed.inc"
+#include "nbody_force_jsplit.inc"
+#include "nbody_force_subgroup.inc"
+#include "nbody_force_tiled.inc"
+#include "nbody_integrate.inc"
+#include "nbody_integrate_ds.inc"
+#include "nbody_pack_half.inc"
+#include "nbody_persistent.inc"
+#include "nbody_reduce.inc"
+#include "nbody_reduce_final.inc"
+#include "roi_compact.inc"
+#include "roi_scan.inc"
+#include "roi_select.inc"
+#include "snapshot_bounds.inc"
+#include "snapshot_quantize.inc"
+#include "nbody_dispatch_args_bda.inc"
+#include "nbody_force_jsplit_bda.inc"
+#include "nbody_force_subgroup_bda.inc"
+#include "nbody_force_tiled_bda.inc"
+#include "nbody_integrate_bda.inc"
+
+#include "particle.h"
+#include "nbody_cpu.h"
+#include "thread_pool.h"
+#include "file_io.h"
+#include "snapshot_writer.h"
+#include "readback.h"
+#include "domain.h"
 
 struct StdinMailbox {
 	std::atomic<bool> input_ready;
@@ -74,16 +103,402 @@ struct StdinMailbox {
 	bool get_input(std::string &line);
 };
 
-struct Particle {
-	vec4 position;
-	vec4 velocity;
+// std140, scalars pack without padding
+struct UBO {
+	float delta_time;
+	std::uint32_t particle_count;
+	float gravity;
+	float softening;
+	float unit_scale;
+};
+
+// bounding box reduction and packing passes recorded after the step when a lossy snapshot is due
+struct QuantizePasses {
+	VkPipeline bounds;
+	VkPipeline quantize;
+	VkPipelineLayout pipeline_layout;
+	VkDescriptorSet desc_set;
+	VkBuffer buf;
+	VkDeviceSize buf_size;
+	std::uint32_t particle_count;
 };
 
-struct UBO {
-	alignas(16) float delta_time;
-	alignas(16) std::uint32_t particle_count;
+static const std::uint32_t quantize_local_size = 256;
+
+// written by nbody_reduce_final.comp, matches Reduction in nbody_reduce.glsl. sums over the
+// unit mass bodies, potential stays 0 without -diagnostics-potential
+struct Reduction {
+	float kinetic;
+	float potential;
+	float padding[2];
+	vec4 momentum;
+	vec4 angular_momentum;
+	vec4 center_of_mass;
+};
+
+// conserved quantity reductions recorded after the last step of a submit with -diagnostics.
+// buf holds the result followed by one partial per workgroup, only the result is copied to
+// host_buf, which the compute queue owns throughout
+struct ReducePasses {
+	VkPipeline reduce;
+	VkPipeline reduce_final;
+	VkPipelineLayout pipeline_layout;
+	VkDescriptorSet desc_set;
+	VkBuffer buf;
+	VkBuffer host_buf;
+	std::uint32_t group_count;
+};
+
+static const std::uint32_t reduce_local_size = 256;
+
+// predicates of the region of interest passes, matches roi_common.glsl
+enum class RoiKind : std::uint32_t {
+	box,
+	sphere,
+	speed
+};
+
+// head of the roi buffer, written with vkCmdUpdateBuffer before every selection. count and
+// stored are filled in by roi_scan.comp, the selected particles follow
+struct RoiParams {
+	RoiKind kind;
+	std::uint32_t capacity;
+	std::uint32_t count;
+	std::uint32_t stored;
+	vec4 a; // box min, sphere centre with the radius in w, speed threshold in x
+	vec4 b; // box max
+};
+
+// one selected particle, id is its index in the particle buffer
+struct RoiParticle {
+	Particle particle;
+	std::uint32_t id;
+	std::uint32_t padding[3];
+};
+
+static_assert(sizeof(RoiParticle) == 48, "RoiParticle must match the shader layout");
+
+// record of a <path>-gpuN.roi file, followed by stored RoiParticle
+struct RoiRecordHeader {
+	char magic[8];
+	std::uint32_t device;
+	std::uint32_t count; // matching particles, more than were stored if the selection overflowed
+	std::uint32_t stored;
+	std::uint32_t reserved;
+	std::uint64_t step;
+	double sim_time;
+};
+
+// select, scan and compact passes recorded after the step when a selection is due. only the
+// head of buf up to copy_size, the params and capacity particles, goes back to the host
+struct RoiPasses {
+	VkPipeline select;
+	VkPipeline scan;
+	VkPipeline compact;
+	VkPipelineLayout pipeline_layout;
+	VkDescriptorSet desc_set;
+	VkBuffer buf;
+	VkBuffer host_buf;
+	VkDeviceSize copy_size;
+	RoiParams params;
+	std::uint32_t group_count;
+};
+
+static const std::uint32_t roi_local_size = 256;
+
+// legacy is particle_attraction.comp on its own, the others run a force pass into an
+// acceleration buffer followed by nbody_integrate.comp. persistent runs both passes for
+// several steps inside one dispatch
+enum class ForceKernel {
+	automatic, // jsplit for small runs, then subgroup where supported, tiled otherwise
+	legacy,
+	tiled,
+	subgroup,
+	jsplit,
+	persistent // experimental, never picked by automatic
+};
+
+// written on the GPU by nbody_dispatch_args.comp, matches dispatchbuf in nbody_common.glsl.
+// active_count is seeded with the particle count, the force and integrate passes are
+// dispatched indirectly from the two commands. the owned range is written at the start of
+// every submit, see ForcePasses, and the j-range and partial slot ahead of every force pass
+struct DispatchArgs {
+	std::uint32_t active_count;
+	VkDispatchIndirectCommand force;
+	VkDispatchIndirectCommand integrate;
+	std::uint32_t owned_first;
+	std::uint32_t owned_count;
+	std::uint32_t j_first;
+	std::uint32_t j_count;
+	std::uint32_t accel_slot;
+};
+
+// j_count that covers every active body
+static const std::uint32_t all_bodies = 0xffffffffu;
+
+struct ForcePasses {
+	VkPipeline dispatch_args;
+	VkPipeline force;
+	VkPipeline integrate;
+	VkPipelineLayout pipeline_layout;
+	VkDescriptorSet desc_set;
+	VkBuffer dispatch_buf;
+
+	// fp16 only, VK_NULL_HANDLE otherwise. bounds and pack fill half_buf before the force pass
+	VkPipeline bounds;
+	VkPipeline pack;
+	VkDescriptorSet bounds_desc_set;
+	VkBuffer half_buf;
+	std::uint32_t pack_group_count;
+
+	// -bda only, 0 otherwise. desc_set is then VK_NULL_HANDLE and the passes reach the buffers
+	// through these addresses, pushed with the step constants
+	VkDeviceAddress bodies_addr;
+	VkDeviceAddress ubo_addr;
+	VkDeviceAddress accel_addr;
+	VkDeviceAddress dispatch_addr;
+
+	// steps recorded into every command buffer, back to back or inside the persistent kernel
+	std::uint32_t steps;
+
+	// persistent only, VK_NULL_HANDLE otherwise. force is nbody_persistent.comp and there is no
+	// integrate pass, grid_buf holds its GridBarrier
+	VkBuffer grid_buf;
+	std::uint32_t persistent_group_count;
+
+	// bodies the force and integrate passes run on, every one of them unless -multi-gpu
+	// handed the rest to other devices. written into dispatch_buf ahead of the steps, the
+	// persistent kernel ignores them
+	std::uint32_t owned_first;
+	std::uint32_t owned_count;
+};
+
+// device-wide barrier of the persistent kernel, matches gridbuf in nbody_persistent.comp
+struct GridBarrier {
+	std::uint32_t arrived;
+	std::uint32_t sense;
+};
+
+// specialization constants of the force kernels
+struct ForceSpecialization {
+	std::uint32_t local_size; // constant_id 0
+	std::uint32_t block;      // constant_id 1, i-bodies per invocation
+	std::uint32_t force_law;  // constant_id 2, see ForceLaw
+	std::uint32_t steps;      // constant_id 3, persistent kernel only
+};
+
+// per-step values recorded into the command buffer as push constants, matches StepConstants
+// in nbody_common.glsl
+struct StepConstants {
+	float delta_time;
+	std::uint32_t step; // index of the step being run, wraps at 2^32
+};
+
+// what the -bda builds push instead, matches StepConstants in nbody_common.glsl with NBODY_BDA
+struct StepAddressConstants {
+	StepConstants constants;
+	VkDeviceAddress bodies;
+	VkDeviceAddress ubo;
+	VkDeviceAddress accel;
+	VkDeviceAddress dispatch;
+};
+
+static_assert(sizeof(StepAddressConstants) == 40, "StepAddressConstants must match the shader layout");
+
+// fp16 keeps the state in fp32 but runs the force pass on a half copy of the positions.
+// ds carries the positions as double-single hi/lo pairs through the integrate pass, the
+// force pass reads the hi words and stays fp32
+enum class Precision {
+	fp32,
+	fp16,
+	ds
+};
+
+static const char *precision_name(const Precision precision) {
+	switch (precision) {
+	case Precision::fp32: return "fp32";
+	case Precision::fp16: return "fp16";
+	case Precision::ds: return "ds";
+	}
+
+	return "unknown";
+}
+
+static bool parse_precision(const std::string_view name, Precision &precision) {
+	for (const auto p : { Precision::fp32, Precision::fp16, Precision::ds }) {
+		if (name == precision_name(p)) {
+			precision = p;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// where the DEV->HOST and HOST->DEV copies run. dedicated and shared take a queue of their own,
+// ownership of the buffers only moves between queues with dedicated, where the families differ
+enum class QueueTopology {
+	automatic, // probe the ones the device has and keep the fastest, see plan_queue_topology
+	dedicated, // DMA queue from a transfer only family
+	shared,    // second queue of the compute family
+	single     // the compute queue runs the copies as well
+};
+
+static const char *queue_topology_name(const QueueTopology topology) {
+	switch (topology) {
+	case QueueTopology::automatic: return "auto";
+	case QueueTopology::dedicated: return "dedicated";
+	case QueueTopology::shared: return "shared";
+	case QueueTopology::single: return "single";
+	}
+
+	return "unknown";
+}
+
+static bool parse_queue_topology(const std::string_view name, QueueTopology &topology) {
+	for (const auto t : { QueueTopology::automatic, QueueTopology::dedicated, QueueTopology::shared, QueueTopology::single }) {
+		if (name == queue_topology_name(t)) {
+			topology = t;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// how the devices share the work. off runs one independent system per device, split and ring
+// run a single system with every device owning a slice of the i-range. split all-gathers the
+// positions through host memory after every submit and uploads them before the next, ring
+// uploads them one j-block at a time while the force pass works through the block before
+enum class MultiGpu {
+	off,
+	split,
+	ring
+};
+
+static const char *multi_gpu_name(const MultiGpu mode) {
+	switch (mode) {
+	case MultiGpu::off: return "off";
+	case MultiGpu::split: return "split";
+	case MultiGpu::ring: return "ring";
+	}
+
+	return "unknown";
+}
+
+static bool parse_multi_gpu(const std::string_view name, MultiGpu &mode) {
+	for (const auto m : { MultiGpu::off, MultiGpu::split, MultiGpu::ring }) {
+		if (name == multi_gpu_name(m)) {
+			mode = m;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// -balance throughput times this many lock-step submits before it resizes the shares, and keeps
+// at least 1/balance_min_share of an even share on every device so each can still be timed
+static const std::uint32_t balance_window = 16;
+static const std::size_t balance_min_share = 16;
+
+static const std::uint32_t tiled_local_size = 64;
+static const std::uint32_t integrate_local_size = 256;
+
+// jsplit slices the j-range until about this many invocations are in flight, 1024 tiled
+// workgroups, enough to fill the largest GPUs we run on
+static const std::size_t jsplit_target_invocations = 65536;
+static const std::uint32_t jsplit_max_splits = 16;
+
+static std::uint32_t jsplit_split_count(const std::size_t particle_count) {
+	const std::size_t splits = (jsplit_target_invocations + particle_count - 1) / particle_count;
+	return static_cast<std::uint32_t>(std::clamp<std::size_t>(splits, 2, jsplit_max_splits));
+}
+
+// the subgroup kernel needs whole subgroups in every workgroup. the half kernels are tiled and,
+// like jsplit and the persistent kernel, take one body per invocation
+static ForceSpecialization force_specialization(const ForceKernel kernel, const bool half, const std::uint32_t subgroup_size, const std::uint32_t block, const std::uint32_t force_law, const std::uint32_t steps) {
+	return ForceSpecialization {
+		.local_size = !half && kernel == ForceKernel::subgroup ? std::max(tiled_local_size, subgroup_size) : tiled_local_size,
+		.block = half || kernel == ForceKernel::jsplit || kernel == ForceKernel::persistent ? 1 : block,
+		.force_law = force_law,
+		.steps = steps
+	};
+}
+
+static const std::array<VkSpecializationMapEntry, 4> force_spec_entries = {
+	VkSpecializationMapEntry {
+		.constantID = 0,
+		.offset = offsetof(ForceSpecialization, local_size),
+		.size = sizeof(ForceSpecialization::local_size)
+	},
+	VkSpecializationMapEntry {
+		.constantID = 1,
+		.offset = offsetof(ForceSpecialization, block),
+		.size = sizeof(ForceSpecialization::block)
+	},
+	VkSpecializationMapEntry {
+		.constantID = 2,
+		.offset = offsetof(ForceSpecialization, force_law),
+		.size = sizeof(ForceSpecialization::force_law)
+	},
+	VkSpecializationMapEntry {
+		.constantID = 3,
+		.offset = offsetof(ForceSpecialization, steps),
+		.size = sizeof(ForceSpecialization::steps)
+	}
 };
 
+// bodies per workgroup, j-range slices and the integrate workgroup size, see DispatchArgs
+static const std::array<VkSpecializationMapEntry, 3> dispatch_args_spec_entries = {
+	VkSpecializationMapEntry {
+		.constantID = 0,
+		.offset = 0,
+		.size = sizeof(std::uint32_t)
+	},
+	VkSpecializationMapEntry {
+		.constantID = 1,
+		.offset = sizeof(std::uint32_t),
+		.size = sizeof(std::uint32_t)
+	},
+	VkSpecializationMapEntry {
+		.constantID = 3,
+		.offset = 2*sizeof(std::uint32_t),
+		.size = sizeof(std::uint32_t)
+	}
+};
+
+// partial acceleration slots the integrate pass adds up
+static const VkSpecializationMapEntry integrate_spec_entry = {
+	.constantID = 0,
+	.offset = 0,
+	.size = sizeof(std::uint32_t)
+};
+
+static const char *force_kernel_name(const ForceKernel kernel) {
+	switch (kernel) {
+	case ForceKernel::automatic: return "auto";
+	case ForceKernel::legacy: return "legacy";
+	case ForceKernel::tiled: return "tiled";
+	case ForceKernel::subgroup: return "subgroup";
+	case ForceKernel::jsplit: return "jsplit";
+	case ForceKernel::persistent: return "persistent";
+	}
+
+	return "unknown";
+}
+
+static bool parse_force_kernel(const std::string_view name, ForceKernel &kernel) {
+	for (const auto k : { ForceKernel::automatic, ForceKernel::legacy, ForceKernel::tiled, ForceKernel::subgroup, ForceKernel::jsplit, ForceKernel::persistent }) {
+		if (name == force_kernel_name(k)) {
+			kernel = k;
+			return true;
+		}
+	}
+
+	return false;
+}
+
 StdinMailbox::StdinMailbox() {
 	const auto thread_func = [](StdinMailbox *mailbox) {
 		while (true) {
@@ -201,7 +616,8 @@ static int select_device_prompt(const std::vector<VkPhysicalDevice> &physical_de
 }
 #endif
 
-static void create_vkinstance(VkInstance &inst, VkDebugUtilsMessengerEXT &debug_msgr, const bool debug_mode) {
+// api_version is the version the instance was created with, 1.1 where the loader has it (needed for subgroup operations)
+static void create_vkinstance(VkInstance &inst, VkDebugUtilsMessengerEXT &debug_msgr, std::uint32_t &api_version, const bool debug_mode) {
 	static const std::array<const char *, 2> supp_layer_names = {
 		"VK_LAYER_KHRONOS_validation",
 		"VK_LAYER_KHRONOS_synchronization2"
@@ -214,16 +630,6 @@ static void create_vkinstance(VkInstance &inst, VkDebugUtilsMessengerEXT &debug_
 		VK_VALIDATION_FEATURE_ENABLE_SYNCHRONIZATION_VALIDATION_EXT
 	};
 
-	static const VkApplicationInfo app_info = {
-		.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
-		.pNext = nullptr,
-		.pApplicationName = "Voka",
-		.applicationVersion = VK_MAKE_API_VERSION(0, 0, 1, 0),
-		.pEngineName = "VokaNN",
-		.engineVersion = VK_MAKE_API_VERSION(0, 0, 1, 0),
-		.apiVersion = VK_API_VERSION_1_0
-	};
-
 	static const VkDebugUtilsMessengerCreateInfoEXT dbg_msgr_create_info = {
 		.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT,
 		.pNext = nullptr,
@@ -252,6 +658,19 @@ static void create_vkinstance(VkInstance &inst, VkDebugUtilsMessengerEXT &debug_
 	if (volkInitialize() != VK_SUCCESS)
 		throw std::runtime_error("Cannot init volk!");
 
+	// a 1.0 loader refuses any other apiVersion
+	api_version = volkGetInstanceVersion() >= VK_API_VERSION_1_1 ? VK_API_VERSION_1_1 : VK_API_VERSION_1_0;
+
+	const VkApplicationInfo app_info = {
+		.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+		.pNext = nullptr,
+		.pApplicationName = "Voka",
+		.applicationVersion = VK_MAKE_API_VERSION(0, 0, 1, 0),
+		.pEngineName = "VokaNN",
+		.engineVersion = VK_MAKE_API_VERSION(0, 0, 1, 0),
+		.apiVersion = api_version
+	};
+
 	vkEnumerateInstanceLayerProperties(&vk_obj_count, nullptr);
 	avail_layer_props.resize(vk_obj_count);
 	vkEnumerateInstanceLayerProperties(&vk_obj_count, avail_layer_props.data());
@@ -329,8 +748,207 @@ static void get_physical_devs(VkInstance inst, std::vector<VkPhysicalDevice> &ph
 	vkEnumeratePhysicalDevices(inst, &count, physical_devs.data());
 }
 
-static void create_device(VkPhysicalDevice physical_dev, VkDevice &dev, std::uint32_t &compute_queue_family_idx, std::uint32_t &transfer_queue_family_idx, std::uint32_t &transfer_queue_idx) {
-	static const float priority = 1.f;
+// whether the subgroup force kernel can run: compute stage subgroups with shuffle, which needs a 1.1 instance and device
+static bool query_subgroup_shuffle(VkPhysicalDevice physical_dev, const std::uint32_t instance_api_version, std::uint32_t &subgroup_size) {
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(physical_dev, &props);
+
+	subgroup_size = 1;
+
+	if (instance_api_version < VK_API_VERSION_1_1 || props.apiVersion < VK_API_VERSION_1_1)
+		return false;
+
+	VkPhysicalDeviceSubgroupProperties subgroup_props = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES,
+		.pNext = nullptr,
+		.subgroupSize = 0,
+		.supportedStages = 0,
+		.supportedOperations = 0,
+		.quadOperationsInAllStages = VK_FALSE
+	};
+
+	VkPhysicalDeviceProperties2 props2 = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+		.pNext = &subgroup_props,
+		.properties = {}
+	};
+
+	vkGetPhysicalDeviceProperties2(physical_dev, &props2);
+	subgroup_size = subgroup_props.subgroupSize;
+
+	return (subgroup_props.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) && (subgroup_props.supportedOperations & VK_SUBGROUP_FEATURE_SHUFFLE_BIT) && subgroup_size > 0;
+}
+
+static bool has_device_extension(VkPhysicalDevice physical_dev, const char *name) {
+	std::uint32_t count;
+	vkEnumerateDeviceExtensionProperties(physical_dev, nullptr, &count, nullptr);
+
+	std::vector<VkExtensionProperties> exts(count);
+	vkEnumerateDeviceExtensionProperties(physical_dev, nullptr, &count, exts.data());
+
+	return std::any_of(exts.begin(), exts.end(), [name](const VkExtensionProperties &ext) {
+		return std::strcmp(ext.extensionName, name) == 0;
+	});
+}
+
+// fp16 arithmetic for the packed half kernel, through VK_KHR_shader_float16_int8 since the instance stops at 1.1
+static bool query_shader_float16(VkPhysicalDevice physical_dev, const std::uint32_t instance_api_version) {
+	if (instance_api_version < VK_API_VERSION_1_1 || !has_device_extension(physical_dev, VK_KHR_SHADER_FLOAT16_INT8_EXTENSION_NAME))
+		return false;
+
+	VkPhysicalDeviceShaderFloat16Int8FeaturesKHR float16_features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_FLOAT16_INT8_FEATURES_KHR,
+		.pNext = nullptr,
+		.shaderFloat16 = VK_FALSE,
+		.shaderInt8 = VK_FALSE
+	};
+
+	VkPhysicalDeviceFeatures2 features2 = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+		.pNext = &float16_features,
+		.features = {}
+	};
+
+	vkGetPhysicalDeviceFeatures2(physical_dev, &features2);
+
+	return float16_features.shaderFloat16 == VK_TRUE;
+}
+
+// -bda, through VK_KHR_buffer_device_address for the same reason. the extension needs a 1.1 device
+static bool query_buffer_device_address(VkPhysicalDevice physical_dev, const std::uint32_t instance_api_version) {
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(physical_dev, &props);
+
+	if (instance_api_version < VK_API_VERSION_1_1 || props.apiVersion < VK_API_VERSION_1_1 || !has_device_extension(physical_dev, VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME))
+		return false;
+
+	VkPhysicalDeviceBufferDeviceAddressFeaturesKHR address_features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES_KHR,
+		.pNext = nullptr,
+		.bufferDeviceAddress = VK_FALSE,
+		.bufferDeviceAddressCaptureReplay = VK_FALSE,
+		.bufferDeviceAddressMultiDevice = VK_FALSE
+	};
+
+	VkPhysicalDeviceFeatures2 features2 = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+		.pNext = &address_features,
+		.features = {}
+	};
+
+	vkGetPhysicalDeviceFeatures2(physical_dev, &features2);
+
+	return address_features.bufferDeviceAddress == VK_TRUE;
+}
+
+// workgroups of the persistent kernel that are sure to be resident at the same time: one per
+// multiprocessor, for the vendors that report how many there are. 0 when the count is unknown
+static std::uint32_t query_resident_workgroups(VkPhysicalDevice physical_dev, const std::uint32_t instance_api_version) {
+	if (instance_api_version < VK_API_VERSION_1_1)
+		return 0;
+
+	VkPhysicalDeviceShaderSMBuiltinsPropertiesNV sm_props = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_SM_BUILTINS_PROPERTIES_NV,
+		.pNext = nullptr,
+		.shaderSMCount = 0,
+		.shaderWarpsPerSM = 0
+	};
+
+	VkPhysicalDeviceShaderCorePropertiesAMD core_props = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_CORE_PROPERTIES_AMD,
+		.pNext = nullptr,
+		.shaderEngineCount = 0,
+		.shaderArraysPerEngineCount = 0,
+		.computeUnitsPerShaderArray = 0,
+		.simdPerComputeUnit = 0,
+		.wavefrontsPerSimd = 0,
+		.wavefrontSize = 0,
+		.sgprsPerSimd = 0,
+		.minSgprAllocation = 0,
+		.maxSgprAllocation = 0,
+		.sgprAllocationGranularity = 0,
+		.vgprsPerSimd = 0,
+		.minVgprAllocation = 0,
+		.maxVgprAllocation = 0,
+		.vgprAllocationGranularity = 0
+	};
+
+	VkPhysicalDeviceProperties2 props2 = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+		.pNext = nullptr,
+		.properties = {}
+	};
+
+	if (has_device_extension(physical_dev, VK_NV_SHADER_SM_BUILTINS_EXTENSION_NAME)) {
+		props2.pNext = &sm_props;
+		vkGetPhysicalDeviceProperties2(physical_dev, &props2);
+		return sm_props.shaderSMCount;
+	}
+
+	if (has_device_extension(physical_dev, VK_AMD_SHADER_CORE_PROPERTIES_EXTENSION_NAME)) {
+		props2.pNext = &core_props;
+		vkGetPhysicalDeviceProperties2(physical_dev, &props2);
+		return core_props.shaderEngineCount * core_props.shaderArraysPerEngineCount * core_props.computeUnitsPerShaderArray;
+	}
+
+	return 0;
+}
+
+// whether a memory type is both DEVICE_LOCAL and HOST_VISIBLE in a heap of at least size. integrated
+// GPUs have one covering all of their memory, discrete ones the 256 MiB BAR window or, with
+// resizable BAR, all of VRAM
+static bool query_zero_copy_memory(VkPhysicalDevice physical_dev, const VkDeviceSize size) {
+	static const VkMemoryPropertyFlags zero_copy_flags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+
+	VkPhysicalDeviceMemoryProperties props;
+	vkGetPhysicalDeviceMemoryProperties(physical_dev, &props);
+
+	for (std::uint32_t t = 0; t < props.memoryTypeCount; t++) {
+		const VkMemoryType &type = props.memoryTypes[t];
+		if ((type.propertyFlags & zero_copy_flags) == zero_copy_flags && props.memoryHeaps[type.heapIndex].size >= size)
+			return true;
+	}
+
+	return false;
+}
+
+// VK_EXT_external_memory_host, host memory we mapped ourselves used as a transfer buffer, see
+// import_host_buf. external memory is core in 1.1, alignment is what the pointer and size of an
+// import have to be aligned to
+static bool query_external_memory_host(VkPhysicalDevice physical_dev, const std::uint32_t instance_api_version, VkDeviceSize &alignment) {
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(physical_dev, &props);
+
+	alignment = 0;
+
+	if (instance_api_version < VK_API_VERSION_1_1 || props.apiVersion < VK_API_VERSION_1_1 || !has_device_extension(physical_dev, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME))
+		return false;
+
+	VkPhysicalDeviceExternalMemoryHostPropertiesEXT host_props = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT,
+		.pNext = nullptr,
+		.minImportedHostPointerAlignment = 0
+	};
+
+	VkPhysicalDeviceProperties2 props2 = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+		.pNext = &host_props,
+		.properties = {}
+	};
+
+	vkGetPhysicalDeviceProperties2(physical_dev, &props2);
+	alignment = host_props.minImportedHostPointerAlignment;
+
+	return alignment > 0;
+}
+
+// shader_float16 enables fp16 arithmetic and buffer_device_address buffer addresses in shaders, see query_shader_float16 and query_buffer_device_address.
+// external_memory_host enables host pointer imports, see query_external_memory_host. every queue a
+// topology could use is created up front: queue 0 of the compute family, queue 1 of it where the
+// family has two (compute_queue_count), and queue 0 of the first transfer only family, which is
+// dma_queue_family_idx and UINT32_MAX without one
+static void create_device(VkPhysicalDevice physical_dev, VkDevice &dev, std::uint32_t &compute_queue_family_idx, std::uint32_t &compute_queue_count, std::uint32_t &dma_queue_family_idx, const bool shader_float16, const bool buffer_device_address, const bool external_memory_host) {
+	static const std::array<float, 2> priorities = { 1.f, 1.f };
 
 	std::uint32_t count;
 	vkGetPhysicalDeviceQueueFamilyProperties(physical_dev, &count, nullptr);
@@ -339,8 +957,7 @@ static void create_device(VkPhysicalDevice physical_dev, VkDevice &dev, std::uin
 	vkGetPhysicalDeviceQueueFamilyProperties(physical_dev, &count, queue_families.data());
 
 	compute_queue_family_idx = std::numeric_limits<std::uint32_t>::max();
-	transfer_queue_family_idx = std::numeric_limits<std::uint32_t>::max();
-	transfer_queue_idx = 0;
+	dma_queue_family_idx = std::numeric_limits<std::uint32_t>::max();
 
 	for (std::size_t i = 0; i < queue_families.size(); i++) {
 		if (compute_queue_family_idx == std::numeric_limits<std::uint32_t>::max() && (queue_families[i].queueFlags & VK_QUEUE_COMPUTE_BIT)) {
@@ -348,8 +965,8 @@ static void create_device(VkPhysicalDevice physical_dev, VkDevice &dev, std::uin
 			continue;
 		}
 
-		if (transfer_queue_family_idx == std::numeric_limits<std::uint32_t>::max() && (queue_families[i].queueFlags & VK_QUEUE_TRANSFER_BIT)) {
-			transfer_queue_family_idx = static_cast<std::uint32_t>(i);
+		if (dma_queue_family_idx == std::numeric_limits<std::uint32_t>::max() && (queue_families[i].queueFlags & VK_QUEUE_TRANSFER_BIT)) {
+			dma_queue_family_idx = static_cast<std::uint32_t>(i);
 			continue;
 		}
 	}
@@ -357,38 +974,70 @@ static void create_device(VkPhysicalDevice physical_dev, VkDevice &dev, std::uin
 	if (compute_queue_family_idx == std::numeric_limits<std::uint32_t>::max())
 		throw std::runtime_error("No compute queue found!");
 
-	if (transfer_queue_family_idx == std::numeric_limits<std::uint32_t>::max()) {
-		std::printf("! No pure transfer queue family found, falling back to extra compute queue\n");
-		transfer_queue_family_idx = compute_queue_family_idx;
-		transfer_queue_idx = 1;
-	}
+	compute_queue_count = std::min<std::uint32_t>(queue_families[compute_queue_family_idx].queueCount, 2);
 
-	const std::array<VkDeviceQueueCreateInfo, 2> queue_create_infos = {
+	std::vector<VkDeviceQueueCreateInfo> queue_create_infos = {
 		VkDeviceQueueCreateInfo {
 			.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
 			.pNext = nullptr,
 			.flags = 0,
 			.queueFamilyIndex = compute_queue_family_idx,
-			.queueCount = 1,
-			.pQueuePriorities = &priority
-		},
-		VkDeviceQueueCreateInfo {
+			.queueCount = compute_queue_count,
+			.pQueuePriorities = priorities.data()
+		}
+	};
+
+	if (dma_queue_family_idx != std::numeric_limits<std::uint32_t>::max()) {
+		queue_create_infos.push_back(VkDeviceQueueCreateInfo {
 			.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
 			.pNext = nullptr,
 			.flags = 0,
-			.queueFamilyIndex = transfer_queue_family_idx,
+			.queueFamilyIndex = dma_queue_family_idx,
 			.queueCount = 1,
-			.pQueuePriorities = &priority
-		}
-	};
+			.pQueuePriorities = priorities.data()
+		});
+	}
 
-	static constinit std::array<const char *, 1> device_exts = {
+	std::vector<const char *> device_exts = {
 		"VK_KHR_portability_subset"
 	};
 
+	// feature structs are chained in front of each other as they are enabled
+	void *features = nullptr;
+
+	VkPhysicalDeviceShaderFloat16Int8FeaturesKHR float16_features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_FLOAT16_INT8_FEATURES_KHR,
+		.pNext = nullptr,
+		.shaderFloat16 = VK_TRUE,
+		.shaderInt8 = VK_FALSE
+	};
+
+	VkPhysicalDeviceBufferDeviceAddressFeaturesKHR address_features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES_KHR,
+		.pNext = nullptr,
+		.bufferDeviceAddress = VK_TRUE,
+		.bufferDeviceAddressCaptureReplay = VK_FALSE,
+		.bufferDeviceAddressMultiDevice = VK_FALSE
+	};
+
+	if (shader_float16) {
+		device_exts.push_back(VK_KHR_SHADER_FLOAT16_INT8_EXTENSION_NAME);
+		float16_features.pNext = features;
+		features = &float16_features;
+	}
+
+	if (buffer_device_address) {
+		device_exts.push_back(VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME);
+		address_features.pNext = features;
+		features = &address_features;
+	}
+
+	if (external_memory_host)
+		device_exts.push_back(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+
 	const VkDeviceCreateInfo create_info = {
 		.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-		.pNext = nullptr,
+		.pNext = features,
 		.flags = 0,
 		.queueCreateInfoCount = static_cast<std::uint32_t>(queue_create_infos.size()),
 		.pQueueCreateInfos = queue_create_infos.data(),
@@ -403,7 +1052,9 @@ static void create_device(VkPhysicalDevice physical_dev, VkDevice &dev, std::uin
 		throw std::runtime_error("Cannot create VkDevice!");
 }
 
-static void create_allocator(const VolkDeviceTable &funcs, VkInstance inst, VkPhysicalDevice physical_dev, VkDevice dev, VmaAllocator &allocator) {
+// buffer_device_address has to match the device, VMA then allocates address capable memory for
+// buffers created with VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+static void create_allocator(const VolkDeviceTable &funcs, VkInstance inst, VkPhysicalDevice physical_dev, VkDevice dev, VmaAllocator &allocator, const bool buffer_device_address) {
 	const VmaVulkanFunctions vulkan_funcs = {
 		.vkGetInstanceProcAddr = vkGetInstanceProcAddr,
 		.vkGetDeviceProcAddr = vkGetDeviceProcAddr,
@@ -441,8 +1092,12 @@ static void create_allocator(const VolkDeviceTable &funcs, VkInstance inst, VkPh
 #endif
 	};
 
+	VmaAllocatorCreateFlags flags = 0;
+	if (buffer_device_address)
+		flags |= VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
+
 	const VmaAllocatorCreateInfo allocator_create_info = {
-		.flags = 0,
+		.flags = flags,
 		.physicalDevice = physical_dev,
 		.device = dev,
 		.preferredLargeHeapBlockSize = 0,
@@ -501,17 +1156,115 @@ static void create_desc_and_pipeline_layout(const VolkDeviceTable &funcs, VkDevi
 		throw std::runtime_error("Cannot create VkPipelineLayout!");
 }
 
-static void create_compute_pipeline(const VolkDeviceTable &funcs, VkDevice dev, VkPipelineLayout pipeline_layout, const std::uint32_t *code, const std::size_t code_size, VkPipeline &pipeline) {
-	const VkShaderModuleCreateInfo shader_module_create_info = {
-		.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+// storage buffers in the aux layout, besides its uniform buffer
+static const std::uint32_t aux_storage_buf_count = 4;
+
+// particles, UBO and three more storage buffers: binding 2 (accelerations, quantized output,
+// selected particles), binding 3 (fp16 positions, double-single low words, grid barrier,
+// reduction partials, scan offsets) and binding 4 (DispatchArgs). StepConstants are pushed on top
+static void create_aux_desc_and_pipeline_layout(const VolkDeviceTable &funcs, VkDevice dev, VkDescriptorSetLayout &desc_set_layout, VkPipelineLayout &pipeline_layout) {
+	const std::array<VkDescriptorSetLayoutBinding, 5> desc_set_layout_bindings = {
+		VkDescriptorSetLayoutBinding {
+			.binding = 0,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+			.pImmutableSamplers = nullptr
+		},
+		VkDescriptorSetLayoutBinding {
+			.binding = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+			.pImmutableSamplers = nullptr
+		},
+		VkDescriptorSetLayoutBinding {
+			.binding = 2,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+			.pImmutableSamplers = nullptr
+		},
+		VkDescriptorSetLayoutBinding {
+			.binding = 3,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+			.pImmutableSamplers = nullptr
+		},
+		VkDescriptorSetLayoutBinding {
+			.binding = 4,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+			.pImmutableSamplers = nullptr
+		}
+	};
+
+	const VkDescriptorSetLayoutCreateInfo desc_set_layout_create_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
 		.pNext = nullptr,
 		.flags = 0,
-		.codeSize = code_size,
-		.pCode = code
+		.bindingCount = static_cast<std::uint32_t>(desc_set_layout_bindings.size()),
+		.pBindings = desc_set_layout_bindings.data()
 	};
 
-	VkShaderModule shader_module;
-	if (funcs.vkCreateShaderModule(dev, &shader_module_create_info, nullptr, &shader_module) != VK_SUCCESS)
+	if (funcs.vkCreateDescriptorSetLayout(dev, &desc_set_layout_create_info, nullptr, &desc_set_layout) != VK_SUCCESS)
+		throw std::runtime_error("Cannot create VkDescriptorSetLayout!");
+
+	const VkPushConstantRange push_constant_range = {
+		.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		.offset = 0,
+		.size = sizeof(StepConstants)
+	};
+
+	const VkPipelineLayoutCreateInfo pipeline_layout_create_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.setLayoutCount = 1,
+		.pSetLayouts = &desc_set_layout,
+		.pushConstantRangeCount = 1,
+		.pPushConstantRanges = &push_constant_range,
+	};
+
+	if (funcs.vkCreatePipelineLayout(dev, &pipeline_layout_create_info, nullptr, &pipeline_layout) != VK_SUCCESS)
+		throw std::runtime_error("Cannot create VkPipelineLayout!");
+}
+
+// -bda passes bind no descriptor set, StepAddressConstants is all they get
+static void create_address_pipeline_layout(const VolkDeviceTable &funcs, VkDevice dev, VkPipelineLayout &pipeline_layout) {
+	const VkPushConstantRange push_constant_range = {
+		.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		.offset = 0,
+		.size = sizeof(StepAddressConstants)
+	};
+
+	const VkPipelineLayoutCreateInfo pipeline_layout_create_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.setLayoutCount = 0,
+		.pSetLayouts = nullptr,
+		.pushConstantRangeCount = 1,
+		.pPushConstantRanges = &push_constant_range,
+	};
+
+	if (funcs.vkCreatePipelineLayout(dev, &pipeline_layout_create_info, nullptr, &pipeline_layout) != VK_SUCCESS)
+		throw std::runtime_error("Cannot create VkPipelineLayout!");
+}
+
+static void create_compute_pipeline(const VolkDeviceTable &funcs, VkDevice dev, VkPipelineLayout pipeline_layout, const std::uint32_t *code, const std::size_t code_size, VkPipeline &pipeline, const VkSpecializationInfo *spec_info = nullptr) {
+	const VkShaderModuleCreateInfo shader_module_create_info = {
+		.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.codeSize = code_size,
+		.pCode = code
+	};
+
+	VkShaderModule shader_module;
+	if (funcs.vkCreateShaderModule(dev, &shader_module_create_info, nullptr, &shader_module) != VK_SUCCESS)
 		throw std::runtime_error("Cannot create VkShaderModule!");
 
 	const VkPipelineShaderStageCreateInfo pipeline_shader_stage_create_info = {
@@ -521,7 +1274,7 @@ static void create_compute_pipeline(const VolkDeviceTable &funcs, VkDevice dev,
 		.stage = VK_SHADER_STAGE_COMPUTE_BIT,
 		.module = shader_module,
 		.pName = "main",
-		.pSpecializationInfo = nullptr
+		.pSpecializationInfo = spec_info
 	};
 
 	const VkComputePipelineCreateInfo create_info = {
@@ -540,9 +1293,10 @@ static void create_compute_pipeline(const VolkDeviceTable &funcs, VkDevice dev,
 	funcs.vkDestroyShaderModule(dev, shader_module, nullptr);
 }
 
-static void create_desc_pool_and_set(const VolkDeviceTable &funcs, VkDevice dev, VkDescriptorSetLayout desc_set_layout, VkDescriptorPool &desc_pool, VkDescriptorSet &desc_set) {
+// storage_buf_count is 1 for the main layout and aux_storage_buf_count for the aux one
+static void create_desc_pool_and_set(const VolkDeviceTable &funcs, VkDevice dev, VkDescriptorSetLayout desc_set_layout, VkDescriptorPool &desc_pool, VkDescriptorSet &desc_set, const std::uint32_t storage_buf_count = 1) {
 	const std::array<VkDescriptorPoolSize, 2> desc_pool_sizes = {
-		VkDescriptorPoolSize { .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .descriptorCount = 1 },
+		VkDescriptorPoolSize { .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .descriptorCount = storage_buf_count },
 		VkDescriptorPoolSize { .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, .descriptorCount = 1 }
 	};
 
@@ -570,7 +1324,8 @@ static void create_desc_pool_and_set(const VolkDeviceTable &funcs, VkDevice dev,
 		throw std::runtime_error("Cannot allocate VkDescriptorSet!");
 }
 
-static void create_dev_buf(VmaAllocator allocator, VkBuffer &buf, VmaAllocation &buf_alloc, const VkDeviceSize size) {
+// extra_usage is VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT for buffers the -bda passes reach
+static void create_dev_buf(VmaAllocator allocator, VkBuffer &buf, VmaAllocation &buf_alloc, const VkDeviceSize size, const VkBufferUsageFlags extra_usage = 0) {
 	const VmaAllocationCreateInfo alloc_create_info = {
 		.flags = 0,
 		.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
@@ -587,7 +1342,7 @@ static void create_dev_buf(VmaAllocator allocator, VkBuffer &buf, VmaAllocation
 		.pNext = nullptr,
 		.flags = 0,
 		.size = size,
-		.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | extra_usage,
 		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
 		.queueFamilyIndexCount = 0,
 		.pQueueFamilyIndices = nullptr
@@ -597,8 +1352,41 @@ static void create_dev_buf(VmaAllocator allocator, VkBuffer &buf, VmaAllocation
 		throw std::runtime_error("Cannot allocate device buffer memory!");
 }
 
+// zero-copy particle buffer, device local and mapped for the host. random access so that the
+// host reads of snapshots and diagnostics are not write-combined where the driver can help it
+template<typename T>
+static void create_mapped_dev_buf(VmaAllocator allocator, VkBuffer &buf, VmaAllocation &buf_alloc, T *&pbuf, const VkDeviceSize size, const VkBufferUsageFlags extra_usage = 0) {
+	const VmaAllocationCreateInfo alloc_create_info = {
+		.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT,
+		.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
+		.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+		.preferredFlags = 0,
+		.memoryTypeBits = 0,
+		.pool = nullptr,
+		.pUserData = nullptr,
+		.priority = 0.f,
+	};
+
+	const VkBufferCreateInfo create_info = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.size = size,
+		.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | extra_usage,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.queueFamilyIndexCount = 0,
+		.pQueueFamilyIndices = nullptr
+	};
+
+	VmaAllocationInfo info;
+	if (vmaCreateBuffer(allocator, &create_info, &alloc_create_info, &buf, &buf_alloc, &info) != VK_SUCCESS)
+		throw std::runtime_error("Cannot allocate mapped device buffer memory!");
+
+	pbuf = reinterpret_cast<T *>(info.pMappedData);
+}
+
 template<typename T>
-static void create_uniform_buf(VmaAllocator allocator, VkBuffer &buf, VmaAllocation &buf_alloc, T *&pbuf, const VkDeviceSize size) {
+static void create_uniform_buf(VmaAllocator allocator, VkBuffer &buf, VmaAllocation &buf_alloc, T *&pbuf, const VkDeviceSize size, const VkBufferUsageFlags extra_usage = 0) {
 	const VmaAllocationCreateInfo alloc_create_info = {
 		.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
 		.usage = VMA_MEMORY_USAGE_AUTO,
@@ -615,7 +1403,7 @@ static void create_uniform_buf(VmaAllocator allocator, VkBuffer &buf, VmaAllocat
 		.pNext = nullptr,
 		.flags = 0,
 		.size = size,
-		.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+		.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | extra_usage,
 		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
 		.queueFamilyIndexCount = 0,
 		.pQueueFamilyIndices = nullptr
@@ -659,11 +1447,105 @@ static void create_host_buf(VmaAllocator allocator, VkBuffer &buf, VmaAllocation
 	pbuf = reinterpret_cast<T *>(info.pMappedData);
 }
 
-static void create_cmd_pool(const VolkDeviceTable &funcs, VkDevice dev, const uint32_t queue_family_idx, VkCommandPool &cmd_pool) {
+// transfer buffer over host memory that is already there, through VK_EXT_external_memory_host.
+// ptr and import_size have to be aligned to minImportedHostPointerAlignment, the buffer covers
+// the first size bytes. coherent memory types only, the host keeps using ptr and never maps mem.
+// false if the driver refuses the pointer, nothing is left behind then
+static bool import_host_buf(const VolkDeviceTable &funcs, VkPhysicalDevice physical_dev, VkDevice dev, void *ptr, const VkDeviceSize import_size, const VkDeviceSize size, const VkBufferUsageFlags usage, VkBuffer &buf, VkDeviceMemory &mem) {
+	VkMemoryHostPointerPropertiesEXT pointer_props = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT,
+		.pNext = nullptr,
+		.memoryTypeBits = 0
+	};
+
+	if (funcs.vkGetMemoryHostPointerPropertiesEXT(dev, VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT, ptr, &pointer_props) != VK_SUCCESS)
+		return false;
+
+	const VkExternalMemoryBufferCreateInfo external_info = {
+		.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO,
+		.pNext = nullptr,
+		.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT
+	};
+
+	const VkBufferCreateInfo create_info = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.pNext = &external_info,
+		.flags = 0,
+		.size = size,
+		.usage = usage,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.queueFamilyIndexCount = 0,
+		.pQueueFamilyIndices = nullptr
+	};
+
+	if (funcs.vkCreateBuffer(dev, &create_info, nullptr, &buf) != VK_SUCCESS)
+		return false;
+
+	VkMemoryRequirements reqs;
+	funcs.vkGetBufferMemoryRequirements(dev, buf, &reqs);
+
+	VkPhysicalDeviceMemoryProperties mem_props;
+	vkGetPhysicalDeviceMemoryProperties(physical_dev, &mem_props);
+
+	// cached where the driver offers it, the host reads the readbacks out of this memory
+	std::uint32_t type_idx = std::numeric_limits<std::uint32_t>::max();
+	for (std::uint32_t t = 0; t < mem_props.memoryTypeCount; t++) {
+		const VkMemoryPropertyFlags flags = mem_props.memoryTypes[t].propertyFlags;
+		if (!(reqs.memoryTypeBits & pointer_props.memoryTypeBits & (1u << t)) || !(flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+			continue;
+
+		if (flags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) {
+			type_idx = t;
+			break;
+		}
+
+		if (type_idx == std::numeric_limits<std::uint32_t>::max())
+			type_idx = t;
+	}
+
+	const VkImportMemoryHostPointerInfoEXT import_info = {
+		.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT,
+		.pNext = nullptr,
+		.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+		.pHostPointer = ptr
+	};
+
+	const VkMemoryAllocateInfo alloc_info = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+		.pNext = &import_info,
+		.allocationSize = import_size,
+		.memoryTypeIndex = type_idx
+	};
+
+	mem = VK_NULL_HANDLE;
+	if (type_idx == std::numeric_limits<std::uint32_t>::max() || funcs.vkAllocateMemory(dev, &alloc_info, nullptr, &mem) != VK_SUCCESS || funcs.vkBindBufferMemory(dev, buf, mem, 0) != VK_SUCCESS) {
+		if (mem != VK_NULL_HANDLE)
+			funcs.vkFreeMemory(dev, mem, nullptr);
+
+		funcs.vkDestroyBuffer(dev, buf, nullptr);
+		buf = VK_NULL_HANDLE;
+		mem = VK_NULL_HANDLE;
+		return false;
+	}
+
+	return true;
+}
+
+static VkDeviceAddress get_buf_address(const VolkDeviceTable &funcs, VkDevice dev, VkBuffer buf) {
+	const VkBufferDeviceAddressInfoKHR info = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO_KHR,
+		.pNext = nullptr,
+		.buffer = buf
+	};
+
+	return funcs.vkGetBufferDeviceAddressKHR(dev, &info);
+}
+
+static void create_cmd_pool(const VolkDeviceTable &funcs, VkDevice dev, const uint32_t queue_family_idx, VkCommandPool &cmd_pool, const VkCommandPoolCreateFlags flags = 0) {
 	const VkCommandPoolCreateInfo create_info = {
 		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
 		.pNext = nullptr,
-		.flags = 0,
+		.flags = flags,
 		.queueFamilyIndex = queue_family_idx
 	};
 
@@ -685,6 +1567,19 @@ static void create_cmd_bufs(const VolkDeviceTable &funcs, VkDevice dev, VkComman
 		throw std::runtime_error("Cannot allocate VkCommandBuffer!");
 }
 
+static void create_cmd_bufs(const VolkDeviceTable &funcs, VkDevice dev, VkCommandPool cmd_pool, std::vector<VkCommandBuffer> &cmd_bufs) {
+	const VkCommandBufferAllocateInfo alloc_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.pNext = nullptr,
+		.commandPool = cmd_pool,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.commandBufferCount = static_cast<std::uint32_t>(cmd_bufs.size())
+	};
+
+	if (funcs.vkAllocateCommandBuffers(dev, &alloc_info, cmd_bufs.data()) != VK_SUCCESS)
+		throw std::runtime_error("Cannot allocate VkCommandBuffer!");
+}
+
 static void update_desc_set(const VolkDeviceTable &funcs, VkDevice dev, VkDescriptorSet desc_set, VkBuffer dev_buf, VkBuffer uniform_buf, const VkDeviceSize dev_buf_range, const VkDeviceSize uniform_buf_range) {
 	const VkDescriptorBufferInfo storage_desc_buf_info = {
 		.buffer = dev_buf,
@@ -728,6 +1623,112 @@ static void update_desc_set(const VolkDeviceTable &funcs, VkDevice dev, VkDescri
 	funcs.vkUpdateDescriptorSets(dev, static_cast<std::uint32_t>(writes.size()), writes.data(), 0, nullptr);
 }
 
+// binding 3 is only written when aux2_buf is given, pipelines that do not use it can leave it empty
+static void update_aux_desc_set(const VolkDeviceTable &funcs, VkDevice dev, VkDescriptorSet desc_set, VkBuffer dev_buf, VkBuffer uniform_buf, VkBuffer aux_buf, const VkDeviceSize dev_buf_range, const VkDeviceSize uniform_buf_range, const VkDeviceSize aux_buf_range, VkBuffer aux2_buf = VK_NULL_HANDLE, const VkDeviceSize aux2_buf_range = 0) {
+	const std::array<VkDescriptorBufferInfo, 4> buf_infos = {
+		VkDescriptorBufferInfo { .buffer = dev_buf, .offset = 0, .range = dev_buf_range },
+		VkDescriptorBufferInfo { .buffer = uniform_buf, .offset = 0, .range = uniform_buf_range },
+		VkDescriptorBufferInfo { .buffer = aux_buf, .offset = 0, .range = aux_buf_range },
+		VkDescriptorBufferInfo { .buffer = aux2_buf, .offset = 0, .range = aux2_buf_range }
+	};
+
+	std::array<VkWriteDescriptorSet, 4> writes;
+	const std::uint32_t write_count = aux2_buf != VK_NULL_HANDLE ? 4 : 3;
+
+	for (std::uint32_t binding = 0; binding < write_count; binding++) {
+		writes[binding] = VkWriteDescriptorSet {
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.pNext = nullptr,
+			.dstSet = desc_set,
+			.dstBinding = binding,
+			.dstArrayElement = 0,
+			.descriptorCount = 1,
+			.descriptorType = binding == 1 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.pImageInfo = nullptr,
+			.pBufferInfo = &buf_infos[binding],
+			.pTexelBufferView = nullptr
+		};
+	}
+
+	funcs.vkUpdateDescriptorSets(dev, write_count, writes.data(), 0, nullptr);
+}
+
+// binding 4 of a force pass set, the other passes do not read it
+static void update_dispatch_desc(const VolkDeviceTable &funcs, VkDevice dev, VkDescriptorSet desc_set, VkBuffer dispatch_buf) {
+	const VkDescriptorBufferInfo buf_info = {
+		.buffer = dispatch_buf,
+		.offset = 0,
+		.range = sizeof(DispatchArgs)
+	};
+
+	const VkWriteDescriptorSet write = {
+		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+		.pNext = nullptr,
+		.dstSet = desc_set,
+		.dstBinding = 4,
+		.dstArrayElement = 0,
+		.descriptorCount = 1,
+		.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		.pImageInfo = nullptr,
+		.pBufferInfo = &buf_info,
+		.pTexelBufferView = nullptr
+	};
+
+	funcs.vkUpdateDescriptorSets(dev, 1, &write, 0, nullptr);
+}
+
+// fills the first size bytes of a device local buffer with value before first use, waits for the queue to drain
+static void fill_dev_buf(const VolkDeviceTable &funcs, VkDevice dev, VkQueue queue, VkCommandPool cmd_pool, VkBuffer buf, const VkDeviceSize size, const std::uint32_t value = 0) {
+	const VkCommandBufferAllocateInfo alloc_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.pNext = nullptr,
+		.commandPool = cmd_pool,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.commandBufferCount = 1
+	};
+
+	VkCommandBuffer cmd_buf;
+	if (funcs.vkAllocateCommandBuffers(dev, &alloc_info, &cmd_buf) != VK_SUCCESS)
+		throw std::runtime_error("Cannot allocate VkCommandBuffer!");
+
+	const VkCommandBufferBeginInfo begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.pNext = nullptr,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+		.pInheritanceInfo = nullptr
+	};
+
+	const VkMemoryBarrier fill_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+	};
+
+	funcs.vkBeginCommandBuffer(cmd_buf, &begin_info);
+	funcs.vkCmdFillBuffer(cmd_buf, buf, 0, size, value);
+	funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &fill_mem_barrier, 0, nullptr, 0, nullptr);
+	funcs.vkEndCommandBuffer(cmd_buf);
+
+	const VkSubmitInfo submit_info = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.pNext = nullptr,
+		.waitSemaphoreCount = 0,
+		.pWaitSemaphores = nullptr,
+		.pWaitDstStageMask = nullptr,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &cmd_buf,
+		.signalSemaphoreCount = 0,
+		.pSignalSemaphores = nullptr
+	};
+
+	if (funcs.vkQueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE) != VK_SUCCESS)
+		throw std::runtime_error("Cannot fill buffer!");
+
+	funcs.vkQueueWaitIdle(queue);
+	funcs.vkFreeCommandBuffers(dev, cmd_pool, 1, &cmd_buf);
+}
+
 static void create_semaphore(const VolkDeviceTable &funcs, VkDevice dev, VkSemaphore &semaphore) {
 	const VkSemaphoreCreateInfo create_info = {
 		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
@@ -750,84 +1751,154 @@ static void create_fence(const VolkDeviceTable &funcs, VkDevice dev, VkFence &fe
 		throw std::runtime_error("Cannot create VkSemaphore!");
 }
 
-static void record_cmd_buf_work(const VolkDeviceTable& funcs, VkCommandBuffer cmd_buf, VkPipeline particle_attraction, VkPipelineLayout pipeline_layout, VkDescriptorSet desc_set, VkBuffer dev_buf, const VkDeviceSize dev_buf_size, const std::uint32_t count, const std::uint32_t compute_queue_family_idx, const std::uint32_t transfer_queue_family_idx) {
-	const VkCommandBufferBeginInfo begin_info = {
-		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+// -bda builds push the buffer addresses with the constants, the others bind the aux set
+static void bind_force_constants(const VolkDeviceTable &funcs, VkCommandBuffer cmd_buf, const ForcePasses &force, const StepConstants &constants) {
+	if (force.desc_set == VK_NULL_HANDLE) {
+		const StepAddressConstants address_constants = {
+			.constants = constants,
+			.bodies = force.bodies_addr,
+			.ubo = force.ubo_addr,
+			.accel = force.accel_addr,
+			.dispatch = force.dispatch_addr
+		};
+
+		funcs.vkCmdPushConstants(cmd_buf, force.pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(address_constants), &address_constants);
+	} else {
+		funcs.vkCmdPushConstants(cmd_buf, force.pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+		funcs.vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, force.pipeline_layout, 0, 1, &force.desc_set, 0, nullptr);
+	}
+}
+
+static void record_force_step(const VolkDeviceTable &funcs, VkCommandBuffer cmd_buf, const ForcePasses &force, const StepConstants &constants) {
+	// integrate overwrites the positions the force pass read, and reads its accelerations
+	const VkMemoryBarrier force_to_integrate_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
 		.pNext = nullptr,
-		.flags = 0,
-		.pInheritanceInfo = nullptr
+		.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
 	};
 
-	const VkBufferMemoryBarrier host_to_dev_buf_mem_barrier = {
-		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+	// the previous step's indirect dispatches read the arguments about to be rewritten, and
+	// whatever changed the active count has to be visible to the arguments pass
+	const VkMemoryBarrier step_to_dispatch_args_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
 		.pNext = nullptr,
-		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
-		.srcQueueFamilyIndex = transfer_queue_family_idx,
-		.dstQueueFamilyIndex = compute_queue_family_idx,
-		.buffer = dev_buf,
-		.offset = 0,
-		.size = dev_buf_size
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
 	};
 
-	const VkBufferMemoryBarrier dev_to_host_buf_mem_barrier = {
-		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+	const VkMemoryBarrier dispatch_args_to_force_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
 		.pNext = nullptr,
-		.srcAccessMask = VK_ACCESS_SHADER_READ_BIT,
-		.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-		.srcQueueFamilyIndex = compute_queue_family_idx,
-		.dstQueueFamilyIndex = transfer_queue_family_idx,
-		.buffer = dev_buf,
-		.offset = 0,
-		.size = dev_buf_size
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT
 	};
 
-	funcs.vkBeginCommandBuffer(cmd_buf, &begin_info);
+	// every pass shares one layout, so the constants stay bound across the pipeline switches
+	bind_force_constants(funcs, cmd_buf, force, constants);
+
+	funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &step_to_dispatch_args_mem_barrier, 0, nullptr, 0, nullptr);
+	funcs.vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, force.dispatch_args);
+	funcs.vkCmdDispatch(cmd_buf, 1, 1, 1);
+	funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &dispatch_args_to_force_mem_barrier, 0, nullptr, 0, nullptr);
+
+	if (force.bounds != VK_NULL_HANDLE) {
+		const VkMemoryBarrier fill_to_bounds_mem_barrier = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+			.pNext = nullptr,
+			.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+		};
 
-	funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &host_to_dev_buf_mem_barrier, 0, nullptr);
+		const VkMemoryBarrier pass_to_pass_mem_barrier = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+			.pNext = nullptr,
+			.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+		};
 
-	funcs.vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, particle_attraction);
-	funcs.vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 0, 1, &desc_set, 0, nullptr);
-	funcs.vkCmdDispatch(cmd_buf, count, count, 1);
+		// the previous step's force pass may still be reading the half positions
+		funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+		funcs.vkCmdFillBuffer(cmd_buf, force.half_buf, offsetof(QuantizedBounds, min), sizeof(QuantizedBounds::min), 0xffffffffu);
+		funcs.vkCmdFillBuffer(cmd_buf, force.half_buf, offsetof(QuantizedBounds, max), sizeof(QuantizedBounds::max), 0);
+		funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &fill_to_bounds_mem_barrier, 0, nullptr, 0, nullptr);
+
+		funcs.vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, force.bounds);
+		funcs.vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, force.pipeline_layout, 0, 1, &force.bounds_desc_set, 0, nullptr);
+		funcs.vkCmdDispatch(cmd_buf, force.pack_group_count, 1, 1);
+		funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &pass_to_pass_mem_barrier, 0, nullptr, 0, nullptr);
+
+		funcs.vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, force.pack);
+		funcs.vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, force.pipeline_layout, 0, 1, &force.desc_set, 0, nullptr);
+		funcs.vkCmdDispatch(cmd_buf, force.pack_group_count, 1, 1);
+		funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &pass_to_pass_mem_barrier, 0, nullptr, 0, nullptr);
+	}
 
-	funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1, &dev_to_host_buf_mem_barrier, 0, nullptr);
+	funcs.vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, force.force);
+	if (force.desc_set != VK_NULL_HANDLE)
+		funcs.vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, force.pipeline_layout, 0, 1, &force.desc_set, 0, nullptr);
+	funcs.vkCmdDispatchIndirect(cmd_buf, force.dispatch_buf, offsetof(DispatchArgs, force));
+	funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &force_to_integrate_mem_barrier, 0, nullptr, 0, nullptr);
 
-	funcs.vkEndCommandBuffer(cmd_buf);
+	funcs.vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, force.integrate);
+	funcs.vkCmdDispatchIndirect(cmd_buf, force.dispatch_buf, offsetof(DispatchArgs, integrate));
 }
 
-static void record_cmd_buf_copy_host_to_dev(const VolkDeviceTable &funcs, VkCommandBuffer cmd_buf, VkBuffer host_buf, VkBuffer dev_buf, const VkDeviceSize size, const std::uint32_t compute_queue_family_idx, const std::uint32_t transfer_queue_family_idx) {
-	const VkCommandBufferBeginInfo begin_info = {
-		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+// the grid barrier state is reset on the GPU, the previous dispatch may not have left it at 0
+static void record_persistent_pass(const VolkDeviceTable &funcs, VkCommandBuffer cmd_buf, const ForcePasses &force, const StepConstants &constants) {
+	const VkMemoryBarrier step_to_fill_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
 		.pNext = nullptr,
-		.flags = 0,
-		.pInheritanceInfo = nullptr
+		.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT
 	};
 
-	const VkBufferCopy region = {
-		.srcOffset = 0,
-		.dstOffset = 0,
-		.size = size
+	const VkMemoryBarrier fill_to_persistent_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
 	};
 
-	const VkBufferMemoryBarrier host_to_dev_buf_mem_barrier = {
-		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+	funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &step_to_fill_mem_barrier, 0, nullptr, 0, nullptr);
+	funcs.vkCmdFillBuffer(cmd_buf, force.grid_buf, 0, sizeof(GridBarrier), 0);
+	funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &fill_to_persistent_mem_barrier, 0, nullptr, 0, nullptr);
+
+	funcs.vkCmdPushConstants(cmd_buf, force.pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+	funcs.vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, force.force);
+	funcs.vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, force.pipeline_layout, 0, 1, &force.desc_set, 0, nullptr);
+	funcs.vkCmdDispatch(cmd_buf, force.persistent_group_count, 1, 1);
+}
+
+// force.steps steps starting at constants.step, all with constants.delta_time
+static void record_force_passes(const VolkDeviceTable &funcs, VkCommandBuffer cmd_buf, const ForcePasses &force, const StepConstants &constants) {
+	// the previous submit's passes are done with the ranges, the semaphores ordered them before this one
+	const VkMemoryBarrier owned_to_dispatch_args_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
 		.pNext = nullptr,
 		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
-		.srcQueueFamilyIndex = transfer_queue_family_idx,
-		.dstQueueFamilyIndex = compute_queue_family_idx,
-		.buffer = dev_buf,
-		.offset = 0,
-		.size = size
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT
 	};
 
-	funcs.vkBeginCommandBuffer(cmd_buf, &begin_info);
-	funcs.vkCmdCopyBuffer(cmd_buf, host_buf, dev_buf, 1, &region);
-	funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &host_to_dev_buf_mem_barrier, 0, nullptr);
-	funcs.vkEndCommandBuffer(cmd_buf);
+	// every j-body into slot 0
+	const std::array<std::uint32_t, 5> ranges = { force.owned_first, force.owned_count, 0, all_bodies, 0 };
+
+	funcs.vkCmdUpdateBuffer(cmd_buf, force.dispatch_buf, offsetof(DispatchArgs, owned_first), sizeof(ranges), ranges.data());
+	funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &owned_to_dispatch_args_mem_barrier, 0, nullptr, 0, nullptr);
+
+	if (force.grid_buf != VK_NULL_HANDLE) {
+		record_persistent_pass(funcs, cmd_buf, force, constants);
+		return;
+	}
+
+	for (std::uint32_t s = 0; s < force.steps; s++)
+		record_force_step(funcs, cmd_buf, force, StepConstants { .delta_time = constants.delta_time, .step = constants.step + s });
 }
 
-static void record_cmd_buf_copy_dev_to_host(const VolkDeviceTable &funcs, VkCommandBuffer cmd_buf, VkBuffer host_buf, VkBuffer dev_buf, const VkDeviceSize size, const std::uint32_t compute_queue_family_idx, const std::uint32_t transfer_queue_family_idx) {
+// one stage of -multi-gpu ring, submitted on its own so it can wait for the j-block it reads to
+// land. the forces on the owned bodies from that block go into partial slot stage. stage 0 also
+// writes the owned range and sizes the dispatches, the last stage integrates the sum of the slots
+static void record_cmd_buf_ring_stage(const VolkDeviceTable &funcs, VkCommandBuffer cmd_buf, const ForcePasses &force, const StepConstants &constants, const std::uint32_t stage, const std::uint32_t stages, const std::uint32_t j_first, const std::uint32_t j_count) {
 	const VkCommandBufferBeginInfo begin_info = {
 		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
 		.pNext = nullptr,
@@ -835,28 +1906,416 @@ static void record_cmd_buf_copy_dev_to_host(const VolkDeviceTable &funcs, VkComm
 		.pInheritanceInfo = nullptr
 	};
 
-	const VkBufferCopy region = {
-		.srcOffset = 0,
-		.dstOffset = 0,
-		.size = size
+	// the previous stage may still be reading the ranges, or last step's integrate the positions
+	const VkMemoryBarrier stage_to_update_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
 	};
 
-	const VkBufferMemoryBarrier dev_to_host_buf_mem_barrier = {
-		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+	const VkMemoryBarrier update_to_force_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
 		.pNext = nullptr,
-		.srcAccessMask = VK_ACCESS_SHADER_READ_BIT,
-		.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-		.srcQueueFamilyIndex = compute_queue_family_idx,
-		.dstQueueFamilyIndex = transfer_queue_family_idx,
-		.buffer = dev_buf,
-		.offset = 0,
-		.size = size
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT
 	};
 
-	const VkBufferMemoryBarrier host_to_dev_buf_mem_barrier = {
-		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+	const VkMemoryBarrier dispatch_args_to_force_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
 		.pNext = nullptr,
-		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT
+	};
+
+	// integrate reads the partial slots of every stage so far, they were submitted earlier on this queue
+	const VkMemoryBarrier force_to_integrate_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+	};
+
+	const std::array<std::uint32_t, 5> ranges = { force.owned_first, force.owned_count, j_first, j_count, stage };
+
+	funcs.vkBeginCommandBuffer(cmd_buf, &begin_info);
+	funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &stage_to_update_mem_barrier, 0, nullptr, 0, nullptr);
+
+	// the owned range only changes between submits
+	if (stage == 0)
+		funcs.vkCmdUpdateBuffer(cmd_buf, force.dispatch_buf, offsetof(DispatchArgs, owned_first), sizeof(ranges), ranges.data());
+	else
+		funcs.vkCmdUpdateBuffer(cmd_buf, force.dispatch_buf, offsetof(DispatchArgs, j_first), 3*sizeof(std::uint32_t), &ranges[2]);
+	funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &update_to_force_mem_barrier, 0, nullptr, 0, nullptr);
+
+	bind_force_constants(funcs, cmd_buf, force, constants);
+
+	if (stage == 0) {
+		funcs.vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, force.dispatch_args);
+		funcs.vkCmdDispatch(cmd_buf, 1, 1, 1);
+		funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &dispatch_args_to_force_mem_barrier, 0, nullptr, 0, nullptr);
+	}
+
+	funcs.vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, force.force);
+	funcs.vkCmdDispatchIndirect(cmd_buf, force.dispatch_buf, offsetof(DispatchArgs, force));
+
+	if (stage + 1 == stages) {
+		funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &force_to_integrate_mem_barrier, 0, nullptr, 0, nullptr);
+		funcs.vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, force.integrate);
+		funcs.vkCmdDispatchIndirect(cmd_buf, force.dispatch_buf, offsetof(DispatchArgs, integrate));
+	}
+
+	funcs.vkEndCommandBuffer(cmd_buf);
+}
+
+static void record_quantize_passes(const VolkDeviceTable &funcs, VkCommandBuffer cmd_buf, const QuantizePasses &quantize, const std::uint32_t compute_queue_family_idx, const std::uint32_t transfer_queue_family_idx) {
+	const VkMemoryBarrier step_to_bounds_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+	};
+
+	const VkMemoryBarrier bounds_to_quantize_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+	};
+
+	const VkBufferMemoryBarrier quantize_to_host_buf_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+		.srcQueueFamilyIndex = compute_queue_family_idx,
+		.dstQueueFamilyIndex = transfer_queue_family_idx,
+		.buffer = quantize.buf,
+		.offset = 0,
+		.size = quantize.buf_size
+	};
+
+	const std::uint32_t pairs = (quantize.particle_count + 1) / 2;
+
+	// reset the bounds, the quantized data is overwritten as a whole so nothing needs to be kept
+	funcs.vkCmdFillBuffer(cmd_buf, quantize.buf, offsetof(QuantizedBounds, min), sizeof(QuantizedBounds::min), 0xffffffffu);
+	funcs.vkCmdFillBuffer(cmd_buf, quantize.buf, offsetof(QuantizedBounds, max), sizeof(QuantizedBounds::max), 0);
+	funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &step_to_bounds_mem_barrier, 0, nullptr, 0, nullptr);
+
+	funcs.vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, quantize.bounds);
+	funcs.vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, quantize.pipeline_layout, 0, 1, &quantize.desc_set, 0, nullptr);
+	funcs.vkCmdDispatch(cmd_buf, (quantize.particle_count + quantize_local_size - 1) / quantize_local_size, 1, 1);
+	funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &bounds_to_quantize_mem_barrier, 0, nullptr, 0, nullptr);
+
+	funcs.vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, quantize.quantize);
+	funcs.vkCmdDispatch(cmd_buf, (pairs + quantize_local_size - 1) / quantize_local_size, 1, 1);
+
+	// within one family the semaphore the copy waits on orders it after the passes
+	if (compute_queue_family_idx != transfer_queue_family_idx)
+		funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1, &quantize_to_host_buf_mem_barrier, 0, nullptr);
+}
+
+static void record_reduce_passes(const VolkDeviceTable &funcs, VkCommandBuffer cmd_buf, const ReducePasses &reduce) {
+	const VkMemoryBarrier step_to_reduce_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+	};
+
+	const VkMemoryBarrier reduce_to_final_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+	};
+
+	const VkMemoryBarrier final_to_copy_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT
+	};
+
+	const VkMemoryBarrier copy_to_host_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_HOST_READ_BIT
+	};
+
+	const VkBufferCopy region = {
+		.srcOffset = 0,
+		.dstOffset = 0,
+		.size = sizeof(Reduction)
+	};
+
+	funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &step_to_reduce_mem_barrier, 0, nullptr, 0, nullptr);
+
+	funcs.vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, reduce.reduce);
+	funcs.vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, reduce.pipeline_layout, 0, 1, &reduce.desc_set, 0, nullptr);
+	funcs.vkCmdDispatch(cmd_buf, reduce.group_count, 1, 1);
+	funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &reduce_to_final_mem_barrier, 0, nullptr, 0, nullptr);
+
+	funcs.vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, reduce.reduce_final);
+	funcs.vkCmdDispatch(cmd_buf, 1, 1, 1);
+	funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &final_to_copy_mem_barrier, 0, nullptr, 0, nullptr);
+
+	funcs.vkCmdCopyBuffer(cmd_buf, reduce.buf, reduce.host_buf, 1, &region);
+	funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &copy_to_host_mem_barrier, 0, nullptr, 0, nullptr);
+}
+
+static void record_roi_passes(const VolkDeviceTable &funcs, VkCommandBuffer cmd_buf, const RoiPasses &roi, const std::uint32_t compute_queue_family_idx, const std::uint32_t transfer_queue_family_idx) {
+	const VkMemoryBarrier step_to_update_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT
+	};
+
+	const VkMemoryBarrier update_to_select_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+	};
+
+	const VkMemoryBarrier pass_to_pass_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+	};
+
+	const VkBufferMemoryBarrier roi_to_host_buf_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+		.srcQueueFamilyIndex = compute_queue_family_idx,
+		.dstQueueFamilyIndex = transfer_queue_family_idx,
+		.buffer = roi.buf,
+		.offset = 0,
+		.size = roi.copy_size
+	};
+
+	funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &step_to_update_mem_barrier, 0, nullptr, 0, nullptr);
+	funcs.vkCmdUpdateBuffer(cmd_buf, roi.buf, 0, sizeof(RoiParams), &roi.params);
+	funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &update_to_select_mem_barrier, 0, nullptr, 0, nullptr);
+
+	funcs.vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, roi.select);
+	funcs.vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, roi.pipeline_layout, 0, 1, &roi.desc_set, 0, nullptr);
+	funcs.vkCmdDispatch(cmd_buf, roi.group_count, 1, 1);
+	funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &pass_to_pass_mem_barrier, 0, nullptr, 0, nullptr);
+
+	funcs.vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, roi.scan);
+	funcs.vkCmdDispatch(cmd_buf, 1, 1, 1);
+	funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &pass_to_pass_mem_barrier, 0, nullptr, 0, nullptr);
+
+	funcs.vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, roi.compact);
+	funcs.vkCmdDispatch(cmd_buf, roi.group_count, 1, 1);
+	if (compute_queue_family_idx != transfer_queue_family_idx)
+		funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1, &roi_to_host_buf_mem_barrier, 0, nullptr);
+}
+
+// zero_copy leaves dev_buf on the compute queue and makes the last step visible to the host
+// instead of releasing dev_buf to the transfer queue. force is null for the legacy kernel, which reads delta_time from the UBO and ignores constants. the force and integrate passes are dispatched indirectly, see DispatchArgs. reduce may be null, otherwise the conserved quantities of the last step are reduced into its host_buf. quantize and roi may be null, otherwise their passes run after the step and their output is released to the transfer queue as well
+static void record_cmd_buf_work(const VolkDeviceTable& funcs, VkCommandBuffer cmd_buf, VkPipeline particle_attraction, VkPipelineLayout pipeline_layout, VkDescriptorSet desc_set, VkBuffer dev_buf, const VkDeviceSize dev_buf_size, const bool zero_copy, const std::uint32_t count, const std::uint32_t compute_queue_family_idx, const std::uint32_t transfer_queue_family_idx, const ForcePasses *force, const StepConstants &constants, const ReducePasses *reduce, const QuantizePasses *quantize = nullptr, const RoiPasses *roi = nullptr) {
+	const VkCommandBufferBeginInfo begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.pInheritanceInfo = nullptr
+	};
+
+	const VkBufferMemoryBarrier host_to_dev_buf_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+		.srcQueueFamilyIndex = transfer_queue_family_idx,
+		.dstQueueFamilyIndex = compute_queue_family_idx,
+		.buffer = dev_buf,
+		.offset = 0,
+		.size = dev_buf_size
+	};
+
+	const VkBufferMemoryBarrier dev_to_host_buf_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_SHADER_READ_BIT,
+		.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.srcQueueFamilyIndex = compute_queue_family_idx,
+		.dstQueueFamilyIndex = transfer_queue_family_idx,
+		.buffer = dev_buf,
+		.offset = 0,
+		.size = dev_buf_size
+	};
+
+	// host writes are made visible by the submit itself
+	const VkMemoryBarrier dev_to_host_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_HOST_READ_BIT
+	};
+
+	// ownership only moves between families, within one the semaphores between the queues order the copies
+	const bool ownership_transfer = !zero_copy && compute_queue_family_idx != transfer_queue_family_idx;
+
+	funcs.vkBeginCommandBuffer(cmd_buf, &begin_info);
+
+	if (ownership_transfer)
+		funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &host_to_dev_buf_mem_barrier, 0, nullptr);
+
+	if (force != nullptr) {
+		record_force_passes(funcs, cmd_buf, *force, constants);
+	} else {
+		funcs.vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, particle_attraction);
+		funcs.vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 0, 1, &desc_set, 0, nullptr);
+		funcs.vkCmdDispatch(cmd_buf, count, count, 1);
+	}
+
+	if (reduce != nullptr)
+		record_reduce_passes(funcs, cmd_buf, *reduce);
+
+	if (quantize != nullptr)
+		record_quantize_passes(funcs, cmd_buf, *quantize, compute_queue_family_idx, transfer_queue_family_idx);
+
+	if (roi != nullptr)
+		record_roi_passes(funcs, cmd_buf, *roi, compute_queue_family_idx, transfer_queue_family_idx);
+
+	if (zero_copy)
+		funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &dev_to_host_mem_barrier, 0, nullptr, 0, nullptr);
+	else if (ownership_transfer)
+		funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1, &dev_to_host_buf_mem_barrier, 0, nullptr);
+
+	funcs.vkEndCommandBuffer(cmd_buf);
+}
+
+// copies the ranges to the same offsets and hands the whole of dev_buf to the compute queue
+static void record_cmd_buf_copy_host_to_dev(const VolkDeviceTable &funcs, VkCommandBuffer cmd_buf, VkBuffer host_buf, VkBuffer dev_buf, const VkDeviceSize size, const std::vector<ReadbackRange> &ranges, const std::uint32_t compute_queue_family_idx, const std::uint32_t transfer_queue_family_idx) {
+	const VkCommandBufferBeginInfo begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.pInheritanceInfo = nullptr
+	};
+
+	std::vector<VkBufferCopy> regions;
+	for (const auto &range : ranges) {
+		regions.push_back(VkBufferCopy {
+			.srcOffset = range.offset,
+			.dstOffset = range.offset,
+			.size = range.size
+		});
+	}
+
+	const VkBufferMemoryBarrier host_to_dev_buf_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+		.srcQueueFamilyIndex = transfer_queue_family_idx,
+		.dstQueueFamilyIndex = compute_queue_family_idx,
+		.buffer = dev_buf,
+		.offset = 0,
+		.size = size
+	};
+
+	funcs.vkBeginCommandBuffer(cmd_buf, &begin_info);
+	if (!regions.empty())
+		funcs.vkCmdCopyBuffer(cmd_buf, host_buf, dev_buf, static_cast<std::uint32_t>(regions.size()), regions.data());
+	if (compute_queue_family_idx != transfer_queue_family_idx)
+		funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &host_to_dev_buf_mem_barrier, 0, nullptr);
+	funcs.vkEndCommandBuffer(cmd_buf);
+}
+
+// sorted slots as byte ranges of the particle buffer, neighbours merged
+static std::vector<ReadbackRange> slot_ranges(const std::vector<std::uint32_t> &slots) {
+	std::vector<ReadbackRange> ranges;
+
+	for (const std::uint32_t slot : slots) {
+		if (!ranges.empty() && ranges.back().offset + ranges.back().size == sizeof(Particle) * slot)
+			ranges.back().size += sizeof(Particle);
+		else
+			ranges.push_back(ReadbackRange { .offset = sizeof(Particle) * slot, .size = sizeof(Particle) });
+	}
+
+	return ranges;
+}
+
+// everything device does not own, in bytes
+static std::vector<ReadbackRange> foreign_ranges(const std::size_t device, const std::vector<std::uint32_t> &owned_first, const std::vector<std::uint32_t> &owned_count, const VkDeviceSize size) {
+	const VkDeviceSize owned_begin = sizeof(Particle) * owned_first[device];
+	const VkDeviceSize owned_end = sizeof(Particle) * (owned_first[device] + owned_count[device]);
+
+	std::vector<ReadbackRange> foreign;
+	if (owned_begin > 0)
+		foreign.push_back(ReadbackRange { .offset = 0, .size = owned_begin });
+	if (owned_end < size)
+		foreign.push_back(ReadbackRange { .offset = owned_end, .size = size - owned_end });
+
+	return foreign;
+}
+
+// the -multi-gpu uploads that follow the owned ranges, recorded again whenever they move.
+// foreign_cmd_buf gets everything device does not own for split, VK_NULL_HANDLE otherwise, and
+// ring_cmd_bufs the block of every ring stage after the first, empty otherwise
+static void record_owned_range_uploads(const VolkDeviceTable &funcs, const std::size_t device, const std::vector<std::uint32_t> &owned_first, const std::vector<std::uint32_t> &owned_count, VkCommandBuffer foreign_cmd_buf, const std::vector<VkCommandBuffer> &ring_cmd_bufs, VkBuffer host_buf, VkBuffer dev_buf, const VkDeviceSize size, const std::uint32_t compute_queue_family_idx, const std::uint32_t transfer_queue_family_idx) {
+	if (foreign_cmd_buf != VK_NULL_HANDLE)
+		record_cmd_buf_copy_host_to_dev(funcs, foreign_cmd_buf, host_buf, dev_buf, size, foreign_ranges(device, owned_first, owned_count, size), compute_queue_family_idx, transfer_queue_family_idx);
+
+	// stage s reads the block of device - s, stage 0 the device's own
+	const std::size_t stages = owned_first.size();
+	for (std::size_t s = 1; s <= ring_cmd_bufs.size(); s++) {
+		const std::size_t block = (device + stages - s) % stages;
+		const ReadbackRange range = {
+			.offset = sizeof(Particle) * owned_first[block],
+			.size = sizeof(Particle) * owned_count[block]
+		};
+
+		record_cmd_buf_copy_host_to_dev(funcs, ring_cmd_bufs[s - 1], host_buf, dev_buf, size, { range }, compute_queue_family_idx, transfer_queue_family_idx);
+	}
+}
+
+// recorded before every submit with the ranges the readback consumers asked for. with none dev_buf
+// only passes through the transfer queue, the next step acquires it from there if the families
+// differ. roi may be null, otherwise the selection it released is copied as well. without
+// hand_back dev_buf stays with the transfer queue for a HOST->DEV copy to hand back instead
+static void record_cmd_buf_copy_dev_to_host(const VolkDeviceTable &funcs, VkCommandBuffer cmd_buf, VkBuffer host_buf, VkBuffer dev_buf, const VkDeviceSize size, const std::vector<ReadbackRange> &ranges, const std::uint32_t compute_queue_family_idx, const std::uint32_t transfer_queue_family_idx, const RoiPasses *roi = nullptr, const bool hand_back = true) {
+	const VkCommandBufferBeginInfo begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.pInheritanceInfo = nullptr
+	};
+
+	std::vector<VkBufferCopy> regions;
+	for (const auto &range : ranges) {
+		regions.push_back(VkBufferCopy {
+			.srcOffset = range.offset,
+			.dstOffset = range.offset,
+			.size = range.size
+		});
+	}
+
+	const VkBufferMemoryBarrier dev_to_host_buf_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_SHADER_READ_BIT,
+		.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.srcQueueFamilyIndex = compute_queue_family_idx,
+		.dstQueueFamilyIndex = transfer_queue_family_idx,
+		.buffer = dev_buf,
+		.offset = 0,
+		.size = size
+	};
+
+	const VkBufferMemoryBarrier host_to_dev_buf_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
 		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
 		.srcQueueFamilyIndex = transfer_queue_family_idx,
 		.dstQueueFamilyIndex = compute_queue_family_idx,
@@ -865,13 +2324,573 @@ static void record_cmd_buf_copy_dev_to_host(const VolkDeviceTable &funcs, VkComm
 		.size = size
 	};
 
+	const bool ownership_transfer = compute_queue_family_idx != transfer_queue_family_idx;
+
 	funcs.vkBeginCommandBuffer(cmd_buf, &begin_info);
-	funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1, &dev_to_host_buf_mem_barrier, 0, nullptr);
-	funcs.vkCmdCopyBuffer(cmd_buf, dev_buf, host_buf, 1, &region);
-	funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &host_to_dev_buf_mem_barrier, 0, nullptr);
+	if (ownership_transfer)
+		funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1, &dev_to_host_buf_mem_barrier, 0, nullptr);
+	if (!regions.empty())
+		funcs.vkCmdCopyBuffer(cmd_buf, dev_buf, host_buf, static_cast<std::uint32_t>(regions.size()), regions.data());
+
+	if (roi != nullptr) {
+		const VkBufferMemoryBarrier acquire_roi_buf_mem_barrier = {
+			.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+			.pNext = nullptr,
+			.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+			.srcQueueFamilyIndex = compute_queue_family_idx,
+			.dstQueueFamilyIndex = transfer_queue_family_idx,
+			.buffer = roi->buf,
+			.offset = 0,
+			.size = roi->copy_size
+		};
+
+		const VkBufferCopy roi_region = {
+			.srcOffset = 0,
+			.dstOffset = 0,
+			.size = roi->copy_size
+		};
+
+		// the selection is rewritten from scratch next time, so it is not handed back
+		if (ownership_transfer)
+			funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1, &acquire_roi_buf_mem_barrier, 0, nullptr);
+		funcs.vkCmdCopyBuffer(cmd_buf, roi->buf, roi->host_buf, 1, &roi_region);
+	}
+	if (ownership_transfer && hand_back)
+		funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &host_to_dev_buf_mem_barrier, 0, nullptr);
 	funcs.vkEndCommandBuffer(cmd_buf);
 }
 
+// takes the place of the full DEV->HOST copy on steps that end in a lossy snapshot
+static void record_cmd_buf_copy_quantized_to_host(const VolkDeviceTable &funcs, VkCommandBuffer cmd_buf, VkBuffer host_buf, VkBuffer quantize_buf, VkBuffer dev_buf, const VkDeviceSize quantize_size, const VkDeviceSize dev_buf_size, const std::uint32_t compute_queue_family_idx, const std::uint32_t transfer_queue_family_idx) {
+	const VkCommandBufferBeginInfo begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.pInheritanceInfo = nullptr
+	};
+
+	const VkBufferCopy region = {
+		.srcOffset = 0,
+		.dstOffset = 0,
+		.size = quantize_size
+	};
+
+	// dev_buf is not copied but still has to pass through the transfer queue, the next step acquires it from there
+	const std::array<VkBufferMemoryBarrier, 2> acquire_buf_mem_barriers = {
+		VkBufferMemoryBarrier {
+			.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+			.pNext = nullptr,
+			.srcAccessMask = VK_ACCESS_SHADER_READ_BIT,
+			.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+			.srcQueueFamilyIndex = compute_queue_family_idx,
+			.dstQueueFamilyIndex = transfer_queue_family_idx,
+			.buffer = dev_buf,
+			.offset = 0,
+			.size = dev_buf_size
+		},
+		VkBufferMemoryBarrier {
+			.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+			.pNext = nullptr,
+			.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+			.srcQueueFamilyIndex = compute_queue_family_idx,
+			.dstQueueFamilyIndex = transfer_queue_family_idx,
+			.buffer = quantize_buf,
+			.offset = 0,
+			.size = quantize_size
+		}
+	};
+
+	const VkBufferMemoryBarrier host_to_dev_buf_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+		.srcQueueFamilyIndex = transfer_queue_family_idx,
+		.dstQueueFamilyIndex = compute_queue_family_idx,
+		.buffer = dev_buf,
+		.offset = 0,
+		.size = dev_buf_size
+	};
+
+	const bool ownership_transfer = compute_queue_family_idx != transfer_queue_family_idx;
+
+	funcs.vkBeginCommandBuffer(cmd_buf, &begin_info);
+	if (ownership_transfer)
+		funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, static_cast<std::uint32_t>(acquire_buf_mem_barriers.size()), acquire_buf_mem_barriers.data(), 0, nullptr);
+	funcs.vkCmdCopyBuffer(cmd_buf, quantize_buf, host_buf, 1, &region);
+	if (ownership_transfer)
+		funcs.vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &host_to_dev_buf_mem_barrier, 0, nullptr);
+	funcs.vkEndCommandBuffer(cmd_buf);
+}
+
+// times the copy side of the main loop on a pair of queues: dev_buf is written on the compute
+// queue, then read back whole on copy_queue, each waiting on the other through a semaphore even
+// when copy_queue is the compute queue. the write is a fill since no pipeline exists yet, what is
+// compared is the cost of moving a buffer of size between the queues. seconds per round
+static double probe_queue_topology(const VolkDeviceTable &funcs, VkDevice dev, VmaAllocator allocator, VkQueue compute_queue, const std::uint32_t compute_queue_family_idx, VkQueue copy_queue, const std::uint32_t copy_queue_family_idx, const VkDeviceSize size) {
+	static const int warmup_rounds = 2;
+	static const int rounds = 16;
+	static const VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+	const VkCommandBufferBeginInfo begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.pInheritanceInfo = nullptr
+	};
+
+	VkBuffer dev_buf, host_buf;
+	VmaAllocation dev_buf_alloc, host_buf_alloc;
+	unsigned char *host_data;
+	create_dev_buf(allocator, dev_buf, dev_buf_alloc, size);
+	create_host_buf(allocator, host_buf, host_buf_alloc, host_data, size);
+
+	VkCommandPool compute_cmd_pool, copy_cmd_pool;
+	// compute 0 runs first and has nothing to acquire yet
+	std::array<VkCommandBuffer, 2> compute_cmd_bufs;
+	std::array<VkCommandBuffer, 1> copy_cmd_buf;
+	create_cmd_pool(funcs, dev, compute_queue_family_idx, compute_cmd_pool);
+	create_cmd_pool(funcs, dev, copy_queue_family_idx, copy_cmd_pool);
+	create_cmd_bufs(funcs, dev, compute_cmd_pool, compute_cmd_bufs);
+	create_cmd_bufs(funcs, dev, copy_cmd_pool, copy_cmd_buf);
+
+	VkSemaphore compute_fin_semaphore, copy_fin_semaphore;
+	VkFence copy_fence;
+	create_semaphore(funcs, dev, compute_fin_semaphore);
+	create_semaphore(funcs, dev, copy_fin_semaphore);
+	create_fence(funcs, dev, copy_fence);
+	funcs.vkResetFences(dev, 1, &copy_fence);
+
+	// the halves of the ownership transfers record_cmd_buf_copy_dev_to_host records on its side
+	const VkBufferMemoryBarrier acquire_buf_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.srcQueueFamilyIndex = copy_queue_family_idx,
+		.dstQueueFamilyIndex = compute_queue_family_idx,
+		.buffer = dev_buf,
+		.offset = 0,
+		.size = size
+	};
+
+	const VkBufferMemoryBarrier release_buf_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+		.srcQueueFamilyIndex = compute_queue_family_idx,
+		.dstQueueFamilyIndex = copy_queue_family_idx,
+		.buffer = dev_buf,
+		.offset = 0,
+		.size = size
+	};
+
+	const bool ownership_transfer = compute_queue_family_idx != copy_queue_family_idx;
+
+	for (std::size_t b = 0; b < compute_cmd_bufs.size(); b++) {
+		funcs.vkBeginCommandBuffer(compute_cmd_bufs[b], &begin_info);
+		if (ownership_transfer && b > 0)
+			funcs.vkCmdPipelineBarrier(compute_cmd_bufs[b], VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1, &acquire_buf_mem_barrier, 0, nullptr);
+		funcs.vkCmdFillBuffer(compute_cmd_bufs[b], dev_buf, 0, size, 0);
+		if (ownership_transfer)
+			funcs.vkCmdPipelineBarrier(compute_cmd_bufs[b], VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1, &release_buf_mem_barrier, 0, nullptr);
+		funcs.vkEndCommandBuffer(compute_cmd_bufs[b]);
+	}
+
+	record_cmd_buf_copy_dev_to_host(funcs, copy_cmd_buf[0], host_buf, dev_buf, size, { ReadbackRange { .offset = 0, .size = size } }, compute_queue_family_idx, copy_queue_family_idx);
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (int r = 0; r < warmup_rounds + rounds; r++) {
+		if (r == warmup_rounds)
+			start = std::chrono::steady_clock::now();
+
+		const VkSubmitInfo compute_submit_info = {
+			.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+			.pNext = nullptr,
+			.waitSemaphoreCount = r > 0 ? 1u : 0u,
+			.pWaitSemaphores = &copy_fin_semaphore,
+			.pWaitDstStageMask = &wait_stage,
+			.commandBufferCount = 1,
+			.pCommandBuffers = &compute_cmd_bufs[r > 0 ? 1 : 0],
+			.signalSemaphoreCount = 1,
+			.pSignalSemaphores = &compute_fin_semaphore
+		};
+
+		const VkSubmitInfo copy_submit_info = {
+			.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+			.pNext = nullptr,
+			.waitSemaphoreCount = 1,
+			.pWaitSemaphores = &compute_fin_semaphore,
+			.pWaitDstStageMask = &wait_stage,
+			.commandBufferCount = 1,
+			.pCommandBuffers = copy_cmd_buf.data(),
+			.signalSemaphoreCount = 1,
+			.pSignalSemaphores = &copy_fin_semaphore
+		};
+
+		if (funcs.vkQueueSubmit(compute_queue, 1, &compute_submit_info, VK_NULL_HANDLE) != VK_SUCCESS || funcs.vkQueueSubmit(copy_queue, 1, &copy_submit_info, copy_fence) != VK_SUCCESS)
+			throw std::runtime_error("Failed to submit queue probe!");
+
+		funcs.vkWaitForFences(dev, 1, &copy_fence, VK_TRUE, std::numeric_limits<std::uint64_t>::max());
+		funcs.vkResetFences(dev, 1, &copy_fence);
+	}
+
+	const double elapsed = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start).count();
+
+	// the last copy signalled a semaphore nobody waits on, let it settle before destroying it
+	funcs.vkDeviceWaitIdle(dev);
+	funcs.vkDestroyFence(dev, copy_fence, nullptr);
+	funcs.vkDestroySemaphore(dev, copy_fin_semaphore, nullptr);
+	funcs.vkDestroySemaphore(dev, compute_fin_semaphore, nullptr);
+	funcs.vkDestroyCommandPool(dev, copy_cmd_pool, nullptr);
+	funcs.vkDestroyCommandPool(dev, compute_cmd_pool, nullptr);
+	vmaDestroyBuffer(allocator, host_buf, host_buf_alloc);
+	vmaDestroyBuffer(allocator, dev_buf, dev_buf_alloc);
+
+	return elapsed / rounds;
+}
+
+// decides where the copies of a device run and hands back that queue and its family. automatic
+// probes every topology the device has with buffers of size and keeps the fastest, one the
+// device lacks falls back to the next one down: dedicated, shared, single
+static QueueTopology plan_queue_topology(const VolkDeviceTable &funcs, VkDevice dev, VmaAllocator allocator, const std::size_t device, const QueueTopology topology, const std::uint32_t compute_queue_family_idx, const std::uint32_t compute_queue_count, const std::uint32_t dma_queue_family_idx, const VkDeviceSize size, VkQueue &transfer_queue, std::uint32_t &transfer_queue_family_idx) {
+	struct Candidate {
+		QueueTopology topology;
+		std::uint32_t queue_family_idx;
+		std::uint32_t queue_idx;
+		bool available;
+	};
+
+	const std::array<Candidate, 3> candidates = {
+		Candidate { QueueTopology::dedicated, dma_queue_family_idx, 0, dma_queue_family_idx != std::numeric_limits<std::uint32_t>::max() },
+		Candidate { QueueTopology::shared, compute_queue_family_idx, 1, compute_queue_count > 1 },
+		Candidate { QueueTopology::single, compute_queue_family_idx, 0, true }
+	};
+
+	VkQueue compute_queue;
+	funcs.vkGetDeviceQueue(dev, compute_queue_family_idx, 0, &compute_queue);
+
+	const Candidate *pick = nullptr;
+
+	if (topology == QueueTopology::automatic) {
+		double best = std::numeric_limits<double>::max();
+
+		std::printf("GPU:%zu Queue probe:", device);
+		for (const auto &candidate : candidates) {
+			if (!candidate.available)
+				continue;
+
+			VkQueue queue;
+			funcs.vkGetDeviceQueue(dev, candidate.queue_family_idx, candidate.queue_idx, &queue);
+
+			const double seconds = probe_queue_topology(funcs, dev, allocator, compute_queue, compute_queue_family_idx, queue, candidate.queue_family_idx, size);
+			std::printf(" %s:%.03fms", queue_topology_name(candidate.topology), seconds * 1000.0);
+
+			if (seconds < best) {
+				best = seconds;
+				pick = &candidate;
+			}
+		}
+		std::printf("\n");
+	} else {
+		bool reached = false;
+		for (const auto &candidate : candidates) {
+			reached = reached || candidate.topology == topology;
+			if (reached && candidate.available) {
+				pick = &candidate;
+				break;
+			}
+		}
+
+		if (pick->topology != topology)
+			std::printf("! GPU:%zu has no queue for the %s topology, falling back to %s\n", device, queue_topology_name(topology), queue_topology_name(pick->topology));
+	}
+
+	funcs.vkGetDeviceQueue(dev, pick->queue_family_idx, pick->queue_idx, &transfer_queue);
+	transfer_queue_family_idx = pick->queue_family_idx;
+
+	return pick->topology;
+}
+
+// throwaway fp32 passes of one kernel for the startup probes, with buffers and a descriptor set
+// of their own around the bodies they are pointed at. -bda and fp16 feed the same kernels
+struct ProbePasses {
+	ForcePasses force;
+	VkBuffer accel_buf;
+	VmaAllocation accel_buf_alloc;
+	VmaAllocation dispatch_buf_alloc;
+	VmaAllocation grid_buf_alloc;
+	VkDescriptorPool desc_pool;
+};
+
+static void create_probe_passes(const VolkDeviceTable &funcs, VkDevice dev, VmaAllocator allocator, VkQueue queue, VkCommandPool cmd_pool, VkDescriptorSetLayout desc_set_layout, VkPipelineLayout pipeline_layout, VkBuffer bodies_buf, VkBuffer uniform_buf, const VkDeviceSize bodies_buf_range, const VkDeviceSize uniform_buf_range, const std::size_t particle_count, const ForceKernel kernel, const ForceSpecialization &spec, const std::uint32_t persistent_group_count, ProbePasses &probe) {
+	const bool jsplit = kernel == ForceKernel::jsplit;
+	const bool persistent = kernel == ForceKernel::persistent;
+
+	const std::uint32_t splits = jsplit ? jsplit_split_count(particle_count) : 1;
+	const VkDeviceSize accel_buf_size = sizeof(vec4)*particle_count*splits;
+	const std::array<std::uint32_t, 3> dispatch_args_spec = { spec.local_size * spec.block, splits, integrate_local_size };
+
+	const VkSpecializationInfo spec_info = {
+		.mapEntryCount = static_cast<std::uint32_t>(force_spec_entries.size()),
+		.pMapEntries = force_spec_entries.data(),
+		.dataSize = sizeof(spec),
+		.pData = &spec
+	};
+
+	const VkSpecializationInfo dispatch_args_spec_info = {
+		.mapEntryCount = static_cast<std::uint32_t>(dispatch_args_spec_entries.size()),
+		.pMapEntries = dispatch_args_spec_entries.data(),
+		.dataSize = sizeof(dispatch_args_spec),
+		.pData = dispatch_args_spec.data()
+	};
+
+	const VkSpecializationInfo integrate_spec_info = {
+		.mapEntryCount = 1,
+		.pMapEntries = &integrate_spec_entry,
+		.dataSize = sizeof(splits),
+		.pData = &splits
+	};
+
+	probe = ProbePasses {};
+	probe.force.pipeline_layout = pipeline_layout;
+	probe.force.steps = spec.steps;
+	probe.force.persistent_group_count = persistent_group_count;
+	probe.force.owned_first = 0;
+	probe.force.owned_count = static_cast<std::uint32_t>(particle_count);
+
+	if (persistent)
+		create_compute_pipeline(funcs, dev, pipeline_layout, nbody_persistent_code, sizeof(nbody_persistent_code), probe.force.force, &spec_info);
+	else if (kernel == ForceKernel::subgroup)
+		create_compute_pipeline(funcs, dev, pipeline_layout, nbody_force_subgroup_code, sizeof(nbody_force_subgroup_code), probe.force.force, &spec_info);
+	else if (jsplit)
+		create_compute_pipeline(funcs, dev, pipeline_layout, nbody_force_jsplit_code, sizeof(nbody_force_jsplit_code), probe.force.force, &spec_info);
+	else
+		create_compute_pipeline(funcs, dev, pipeline_layout, nbody_force_tiled_code, sizeof(nbody_force_tiled_code), probe.force.force, &spec_info);
+
+	if (!persistent) {
+		create_compute_pipeline(funcs, dev, pipeline_layout, nbody_dispatch_args_code, sizeof(nbody_dispatch_args_code), probe.force.dispatch_args, &dispatch_args_spec_info);
+		create_compute_pipeline(funcs, dev, pipeline_layout, nbody_integrate_code, sizeof(nbody_integrate_code), probe.force.integrate, &integrate_spec_info);
+	}
+
+	create_dev_buf(allocator, probe.force.dispatch_buf, probe.dispatch_buf_alloc, sizeof(DispatchArgs), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+	fill_dev_buf(funcs, dev, queue, cmd_pool, probe.force.dispatch_buf, sizeof(DispatchArgs::active_count), static_cast<std::uint32_t>(particle_count));
+	create_dev_buf(allocator, probe.accel_buf, probe.accel_buf_alloc, accel_buf_size);
+	create_desc_pool_and_set(funcs, dev, desc_set_layout, probe.desc_pool, probe.force.desc_set, aux_storage_buf_count);
+
+	if (persistent) {
+		create_dev_buf(allocator, probe.force.grid_buf, probe.grid_buf_alloc, sizeof(GridBarrier));
+		update_aux_desc_set(funcs, dev, probe.force.desc_set, bodies_buf, uniform_buf, probe.accel_buf, bodies_buf_range, uniform_buf_range, accel_buf_size, probe.force.grid_buf, sizeof(GridBarrier));
+	} else {
+		update_aux_desc_set(funcs, dev, probe.force.desc_set, bodies_buf, uniform_buf, probe.accel_buf, bodies_buf_range, uniform_buf_range, accel_buf_size);
+	}
+
+	update_dispatch_desc(funcs, dev, probe.force.desc_set, probe.force.dispatch_buf);
+}
+
+static void destroy_probe_passes(const VolkDeviceTable &funcs, VkDevice dev, VmaAllocator allocator, ProbePasses &probe) {
+	funcs.vkDestroyDescriptorPool(dev, probe.desc_pool, nullptr);
+	vmaDestroyBuffer(allocator, probe.force.grid_buf, probe.grid_buf_alloc);
+	vmaDestroyBuffer(allocator, probe.accel_buf, probe.accel_buf_alloc);
+	vmaDestroyBuffer(allocator, probe.force.dispatch_buf, probe.dispatch_buf_alloc);
+	funcs.vkDestroyPipeline(dev, probe.force.integrate, nullptr);
+	funcs.vkDestroyPipeline(dev, probe.force.dispatch_args, nullptr);
+	funcs.vkDestroyPipeline(dev, probe.force.force, nullptr);
+}
+
+// submits cmd_buf warmup_rounds + rounds times, waiting for each one and running after_round on
+// the host once it finished, and returns the seconds per timed round
+template<typename AfterRound>
+static double time_probe_submits(const VolkDeviceTable &funcs, VkDevice dev, VkQueue queue, VkCommandBuffer cmd_buf, AfterRound after_round) {
+	static const int warmup_rounds = 2;
+	static const int rounds = 8;
+
+	VkFence fence;
+	create_fence(funcs, dev, fence);
+	funcs.vkResetFences(dev, 1, &fence);
+
+	const VkSubmitInfo submit_info = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.pNext = nullptr,
+		.waitSemaphoreCount = 0,
+		.pWaitSemaphores = nullptr,
+		.pWaitDstStageMask = nullptr,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &cmd_buf,
+		.signalSemaphoreCount = 0,
+		.pSignalSemaphores = nullptr
+	};
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (int r = 0; r < warmup_rounds + rounds; r++) {
+		if (r == warmup_rounds)
+			start = std::chrono::steady_clock::now();
+
+		if (funcs.vkQueueSubmit(queue, 1, &submit_info, fence) != VK_SUCCESS)
+			throw std::runtime_error("Failed to submit probe!");
+
+		funcs.vkWaitForFences(dev, 1, &fence, VK_TRUE, std::numeric_limits<std::uint64_t>::max());
+		funcs.vkResetFences(dev, 1, &fence);
+		after_round();
+	}
+
+	const double elapsed = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start).count();
+
+	funcs.vkDestroyFence(dev, fence, nullptr);
+
+	return elapsed / rounds;
+}
+
+// seconds per step of kernel over the bodies in bodies_buf, spec.steps of them per submit. the
+// probes run before the initial state is written and step whatever the buffer holds with dt 0
+static double probe_force_kernel(const VolkDeviceTable &funcs, VkDevice dev, VmaAllocator allocator, VkQueue queue, VkCommandPool cmd_pool, VkDescriptorSetLayout desc_set_layout, VkPipelineLayout pipeline_layout, VkBuffer bodies_buf, VkBuffer uniform_buf, const VkDeviceSize bodies_buf_range, const VkDeviceSize uniform_buf_range, const std::size_t particle_count, const ForceKernel kernel, const ForceSpecialization &spec, const std::uint32_t persistent_group_count = 0) {
+	const VkCommandBufferBeginInfo begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.pInheritanceInfo = nullptr
+	};
+
+	ProbePasses probe;
+	create_probe_passes(funcs, dev, allocator, queue, cmd_pool, desc_set_layout, pipeline_layout, bodies_buf, uniform_buf, bodies_buf_range, uniform_buf_range, particle_count, kernel, spec, persistent_group_count, probe);
+
+	std::array<VkCommandBuffer, 1> cmd_buf;
+	create_cmd_bufs(funcs, dev, cmd_pool, cmd_buf);
+
+	funcs.vkBeginCommandBuffer(cmd_buf[0], &begin_info);
+	record_force_passes(funcs, cmd_buf[0], probe.force, StepConstants { .delta_time = 0.f, .step = 0 });
+	funcs.vkEndCommandBuffer(cmd_buf[0]);
+
+	const double seconds = time_probe_submits(funcs, dev, queue, cmd_buf[0], [] {});
+
+	funcs.vkFreeCommandBuffers(dev, cmd_pool, 1, cmd_buf.data());
+	destroy_probe_passes(funcs, dev, allocator, probe);
+
+	return seconds / spec.steps;
+}
+
+// seconds per round of a force pass and a full readback the host then reads, with the bodies in
+// mapped DEVICE_LOCAL|HOST_VISIBLE memory read in place, and with them in device memory copied out
+// to host memory first. the kernel is only picked later, the tiled one stands in for it
+static void probe_zero_copy(const VolkDeviceTable &funcs, VkDevice dev, VmaAllocator allocator, VkQueue queue, VkCommandPool cmd_pool, VkDescriptorSetLayout desc_set_layout, VkPipelineLayout pipeline_layout, const UBO &constants, const VkDeviceSize bodies_size, const std::size_t particle_count, const ForceSpecialization &spec, double &mapped_seconds, double &staged_seconds) {
+	const VkCommandBufferBeginInfo begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.pInheritanceInfo = nullptr
+	};
+
+	const VkMemoryBarrier force_to_host_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_HOST_READ_BIT
+	};
+
+	const VkMemoryBarrier force_to_copy_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT
+	};
+
+	const VkMemoryBarrier copy_to_host_mem_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_HOST_READ_BIT
+	};
+
+	const VkBufferCopy region = {
+		.srcOffset = 0,
+		.dstOffset = 0,
+		.size = bodies_size
+	};
+
+	VkBuffer mapped_buf, dev_buf, host_buf, uniform_buf;
+	VmaAllocation mapped_buf_alloc, dev_buf_alloc, host_buf_alloc, uniform_buf_alloc;
+	unsigned char *mapped_data, *host_data;
+	UBO *ubo;
+	create_mapped_dev_buf(allocator, mapped_buf, mapped_buf_alloc, mapped_data, bodies_size);
+	create_dev_buf(allocator, dev_buf, dev_buf_alloc, bodies_size);
+	create_host_buf(allocator, host_buf, host_buf_alloc, host_data, bodies_size);
+	create_uniform_buf(allocator, uniform_buf, uniform_buf_alloc, ubo, sizeof(UBO));
+	*ubo = constants;
+
+	// 0 runs on the mapped bodies, 1 on the ones in device memory
+	std::array<ProbePasses, 2> probes;
+	create_probe_passes(funcs, dev, allocator, queue, cmd_pool, desc_set_layout, pipeline_layout, mapped_buf, uniform_buf, bodies_size, sizeof(UBO), particle_count, ForceKernel::tiled, spec, 0, probes[0]);
+	create_probe_passes(funcs, dev, allocator, queue, cmd_pool, desc_set_layout, pipeline_layout, dev_buf, uniform_buf, bodies_size, sizeof(UBO), particle_count, ForceKernel::tiled, spec, 0, probes[1]);
+
+	std::array<VkCommandBuffer, 2> cmd_bufs;
+	create_cmd_bufs(funcs, dev, cmd_pool, cmd_bufs);
+
+	funcs.vkBeginCommandBuffer(cmd_bufs[0], &begin_info);
+	record_force_passes(funcs, cmd_bufs[0], probes[0].force, StepConstants { .delta_time = 0.f, .step = 0 });
+	funcs.vkCmdPipelineBarrier(cmd_bufs[0], VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &force_to_host_mem_barrier, 0, nullptr, 0, nullptr);
+	funcs.vkEndCommandBuffer(cmd_bufs[0]);
+
+	funcs.vkBeginCommandBuffer(cmd_bufs[1], &begin_info);
+	record_force_passes(funcs, cmd_bufs[1], probes[1].force, StepConstants { .delta_time = 0.f, .step = 0 });
+	funcs.vkCmdPipelineBarrier(cmd_bufs[1], VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &force_to_copy_mem_barrier, 0, nullptr, 0, nullptr);
+	funcs.vkCmdCopyBuffer(cmd_bufs[1], dev_buf, host_buf, 1, &region);
+	funcs.vkCmdPipelineBarrier(cmd_bufs[1], VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &copy_to_host_mem_barrier, 0, nullptr, 0, nullptr);
+	funcs.vkEndCommandBuffer(cmd_bufs[1]);
+
+	// the host has to read what arrived, that is where reads through the BAR lose
+	std::vector<unsigned char> readback(bodies_size);
+
+	mapped_seconds = time_probe_submits(funcs, dev, queue, cmd_bufs[0], [&] {
+		vmaInvalidateAllocation(allocator, mapped_buf_alloc, 0, bodies_size);
+		std::memcpy(readback.data(), mapped_data, bodies_size);
+	});
+
+	staged_seconds = time_probe_submits(funcs, dev, queue, cmd_bufs[1], [&] {
+		vmaInvalidateAllocation(allocator, host_buf_alloc, 0, bodies_size);
+		std::memcpy(readback.data(), host_data, bodies_size);
+	});
+
+	funcs.vkFreeCommandBuffers(dev, cmd_pool, static_cast<std::uint32_t>(cmd_bufs.size()), cmd_bufs.data());
+	destroy_probe_passes(funcs, dev, allocator, probes[1]);
+	destroy_probe_passes(funcs, dev, allocator, probes[0]);
+	vmaDestroyBuffer(allocator, uniform_buf, uniform_buf_alloc);
+	vmaDestroyBuffer(allocator, host_buf, host_buf_alloc);
+	vmaDestroyBuffer(allocator, dev_buf, dev_buf_alloc);
+	vmaDestroyBuffer(allocator, mapped_buf, mapped_buf_alloc);
+}
+
+// length of the xyz difference of two vec4, the diagnostics drift figures
+static double vec3_distance(const vec4 &a, const vec4 &b) {
+	const double dx = static_cast<double>(a.components.x) - b.components.x;
+	const double dy = static_cast<double>(a.components.y) - b.components.y;
+	const double dz = static_cast<double>(a.components.z) - b.components.z;
+
+	return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+// -init without a mapping to import: the first size bytes of the file, particles as they sit in
+// the particle buffer
+static void read_init_file(const std::string &path, Particle *particles, const std::size_t size) {
+	std::FILE *file = std::fopen(path.c_str(), "rb");
+	if (file == nullptr)
+		throw std::runtime_error("Cannot open initial conditions file!");
+
+	const std::size_t read = std::fread(particles, 1, size, file);
+	std::fclose(file);
+
+	if (read != size)
+		throw std::runtime_error("Initial conditions file is too small!");
+}
+
+static std::uint64_t round_up(const std::uint64_t value, const std::uint64_t multiple) {
+	return (value + multiple - 1) / multiple * multiple;
+}
+
 static auto get_random_seed() {
 	std::random_device source;
 
@@ -893,16 +2912,63 @@ int main(int argc, char *argv[]) {
 	static const VkPipelineStageFlags wait_stage_transfer = VK_PIPELINE_STAGE_TRANSFER_BIT;
 	static const VkPipelineStageFlags wait_stage_compute = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
 
+	// without ownership barriers to chain onto the semaphores hold back every stage that touches the buffers
+	static const VkPipelineStageFlags wait_stage_shared = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
 	static auto seed = get_random_seed();
 	static std::default_random_engine rng(seed);
 	std::uniform_real_distribution<float> dist(-1.f, 1.f);
 
 	VkInstance inst;
 	VkDebugUtilsMessengerEXT debug_msgr = VK_NULL_HANDLE;
+	std::uint32_t instance_api_version;
 	std::vector<VkPhysicalDevice> present_physical_devs, physical_devs;
 
 	struct {
 		bool debug_mode = false;
+		std::string snapshot_path;
+		std::uint64_t snapshot_interval = 100;
+		std::size_t snapshot_queue = 4;
+		SnapshotPolicy snapshot_policy = SnapshotPolicy::block;
+		IoBackend snapshot_io = IoBackend::stdio;
+		bool snapshot_direct = false;
+		bool snapshot_compress = false;
+		std::uint32_t snapshot_keyframe = 16;
+		std::uint32_t snapshot_quantize = 0;
+		ForceKernel kernel = ForceKernel::automatic;
+		std::uint32_t block = 1;
+		std::size_t jsplit_threshold = 0;
+		std::uint32_t steps_per_submit = 1;
+
+		// the defaults reproduce the constants baked into particle_attraction.comp
+		ForceLaw force_law = ForceLaw::legacy;
+		float gravity = 0.00430091f;
+		float softening = 0.00316227766f;
+		float unit_scale = 1e-6f;
+		Precision precision = Precision::fp32;
+		bool energy = false;
+		bool diagnostics = false;
+		bool diagnostics_potential = false;
+		std::uint64_t validate_steps = 0;
+		bool bda = false;
+		std::string zero_copy = "auto";
+		QueueTopology queues = QueueTopology::automatic;
+		MultiGpu multi_gpu = MultiGpu::off;
+		Decomposition decompose = Decomposition::index;
+		std::uint64_t decompose_interval = 64;
+		Balance balance = Balance::throughput;
+		float balance_threshold = 5.f;
+		std::string init_path;
+		bool hugepages = false;
+		std::string roi_path;
+		std::uint64_t roi_interval = 100;
+		std::uint32_t roi_max = 4096;
+		bool has_roi = false;
+		RoiKind roi_kind = RoiKind::box;
+		std::array<float, 6> roi_values = {};
+		std::string io_bench_path;
+		std::size_t io_bench_mb = 1024;
+		std::string traj_check_path;
 	} cli_options;
 
 	for (int i = 1; i < argc; i++) {
@@ -910,9 +2976,50 @@ int main(int argc, char *argv[]) {
 
 		if (arg == "-help") {
 			std::printf(
-				"usage: vkcl-nbody [-help] [-debug]\n"
+				"usage: vkcl-nbody [-help] [-debug] [-kernel <auto|legacy|tiled|subgroup|jsplit|persistent>] [-block <1|2|4|8>] [-jsplit-threshold <particles>] [-steps-per-submit <n>] [-force-law <legacy|plummer|spline>] [-gravity <G>] [-softening <length>] [-unit-scale <scale>] [-precision <fp32|fp16|ds>] [-energy] [-diagnostics] [-diagnostics-potential] [-validate <steps>] [-bda] [-zero-copy <auto|on|off>] [-queues <auto|dedicated|shared|single>] [-multi-gpu <off|split|ring>] [-decompose <index|morton>] [-decompose-interval <steps>] [-balance <even|throughput>] [-balance-threshold <percent>] [-init <path>] [-hugepages] [-snapshot <path>] [-snapshot-interval <steps>] [-snapshot-queue <depth>] [-snapshot-drop] [-snapshot-io <stdio|pwrite|uring>] [-snapshot-direct] [-snapshot-compress] [-snapshot-keyframe <n>] [-snapshot-quantize <16|21>] [-roi <path>] [-roi-box <x0> <y0> <z0> <x1> <y1> <z1>] [-roi-sphere <x> <y> <z> <radius>] [-roi-speed <speed>] [-roi-interval <steps>] [-roi-max <particles>] [-io-bench <path>] [-io-bench-size <MB>] [-traj-check <path>]\n"
 				"-help: Display help information\n"
 				"-debug: Enable Vulkan validation layers if found\n"
+				"-kernel: Force kernel, auto picks jsplit below the jsplit threshold, then subgroup where the device has compute subgroup shuffles and tiled otherwise. persistent is experimental and runs every step of a submit in one dispatch (default auto)\n"
+				"-block: Bodies each invocation of the tiled and subgroup kernels computes forces for (default 1)\n"
+				"-jsplit-threshold: Particle count below which auto picks the jsplit kernel, instead of timing it against the two-pass kernel at startup (default 0, timed)\n"
+				"-steps-per-submit: Steps recorded into each command buffer, the persistent kernel runs them inside one dispatch (default 1)\n"
+				"-force-law: Force law of every kernel but legacy (default legacy)\n"
+				"-gravity: Gravitational constant (default 0.00430091)\n"
+				"-softening: Plummer epsilon or spline kernel radius, must be positive (default 0.00316228)\n"
+				"-unit-scale: Factor applied to G * m (default 1e-6)\n"
+				"-precision: fp16 runs the force pass on half float positions relative to the bounding box of each step, ds keeps double-single positions. -validate reports the difference from an fp32 or ds CPU mirror (default fp32)\n"
+				"-energy: Report the total energy and its drift since the start with every stats line, computed on the CPU\n"
+				"-diagnostics: Reduce the kinetic energy, linear and angular momentum and center of mass on the GPU after every submit and report their drift since the first one with every stats line, reading back a few bytes instead of the particles\n"
+				"-diagnostics-potential: Add the potential energy and the total energy drift to -diagnostics, an O(N^2) pass as costly as the force pass\n"
+				"-validate: Mirror the first <steps> steps on the CPU and report the largest difference after each. The mirror runs ds under -precision ds and fp32 otherwise, so with fp16 it reports the loss against fp32 from the same initial state\n"
+				"-bda: Hand the fp32 force and integrate passes buffer device addresses through push constants instead of binding a descriptor set, where VK_KHR_buffer_device_address is supported\n"
+				"-zero-copy: Map the particle buffer straight from DEVICE_LOCAL|HOST_VISIBLE memory and skip the staging copy and the transfer queue. auto times a force pass and a readback both ways at startup and keeps the faster (default auto)\n"
+				"-queues: Queue the particle copies run on: dedicated takes a transfer only family, shared a second compute queue and single the compute queue itself. auto times each the device has with the particle buffer and keeps the fastest (default auto)\n"
+				"-multi-gpu: off runs an independent system on every device, split runs one system with each device computing the forces on its share of the bodies against all of them. The positions are all-gathered through host memory after every submit, so the devices see each other's bodies -steps-per-submit steps late. ring splits the bodies the same way but uploads the other devices' shares one block at a time, computing the forces from each block while the next one is copied in on a second compute queue, which every device needs, one step per submit (default off)\n"
+				"-decompose: What the share of each -multi-gpu device covers. index keeps the bodies in the order they were loaded, morton sorts them along a Morton curve so every share is a compact region of space, moving the bodies that drifted out of theirs on every reorder (default index)\n"
+				"-decompose-interval: Steps between the -decompose morton reorders (default 64)\n"
+				"-balance: How the -multi-gpu shares are sized. even gives every device the same, throughput times each device's submits and moves bodies to the faster ones when the slowest runs more than -balance-threshold behind the mean (default throughput)\n"
+				"-balance-threshold: Imbalance in percent -balance throughput lets stand (default 5)\n"
+				"-init: Start from the particles in <path> instead of random ones, stored as in the particle buffer. The file is mapped and copied to the device straight from the page cache where VK_EXT_external_memory_host is supported\n"
+				"-hugepages: Back the host buffer with huge pages imported through VK_EXT_external_memory_host, falls back to regular host memory where none are reserved\n"
+				"-snapshot: Write full particle state to the trajectory file <path>-gpuN.traj from a background thread\n"
+				"-snapshot-interval: Steps between snapshots (default 100)\n"
+				"-snapshot-queue: Number of readback buffers queued for the writer (default 4)\n"
+				"-snapshot-drop: Drop snapshots when the queue is full instead of stalling the simulation\n"
+				"-snapshot-io: Snapshot write path, uring falls back to pwrite where io_uring or its write opcode is unavailable, as before Linux 5.6 (default stdio)\n"
+				"-snapshot-direct: Open snapshot files with O_DIRECT, bypassing the page cache. Falls back to buffered I/O where the filesystem refuses it\n"
+				"-snapshot-compress: Losslessly compress snapshots (byte shuffle and XOR delta against the previous snapshot)\n"
+				"-snapshot-keyframe: Snapshots between self-contained compressed snapshots (default 16)\n"
+				"-snapshot-quantize: Lossy snapshots packed on the GPU, positions as 16 or 21 bit integers inside the bounding box and velocities as half floats\n"
+				"-roi: Select the particles inside a region of interest on the GPU and append them with their ids to <path>-gpuN.roi, reading back only the selection\n"
+				"-roi-box: Select the particles inside the box from (x0, y0, z0) to (x1, y1, z1)\n"
+				"-roi-sphere: Select the particles within radius of (x, y, z)\n"
+				"-roi-speed: Select the particles faster than speed\n"
+				"-roi-interval: Steps between selections (default 100)\n"
+				"-roi-max: Particles a selection stores, the rest are only counted (default 4096)\n"
+				"-io-bench: Compare the snapshot write paths on the filesystem holding <path> and exit\n"
+				"-io-bench-size: Amount of data written per write path by -io-bench (default 1024)\n"
+				"-traj-check: Write synthetic snapshots with every trajectory codec to <path>, read them back, compare and exit\n"
 			);
 
 			return 0;
@@ -920,9 +3027,212 @@ int main(int argc, char *argv[]) {
 		else if (arg == "-debug") {
 			cli_options.debug_mode = true;
 		}
+		else if (arg == "-kernel" && i + 1 < argc) {
+			if (!parse_force_kernel(argv[++i], cli_options.kernel)) {
+				std::printf("Unknown kernel %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (arg == "-block" && i + 1 < argc) {
+			cli_options.block = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+			if (cli_options.block != 1 && cli_options.block != 2 && cli_options.block != 4 && cli_options.block != 8) {
+				std::printf("Bodies per invocation must be 1, 2, 4 or 8\n");
+				return 1;
+			}
+		}
+		else if (arg == "-jsplit-threshold" && i + 1 < argc) {
+			cli_options.jsplit_threshold = std::strtoull(argv[++i], nullptr, 10);
+		}
+		else if (arg == "-steps-per-submit" && i + 1 < argc) {
+			cli_options.steps_per_submit = static_cast<std::uint32_t>(std::max<unsigned long long>(1, std::strtoull(argv[++i], nullptr, 10)));
+		}
+		else if (arg == "-force-law" && i + 1 < argc) {
+			if (!parse_force_law(argv[++i], cli_options.force_law)) {
+				std::printf("Unknown force law %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (arg == "-gravity" && i + 1 < argc) {
+			cli_options.gravity = std::strtof(argv[++i], nullptr);
+		}
+		else if (arg == "-softening" && i + 1 < argc) {
+			cli_options.softening = std::strtof(argv[++i], nullptr);
+			// every force loop includes the self-pair, which is only finite with a softening length
+			if (!std::isfinite(cli_options.softening) || cli_options.softening <= 0.f) {
+				std::printf("Softening must be a positive length\n");
+				return 1;
+			}
+		}
+		else if (arg == "-unit-scale" && i + 1 < argc) {
+			cli_options.unit_scale = std::strtof(argv[++i], nullptr);
+		}
+		else if (arg == "-precision" && i + 1 < argc) {
+			if (!parse_precision(argv[++i], cli_options.precision)) {
+				std::printf("Unknown precision %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (arg == "-energy") {
+			cli_options.energy = true;
+		}
+		else if (arg == "-diagnostics") {
+			cli_options.diagnostics = true;
+		}
+		else if (arg == "-diagnostics-potential") {
+			cli_options.diagnostics = true;
+			cli_options.diagnostics_potential = true;
+		}
+		else if (arg == "-validate" && i + 1 < argc) {
+			cli_options.validate_steps = std::strtoull(argv[++i], nullptr, 10);
+		}
+		else if (arg == "-bda") {
+			cli_options.bda = true;
+		}
+		else if (arg == "-zero-copy" && i + 1 < argc) {
+			cli_options.zero_copy = argv[++i];
+			if (cli_options.zero_copy != "auto" && cli_options.zero_copy != "on" && cli_options.zero_copy != "off") {
+				std::printf("Zero-copy must be auto, on or off\n");
+				return 1;
+			}
+		}
+		else if (arg == "-queues" && i + 1 < argc) {
+			if (!parse_queue_topology(argv[++i], cli_options.queues)) {
+				std::printf("Unknown queue topology %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (arg == "-multi-gpu" && i + 1 < argc) {
+			if (!parse_multi_gpu(argv[++i], cli_options.multi_gpu)) {
+				std::printf("Unknown multi-GPU mode %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (arg == "-decompose" && i + 1 < argc) {
+			if (!parse_decomposition(argv[++i], cli_options.decompose)) {
+				std::printf("Unknown decomposition %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (arg == "-decompose-interval" && i + 1 < argc) {
+			cli_options.decompose_interval = std::max<std::uint64_t>(1, std::strtoull(argv[++i], nullptr, 10));
+		}
+		else if (arg == "-balance" && i + 1 < argc) {
+			if (!parse_balance(argv[++i], cli_options.balance)) {
+				std::printf("Unknown balance %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (arg == "-balance-threshold" && i + 1 < argc) {
+			cli_options.balance_threshold = std::max(0.f, std::strtof(argv[++i], nullptr));
+		}
+		else if (arg == "-init" && i + 1 < argc) {
+			cli_options.init_path = argv[++i];
+		}
+		else if (arg == "-hugepages") {
+			cli_options.hugepages = true;
+		}
+		else if (arg == "-snapshot" && i + 1 < argc) {
+			cli_options.snapshot_path = argv[++i];
+		}
+		else if (arg == "-snapshot-interval" && i + 1 < argc) {
+			cli_options.snapshot_interval = std::max<std::uint64_t>(1, std::strtoull(argv[++i], nullptr, 10));
+		}
+		else if (arg == "-snapshot-queue" && i + 1 < argc) {
+			cli_options.snapshot_queue = std::max<std::size_t>(1, std::strtoull(argv[++i], nullptr, 10));
+		}
+		else if (arg == "-snapshot-drop") {
+			cli_options.snapshot_policy = SnapshotPolicy::drop;
+		}
+		else if (arg == "-snapshot-io" && i + 1 < argc) {
+			if (!parse_io_backend(argv[++i], cli_options.snapshot_io)) {
+				std::printf("Unknown snapshot I/O backend %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (arg == "-snapshot-direct") {
+			cli_options.snapshot_direct = true;
+		}
+		else if (arg == "-snapshot-compress") {
+			cli_options.snapshot_compress = true;
+		}
+		else if (arg == "-snapshot-keyframe" && i + 1 < argc) {
+			cli_options.snapshot_keyframe = static_cast<std::uint32_t>(std::max<unsigned long long>(1, std::strtoull(argv[++i], nullptr, 10)));
+		}
+		else if (arg == "-snapshot-quantize" && i + 1 < argc) {
+			cli_options.snapshot_quantize = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+			if (cli_options.snapshot_quantize != 16 && cli_options.snapshot_quantize != 21) {
+				std::printf("Snapshot quantization must be 16 or 21 bits\n");
+				return 1;
+			}
+		}
+		else if (arg == "-roi" && i + 1 < argc) {
+			cli_options.roi_path = argv[++i];
+		}
+		else if (arg == "-roi-box" && i + 6 < argc) {
+			cli_options.has_roi = true;
+			cli_options.roi_kind = RoiKind::box;
+			for (std::size_t v = 0; v < 6; v++)
+				cli_options.roi_values[v] = std::strtof(argv[++i], nullptr);
+		}
+		else if (arg == "-roi-sphere" && i + 4 < argc) {
+			cli_options.has_roi = true;
+			cli_options.roi_kind = RoiKind::sphere;
+			for (std::size_t v = 0; v < 4; v++)
+				cli_options.roi_values[v] = std::strtof(argv[++i], nullptr);
+		}
+		else if (arg == "-roi-speed" && i + 1 < argc) {
+			cli_options.has_roi = true;
+			cli_options.roi_kind = RoiKind::speed;
+			cli_options.roi_values[0] = std::strtof(argv[++i], nullptr);
+		}
+		else if (arg == "-roi-interval" && i + 1 < argc) {
+			cli_options.roi_interval = std::max<std::uint64_t>(1, std::strtoull(argv[++i], nullptr, 10));
+		}
+		else if (arg == "-roi-max" && i + 1 < argc) {
+			cli_options.roi_max = static_cast<std::uint32_t>(std::max<unsigned long long>(1, std::strtoull(argv[++i], nullptr, 10)));
+		}
+		else if (arg == "-io-bench" && i + 1 < argc) {
+			cli_options.io_bench_path = argv[++i];
+		}
+		else if (arg == "-io-bench-size" && i + 1 < argc) {
+			cli_options.io_bench_mb = std::max<std::size_t>(1, std::strtoull(argv[++i], nullptr, 10));
+		}
+		else if (arg == "-traj-check" && i + 1 < argc) {
+			cli_options.traj_check_path = argv[++i];
+		}
+	}
+
+	// the ring passes every j-block around once per step, a longer submit would integrate on stale blocks
+	if (cli_options.multi_gpu == MultiGpu::ring && cli_options.steps_per_submit != 1) {
+		std::printf("! -multi-gpu ring exchanges the positions every step, running 1 step per submit\n");
+		cli_options.steps_per_submit = 1;
+	}
+
+	// every submit ends on a multiple of steps_per_submit, so the snapshot steps have to be one too
+	cli_options.snapshot_interval = round_up(cli_options.snapshot_interval, cli_options.steps_per_submit);
+	cli_options.roi_interval = round_up(cli_options.roi_interval, cli_options.steps_per_submit);
+	cli_options.decompose_interval = round_up(cli_options.decompose_interval, cli_options.steps_per_submit);
+
+	if (!cli_options.roi_path.empty() && !cli_options.has_roi) {
+		std::printf("-roi needs one of -roi-box, -roi-sphere or -roi-speed\n");
+		return 1;
+	}
+
+	// these run on a device's own copy of every body, which is stale outside its range until the gather
+	if (cli_options.multi_gpu != MultiGpu::off && ((!cli_options.snapshot_path.empty() && cli_options.snapshot_quantize != 0) || !cli_options.roi_path.empty() || cli_options.diagnostics || cli_options.validate_steps > 0)) {
+		std::printf("-multi-gpu %s cannot be combined with -snapshot-quantize, -roi, -diagnostics or -validate\n", multi_gpu_name(cli_options.multi_gpu));
+		return 1;
+	}
+
+	if (!cli_options.io_bench_path.empty()) {
+		run_io_benchmark(cli_options.io_bench_path, cli_options.io_bench_mb);
+		return 0;
 	}
 
-	create_vkinstance(inst, debug_msgr, cli_options.debug_mode);
+	if (!cli_options.traj_check_path.empty())
+		return run_trajectory_check(cli_options.traj_check_path) ? 0 : 1;
+
+	create_vkinstance(inst, debug_msgr, instance_api_version, cli_options.debug_mode);
 	get_physical_devs(inst, present_physical_devs);
 	//physical_dev = physical_devs[select_device_prompt(physical_devs)];
 
@@ -934,6 +3244,44 @@ int main(int argc, char *argv[]) {
 			physical_devs.push_back(present_physical_devs[i]);
 	}
 
+	const bool single_system = cli_options.multi_gpu != MultiGpu::off && physical_devs.size() > 1;
+	const bool split = single_system && cli_options.multi_gpu == MultiGpu::split;
+	const bool ring = single_system && cli_options.multi_gpu == MultiGpu::ring;
+	if (cli_options.multi_gpu != MultiGpu::off && !single_system)
+		std::printf("! -multi-gpu %s needs more than one device, running one system per device\n", multi_gpu_name(cli_options.multi_gpu));
+
+	// -multi-gpu hands each device an even share of the i-range, the devices submit in lock-step
+	// and gather the owned ranges in host memory in between
+	std::vector<std::uint32_t> owned_first(physical_devs.size(), 0), owned_count(physical_devs.size(), static_cast<std::uint32_t>(num_particles));
+	if (single_system) {
+		for (std::size_t i = 0; i < physical_devs.size(); i++) {
+			owned_first[i] = static_cast<std::uint32_t>(num_particles * i / physical_devs.size());
+			owned_count[i] = static_cast<std::uint32_t>(num_particles * (i + 1) / physical_devs.size()) - owned_first[i];
+		}
+
+		if (ring)
+			std::printf("Multi-GPU: ring of %zu devices, j-blocks uploaded from host memory while the previous block is computed\n", physical_devs.size());
+		else
+			std::printf("Multi-GPU: split across %zu devices, positions all-gathered through host memory every %u steps\n", physical_devs.size(), cli_options.steps_per_submit);
+	}
+
+	// the host regroups the gathered system and exchanges the bodies that changed device, the
+	// owned ranges stay put
+	const bool morton = single_system && cli_options.decompose == Decomposition::morton;
+	if (cli_options.decompose != Decomposition::index && !morton)
+		std::printf("! -decompose %s needs -multi-gpu on more than one device, keeping the index order\n", decomposition_name(cli_options.decompose));
+	else if (morton)
+		std::printf("Decomposition: morton, bodies reordered every %llu steps\n", static_cast<unsigned long long>(cli_options.decompose_interval));
+
+	DomainOrder domain_order(morton ? num_particles : 0);
+	std::vector<std::uint32_t> moved_slots;
+
+	// the shares start out even, throughput moves them once the devices have been timed
+	const bool balance = single_system && cli_options.balance == Balance::throughput;
+	if (balance)
+		std::printf("Balance: throughput, shares resized past %.01f%% imbalance\n", cli_options.balance_threshold);
+	std::vector<bool> reupload(physical_devs.size(), false);
+
 	std::vector<VkDevice> dev(physical_devs.size());
 	std::vector<VolkDeviceTable> funcs(physical_devs.size());
 	std::vector<VmaAllocator> allocator(physical_devs.size());
@@ -945,21 +3293,129 @@ int main(int argc, char *argv[]) {
 	std::vector<VkDescriptorPool> desc_pool(physical_devs.size());
 	std::vector<VkDescriptorSet> desc_set(physical_devs.size());
 
+	// shared by the force, integrate and quantize passes
+	std::vector<VkDescriptorSetLayout> aux_desc_set_layout(physical_devs.size());
+	std::vector<VkPipelineLayout> aux_pipeline_layout(physical_devs.size());
+
+	std::vector<ForceKernel> force_kernel(physical_devs.size());
+	std::vector<ForcePasses> force_passes(physical_devs.size());
+	std::vector<VkPipeline> pipeline_force(physical_devs.size()), pipeline_integrate(physical_devs.size());
+	std::vector<VkDescriptorPool> force_desc_pool(physical_devs.size());
+	std::vector<VkDescriptorSet> force_desc_set(physical_devs.size());
+	std::vector<VmaAllocation> accel_buf_alloc(physical_devs.size());
+	std::vector<VkBuffer> accel_buf(physical_devs.size());
+	std::vector<VkPipeline> pipeline_dispatch_args(physical_devs.size());
+	std::vector<std::uint32_t> steps_per_submit(physical_devs.size(), 1);
+
+	// persistent kernel only
+	std::vector<VmaAllocation> grid_buf_alloc(physical_devs.size());
+	std::vector<VkBuffer> grid_buf(physical_devs.size());
+
+	std::vector<VmaAllocation> dispatch_buf_alloc(physical_devs.size());
+	std::vector<VkBuffer> dispatch_buf(physical_devs.size());
+
+	// -bda, the force and integrate passes then run on address_pipeline_layout without force_desc_set
+	std::vector<bool> buffer_device_address(physical_devs.size(), false);
+	std::vector<VkPipelineLayout> address_pipeline_layout(physical_devs.size());
+
+	// fp16 force pass, only created with -precision fp16
+	static const VkDeviceSize half_buf_size = sizeof(QuantizedBounds) + 2*sizeof(std::uint32_t)*num_particles;
+	std::vector<Precision> precision(physical_devs.size());
+	std::vector<bool> shader_float16(physical_devs.size(), false);
+	std::vector<VkPipeline> pipeline_half_bounds(physical_devs.size()), pipeline_pack_half(physical_devs.size());
+	std::vector<VkDescriptorPool> half_bounds_desc_pool(physical_devs.size());
+	std::vector<VkDescriptorSet> half_bounds_desc_set(physical_devs.size());
+	std::vector<VmaAllocation> half_buf_alloc(physical_devs.size());
+	std::vector<VkBuffer> half_buf(physical_devs.size());
+
+	// double-single low words, only created with -precision ds
+	static const VkDeviceSize position_lo_buf_size = sizeof(vec4)*num_particles;
+	std::vector<VmaAllocation> position_lo_buf_alloc(physical_devs.size());
+	std::vector<VkBuffer> position_lo_buf(physical_devs.size());
+
+	// GPU diagnostics, only created with -diagnostics
+	static const VkDeviceSize reduce_buf_size = sizeof(Reduction)*(1 + (num_particles + reduce_local_size - 1) / reduce_local_size);
+	std::vector<bool> diagnostics(physical_devs.size(), false);
+	std::vector<VkPipeline> pipeline_reduce(physical_devs.size()), pipeline_reduce_final(physical_devs.size());
+	std::vector<VkDescriptorPool> reduce_desc_pool(physical_devs.size());
+	std::vector<VkDescriptorSet> reduce_desc_set(physical_devs.size());
+	std::vector<VmaAllocation> reduce_dev_buf_alloc(physical_devs.size()), reduce_host_buf_alloc(physical_devs.size());
+	std::vector<VkBuffer> reduce_dev_buf(physical_devs.size()), reduce_host_buf(physical_devs.size());
+	std::vector<Reduction *> reduction(physical_devs.size()); // from reduce_host_buf memory
+	std::vector<ReducePasses> reduce_passes(physical_devs.size());
+
+	// drift is measured against the result of the first submit
+	std::vector<Reduction> initial_reduction(physical_devs.size());
+	std::vector<bool> has_initial_reduction(physical_devs.size(), false);
+
+	// region of interest selections, only created with -roi
+	const std::uint32_t roi_capacity = static_cast<std::uint32_t>(std::min<std::size_t>(cli_options.roi_max, num_particles));
+	const VkDeviceSize roi_buf_size = sizeof(RoiParams) + sizeof(RoiParticle)*roi_capacity;
+	static const VkDeviceSize roi_scan_buf_size = sizeof(std::uint32_t)*((num_particles + roi_local_size - 1) / roi_local_size);
+	std::vector<bool> roi(physical_devs.size(), false);
+	std::vector<VkPipeline> pipeline_roi_select(physical_devs.size()), pipeline_roi_scan(physical_devs.size()), pipeline_roi_compact(physical_devs.size());
+	std::vector<VkDescriptorPool> roi_desc_pool(physical_devs.size());
+	std::vector<VkDescriptorSet> roi_desc_set(physical_devs.size());
+	std::vector<VmaAllocation> roi_dev_buf_alloc(physical_devs.size()), roi_scan_buf_alloc(physical_devs.size()), roi_host_buf_alloc(physical_devs.size());
+	std::vector<VkBuffer> roi_dev_buf(physical_devs.size()), roi_scan_buf(physical_devs.size()), roi_host_buf(physical_devs.size());
+	std::vector<unsigned char *> roi_data(physical_devs.size()); // from roi_host_buf memory
+	std::vector<RoiPasses> roi_passes(physical_devs.size());
+	std::vector<std::FILE *> roi_file(physical_devs.size(), nullptr);
+	std::vector<bool> roi_pending(physical_devs.size(), false), roi_in_flight(physical_devs.size(), false);
+	std::vector<std::uint32_t> roi_selected(physical_devs.size(), 0);
+
+	// lossy snapshots, only created with -snapshot-quantize
+	const std::uint32_t quantize_bits = cli_options.snapshot_path.empty() ? 0 : cli_options.snapshot_quantize;
+	const VkDeviceSize quantize_buf_size = quantize_bits != 0 ? trajectory_quantized_size(num_particles, quantize_bits) : 0;
+	std::vector<VkPipeline> pipeline_bounds(physical_devs.size()), pipeline_quantize(physical_devs.size());
+	std::vector<VkDescriptorPool> quantize_desc_pool(physical_devs.size());
+	std::vector<VkDescriptorSet> quantize_desc_set(physical_devs.size());
+	std::vector<VmaAllocation> quantize_dev_buf_alloc(physical_devs.size()), quantize_host_buf_alloc(physical_devs.size());
+	std::vector<VkBuffer> quantize_dev_buf(physical_devs.size()), quantize_host_buf(physical_devs.size());
+	std::vector<unsigned char *> quantized(physical_devs.size()); // from quantize_host_buf memory
+	std::vector<QuantizePasses> quantize_passes(physical_devs.size());
+	std::vector<bool> quantize_in_flight(physical_devs.size(), false);
+
 	std::vector<VmaAllocation> dev_buf_alloc(physical_devs.size()), host_buf_alloc(physical_devs.size()), uniform_buf_alloc(physical_devs.size());
 	std::vector<VkBuffer> dev_buf(physical_devs.size()), host_buf(physical_devs.size()), uniform_buf(physical_devs.size());
-	std::vector<Particle *> particles(physical_devs.size()); // from host_buf memory
+	std::vector<Particle *> particles(physical_devs.size()); // from host_buf memory, or dev_buf memory with zero-copy
+	std::vector<bool> zero_copy(physical_devs.size(), false);
+
+	// VK_EXT_external_memory_host imports, VK_NULL_HANDLE where VMA allocated the memory instead.
+	// host_buf comes from a huge page region with -hugepages, init_buf is the HOST->DEV copy
+	// source over the -init mapping. particles points into that mapping until the first
+	// readback lands in host_buf, host_particles is where it goes back to
+	std::vector<bool> external_memory_host(physical_devs.size(), false);
+	std::vector<VkDeviceSize> import_alignment(physical_devs.size(), 0);
+	std::vector<VkDeviceMemory> host_buf_mem(physical_devs.size(), VK_NULL_HANDLE), init_buf_mem(physical_devs.size(), VK_NULL_HANDLE);
+	std::vector<VkBuffer> init_buf(physical_devs.size(), VK_NULL_HANDLE);
+	std::vector<void *> hugepage_buf(physical_devs.size(), nullptr);
+	std::vector<std::size_t> hugepage_size(physical_devs.size(), 0);
+	std::vector<Particle *> host_particles(physical_devs.size());
+	MappedFile init_file = {};
 	std::vector<UBO *> ubo(physical_devs.size()); // from uniform_buf memory
 
 	std::vector<VkCommandPool> compute_cmd_pool(physical_devs.size()), transfer_cmd_pool(physical_devs.size());
-	std::vector<std::array<VkCommandBuffer, 1>> compute_cmd_bufs(physical_devs.size());
+	// 0: step, 1: step followed by the quantize passes
+	std::vector<std::array<VkCommandBuffer, 2>> compute_cmd_bufs(physical_devs.size());
+
+	// 0: HOST->DEV, 1: DEV->HOST of the readback ranges, 2: quantized DEV->HOST, 3: HOST->DEV of
+	// the ranges the other devices own with -multi-gpu split, 4: HOST->DEV of the whole host_buf
+	// after a -balance throughput repartition, or of the foreign ranges and the slots a
+	// -decompose morton reorder moved into the owned one
+	std::vector<std::array<VkCommandBuffer, 5>> transfer_cmd_bufs(physical_devs.size());
 
-	// 0: HOST->DEV, 1: DEV->HOST
-	std::vector<std::array<VkCommandBuffer, 2>> transfer_cmd_bufs(physical_devs.size());
+	// -multi-gpu ring only. one compute command buffer per stage, and per stage after the first the
+	// HOST->DEV copy of its j-block, which signals the semaphore that stage waits on
+	std::vector<std::vector<VkCommandBuffer>> ring_cmd_bufs(physical_devs.size()), ring_upload_cmd_bufs(physical_devs.size());
+	std::vector<std::vector<VkSemaphore>> ring_semaphore(physical_devs.size());
 
 	std::vector<VkFence> compute_fence(physical_devs.size()), dev_to_host_copy_fence(physical_devs.size());
 	std::vector<VkSemaphore> copy_host_to_dev_semaphore(physical_devs.size()), copy_dev_to_host_semaphore(physical_devs.size()), compute_fin_semaphore(physical_devs.size());
 
-	std::vector<std::uint32_t> compute_queue_family_idx(physical_devs.size()), transfer_queue_family_idx(physical_devs.size()), transfer_queue_idx(physical_devs.size());
+	std::vector<std::uint32_t> compute_queue_family_idx(physical_devs.size()), transfer_queue_family_idx(physical_devs.size());
+	std::vector<std::uint32_t> compute_queue_count(physical_devs.size()), dma_queue_family_idx(physical_devs.size());
+	std::vector<QueueTopology> queue_topology(physical_devs.size());
 	std::vector<VkQueue> compute_queue(physical_devs.size());
 	std::vector<VkQueue> transfer_queue(physical_devs.size());
 
@@ -967,36 +3423,603 @@ int main(int argc, char *argv[]) {
 	std::vector<float> duration(physical_devs.size(), 0.f), mean_sample(physical_devs.size(), 0.f);
 	std::vector<int> num_samples(physical_devs.size(), 0);
 	std::vector<bool> wait_for_copy(physical_devs.size(), true);
+	std::vector<std::uint64_t> step(physical_devs.size(), 0);
+	std::vector<double> sim_time(physical_devs.size(), 0.0);
+
+	// -multi-gpu split and ring. end_time is when a device was first seen done, the system steps once all
+	// of them are. busy_time adds up end_time - start_time over the stats period
+	std::vector<bool> device_ready(physical_devs.size(), false);
+	std::vector<float> busy_time(physical_devs.size(), 0.f);
+	auto system_start = std::chrono::high_resolution_clock::now();
+	float system_delta_time = 0.f, system_duration = 0.f, system_mean_sample = 0.f;
+	int system_samples = 0;
+	std::uint64_t gather_bytes = 0;
+
+	// -balance throughput. balance_busy adds up end_time - start_time over balance_window lock-step
+	// submits, balance_discard drops a submit that uploaded more than the foreign ranges
+	std::vector<double> balance_busy(physical_devs.size(), 0.0);
+	std::uint32_t balance_samples = 0;
+	bool balance_discard = false;
+
+	// what the DEV->HOST copy in flight covers. host_buf holds the initial state until the first
+	// one lands, after that only the ranges some consumer asked for are current
+	std::vector<ReadbackPlan> readback_plan(physical_devs.size());
+	std::vector<bool> dump_pending(physical_devs.size(), false), energy_pending(physical_devs.size(), false);
+	std::vector<int> readback_count(physical_devs.size(), 0);
+	std::vector<std::uint64_t> readback_bytes(physical_devs.size(), 0);
+
+	// energy diagnostics, only with -energy
+	const ForceParams force_params = {
+		.law = cli_options.force_law,
+		.gravity = cli_options.gravity,
+		.softening = cli_options.softening,
+		.unit_scale = cli_options.unit_scale
+	};
+
+	std::unique_ptr<ThreadPool> cpu_pool;
+	std::vector<double> initial_energy(physical_devs.size(), 0.0);
+	if (cli_options.energy || cli_options.validate_steps > 0)
+		cpu_pool = std::make_unique<ThreadPool>(std::max(std::thread::hardware_concurrency(), 1u));
+
+	// CPU mirror of the first validate_steps steps, see nbody_cpu_step
+	std::vector<bool> validate(physical_devs.size(), false);
+	std::vector<std::vector<Particle>> cpu_particles(physical_devs.size());
+	std::vector<std::vector<vec4>> cpu_position_lo(physical_devs.size());
+
+	// -multi-gpu runs a single system, GPU 0 writes it
+	std::unique_ptr<SnapshotWriter> snapshot_writer;
+	if (!cli_options.snapshot_path.empty())
+		snapshot_writer = std::make_unique<SnapshotWriter>(cli_options.snapshot_path, single_system ? 1 : physical_devs.size(), cli_options.snapshot_queue, static_cast<std::uint32_t>(num_particles), cli_options.snapshot_policy, cli_options.snapshot_io, cli_options.snapshot_direct, cli_options.snapshot_compress, cli_options.snapshot_keyframe, quantize_bits);
 
 	StdinMailbox mailbox;
 	std::string line;
 
 	for (std::size_t i = 0; i < physical_devs.size(); i++) {
-		create_device(physical_devs[i], dev[i], compute_queue_family_idx[i], transfer_queue_family_idx[i], transfer_queue_idx[i]);
+		shader_float16[i] = cli_options.precision == Precision::fp16 && query_shader_float16(physical_devs[i], instance_api_version);
+
+		buffer_device_address[i] = cli_options.bda && query_buffer_device_address(physical_devs[i], instance_api_version);
+		if (cli_options.bda && !buffer_device_address[i])
+			std::printf("! GPU:%zu has no bufferDeviceAddress, falling back to descriptor sets\n", i);
+
+		// only needed to import -init or -hugepages memory
+		if (!cli_options.init_path.empty() || cli_options.hugepages)
+			external_memory_host[i] = query_external_memory_host(physical_devs[i], instance_api_version, import_alignment[i]);
+
+		create_device(physical_devs[i], dev[i], compute_queue_family_idx[i], compute_queue_count[i], dma_queue_family_idx[i], shader_float16[i], buffer_device_address[i], external_memory_host[i]);
 		volkLoadDeviceTable(&funcs[i], dev[i]);
 		funcs[i].vkGetDeviceQueue(dev[i], compute_queue_family_idx[i], 0, &compute_queue[i]);
-		funcs[i].vkGetDeviceQueue(dev[i], transfer_queue_family_idx[i], transfer_queue_idx[i], &transfer_queue[i]);
-		create_allocator(funcs[i], inst, physical_devs[i], dev[i], allocator[i]);
+		create_allocator(funcs[i], inst, physical_devs[i], dev[i], allocator[i], buffer_device_address[i]);
+
+		// the ring uploads a j-block into dev_buf while the force pass reads the one before it, which
+		// an ownership transfer of the whole buffer cannot express. the second compute queue still
+		// overlaps them, without one every upload would wait for the force pass and the ring is pointless
+		if (ring && compute_queue_count[i] < 2) {
+			std::printf("! GPU:%zu has a single compute queue, the ring cannot overlap its uploads with the force pass\n", i);
+			throw std::runtime_error("-multi-gpu ring needs a second compute queue on every device, use -multi-gpu split!");
+		}
+
+		QueueTopology queues = cli_options.queues;
+		if (ring && queues != QueueTopology::shared) {
+			if (queues != QueueTopology::automatic)
+				std::printf("! GPU:%zu -multi-gpu ring keeps the copies in the compute family, using the shared topology\n", i);
+			queues = QueueTopology::shared;
+		}
+
+		queue_topology[i] = plan_queue_topology(funcs[i], dev[i], allocator[i], i, queues, compute_queue_family_idx[i], compute_queue_count[i], dma_queue_family_idx[i], storage_buf_size, transfer_queue[i], transfer_queue_family_idx[i]);
+		std::printf("GPU:%zu Queue topology: %s%s\n", i, queue_topology_name(queue_topology[i]), transfer_queue_family_idx[i] != compute_queue_family_idx[i] ? ", ownership moves between families" : "");
+	}
+
+	// mapped once for every device, aligned for the strictest of them. the devices that cannot
+	// import the mapping copy it into host_buf, and without a mapping the file is read there
+	if (!cli_options.init_path.empty()) {
+		VkDeviceSize alignment = 0;
+		for (std::size_t i = 0; i < physical_devs.size(); i++)
+			alignment = std::max(alignment, import_alignment[i]);
+
+		if (map_file(cli_options.init_path, static_cast<std::size_t>(alignment), init_file) && init_file.size < storage_buf_size) {
+			unmap_file(init_file);
+			throw std::runtime_error("Initial conditions file is too small!");
+		}
 	}
 
 	for (std::size_t i = 0; i < physical_devs.size(); i++) {
 		create_desc_and_pipeline_layout(funcs[i], dev[i], desc_set_layout[i], pipeline_layout[i]);
 		create_compute_pipeline(funcs[i], dev[i], pipeline_layout[i], particle_attraction_code, sizeof(particle_attraction_code), pipeline_attraction[i]);
 		create_desc_pool_and_set(funcs[i], dev[i], desc_set_layout[i], desc_pool[i], desc_set[i]);
+		create_aux_desc_and_pipeline_layout(funcs[i], dev[i], aux_desc_set_layout[i], aux_pipeline_layout[i]);
+
+		// the step command buffers are recorded again before every submit with that step's constants,
+		// the DEV->HOST copy with that submit's readback ranges
+		create_cmd_pool(funcs[i], dev[i], compute_queue_family_idx[i], compute_cmd_pool[i], VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+
+		const VkBufferUsageFlags address_usage = buffer_device_address[i] ? VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR : 0;
+
+		// the selection and the quantized snapshots still go through the transfer queue. reading the
+		// state in place through the BAR can be slower than a DMA into cached host memory, auto times both
+		VkPhysicalDeviceProperties dev_props;
+		vkGetPhysicalDeviceProperties(physical_devs[i], &dev_props);
+
+		const bool zero_copy_memory = query_zero_copy_memory(physical_devs[i], storage_buf_size + uniform_buf_size);
+		const bool integrated = dev_props.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU;
+
+		zero_copy[i] = !single_system && zero_copy_memory && quantize_bits == 0 && cli_options.roi_path.empty() && cli_options.zero_copy != "off";
+		if (zero_copy[i] && cli_options.zero_copy == "auto") {
+			const UBO constants = {
+				.delta_time = 0.f,
+				.particle_count = static_cast<std::uint32_t>(num_particles),
+				.gravity = cli_options.gravity,
+				.softening = cli_options.softening,
+				.unit_scale = cli_options.unit_scale
+			};
 
-		create_dev_buf(allocator[i], dev_buf[i], dev_buf_alloc[i], storage_buf_size + uniform_buf_size);
-		create_host_buf(allocator[i], host_buf[i], host_buf_alloc[i], particles[i], storage_buf_size);
-		create_uniform_buf(allocator[i], uniform_buf[i], uniform_buf_alloc[i], ubo[i], uniform_buf_size);
-		update_desc_set(funcs[i], dev[i], desc_set[i], dev_buf[i], uniform_buf[i], storage_buf_size, uniform_buf_size);
+			double mapped_seconds, staged_seconds;
+			probe_zero_copy(funcs[i], dev[i], allocator[i], compute_queue[i], compute_cmd_pool[i], aux_desc_set_layout[i], aux_pipeline_layout[i], constants, storage_buf_size, num_particles, force_specialization(ForceKernel::tiled, false, 0, cli_options.block, static_cast<std::uint32_t>(cli_options.force_law), 1), mapped_seconds, staged_seconds);
+			std::printf("GPU:%zu Zero-copy probe: mapped:%.03fms staged:%.03fms per step and readback\n", i, mapped_seconds * 1000.0, staged_seconds * 1000.0);
+
+			zero_copy[i] = mapped_seconds < staged_seconds;
+		} else if (cli_options.zero_copy == "on" && !zero_copy[i]) {
+			std::printf("! GPU:%zu Zero-copy needs DEVICE_LOCAL|HOST_VISIBLE memory and no -snapshot-quantize, -roi or -multi-gpu, staging through host memory\n", i);
+		}
+
+		if (zero_copy[i])
+			create_mapped_dev_buf(allocator[i], dev_buf[i], dev_buf_alloc[i], particles[i], storage_buf_size + uniform_buf_size, address_usage);
+		else
+			create_dev_buf(allocator[i], dev_buf[i], dev_buf_alloc[i], storage_buf_size + uniform_buf_size, address_usage);
+
+		create_uniform_buf(allocator[i], uniform_buf[i], uniform_buf_alloc[i], ubo[i], uniform_buf_size, address_usage);
 
-		create_cmd_pool(funcs[i], dev[i], compute_queue_family_idx[i], compute_cmd_pool[i]);
-		create_cmd_pool(funcs[i], dev[i], transfer_queue_family_idx[i], transfer_cmd_pool[i]);
+		// set ahead of the kernel probes, delta_time is written before every submit
+		ubo[i]->particle_count = num_particles;
+		ubo[i]->gravity = cli_options.gravity;
+		ubo[i]->softening = cli_options.softening;
+		ubo[i]->unit_scale = cli_options.unit_scale;
+
+		update_desc_set(funcs[i], dev[i], desc_set[i], dev_buf[i], uniform_buf[i], storage_buf_size, uniform_buf_size);
 		create_cmd_bufs(funcs[i], dev[i], compute_cmd_pool[i], compute_cmd_bufs[i]);
-		create_cmd_bufs(funcs[i], dev[i], transfer_cmd_pool[i], transfer_cmd_bufs[i]);
 
-		record_cmd_buf_copy_host_to_dev(funcs[i], transfer_cmd_bufs[i][0], host_buf[i], dev_buf[i], storage_buf_size, compute_queue_family_idx[i], transfer_queue_family_idx[i]);
-		record_cmd_buf_copy_dev_to_host(funcs[i], transfer_cmd_bufs[i][1], host_buf[i], dev_buf[i], storage_buf_size, compute_queue_family_idx[i], transfer_queue_family_idx[i]);
-		record_cmd_buf_work(funcs[i], compute_cmd_bufs[i][0], pipeline_attraction[i], pipeline_layout[i], desc_set[i], dev_buf[i], storage_buf_size, particles_per_workgroup, compute_queue_family_idx[i], transfer_queue_family_idx[i]);
+		if (zero_copy[i]) {
+			std::printf("GPU:%zu Particle buffer: zero-copy (%s)\n", i, integrated ? "UMA" : "BAR");
+		} else {
+			// fewer and larger pages for the readback DMA to pin and walk
+			if (cli_options.hugepages && external_memory_host[i]) {
+				hugepage_buf[i] = hugepage_alloc(storage_buf_size, hugepage_size[i]);
+				if (hugepage_buf[i] != nullptr && import_host_buf(funcs[i], physical_devs[i], dev[i], hugepage_buf[i], hugepage_size[i], storage_buf_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, host_buf[i], host_buf_mem[i])) {
+					particles[i] = static_cast<Particle *>(hugepage_buf[i]);
+					std::printf("GPU:%zu Host buffer: %zu MiB of huge pages\n", i, hugepage_size[i] >> 20);
+				}
+			}
+
+			if (host_buf_mem[i] == VK_NULL_HANDLE) {
+				if (cli_options.hugepages)
+					std::printf("! GPU:%zu Cannot import huge pages as the host buffer, falling back to host memory\n", i);
+
+				hugepage_free(hugepage_buf[i], hugepage_size[i]);
+				hugepage_buf[i] = nullptr;
+				create_host_buf(allocator[i], host_buf[i], host_buf_alloc[i], particles[i], storage_buf_size);
+			}
+
+			host_particles[i] = particles[i];
+
+			// the initial conditions go from the page cache to the device in a single DMA
+			VkBuffer init_src_buf = host_buf[i];
+			if (init_file.data != nullptr && external_memory_host[i]) {
+				if (import_host_buf(funcs[i], physical_devs[i], dev[i], init_file.data, init_file.mapped_size, storage_buf_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, init_buf[i], init_buf_mem[i]))
+					init_src_buf = init_buf[i];
+				else
+					std::printf("! GPU:%zu Cannot import the initial conditions mapping, copying it into the host buffer\n", i);
+			}
+
+			create_cmd_pool(funcs[i], dev[i], transfer_queue_family_idx[i], transfer_cmd_pool[i], VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+			create_cmd_bufs(funcs[i], dev[i], transfer_cmd_pool[i], transfer_cmd_bufs[i]);
+			record_cmd_buf_copy_host_to_dev(funcs[i], transfer_cmd_bufs[i][0], init_src_buf, dev_buf[i], storage_buf_size, { ReadbackRange { .offset = 0, .size = storage_buf_size } }, compute_queue_family_idx[i], transfer_queue_family_idx[i]);
+
+			// everything but the owned range comes from the other devices through host_buf, see
+			// transfer_cmd_bufs for what goes up once the bodies or the ranges move
+
+			if (ring) {
+				const std::size_t stages = physical_devs.size();
+
+				ring_cmd_bufs[i].resize(stages);
+				ring_upload_cmd_bufs[i].resize(stages - 1);
+				ring_semaphore[i].resize(stages - 1);
+				create_cmd_bufs(funcs[i], dev[i], compute_cmd_pool[i], ring_cmd_bufs[i]);
+				create_cmd_bufs(funcs[i], dev[i], transfer_cmd_pool[i], ring_upload_cmd_bufs[i]);
+
+				for (auto &semaphore : ring_semaphore[i])
+					create_semaphore(funcs[i], dev[i], semaphore);
+			}
+
+			if (single_system)
+				record_owned_range_uploads(funcs[i], i, owned_first, owned_count, split ? transfer_cmd_bufs[i][3] : VK_NULL_HANDLE, ring_upload_cmd_bufs[i], host_buf[i], dev_buf[i], storage_buf_size, compute_queue_family_idx[i], transfer_queue_family_idx[i]);
+		}
+
+		std::uint32_t subgroup_size;
+		const bool subgroup_shuffle = query_subgroup_shuffle(physical_devs[i], instance_api_version, subgroup_size);
+
+		const std::uint32_t force_law = static_cast<std::uint32_t>(cli_options.force_law);
+
+		force_kernel[i] = cli_options.kernel;
+		if (force_kernel[i] == ForceKernel::automatic) {
+			const ForceKernel two_pass = subgroup_shuffle ? ForceKernel::subgroup : ForceKernel::tiled;
+
+			// jsplit pays off while the i-range alone leaves the device idle, which depends on more
+			// than the body count. the ring cannot run it and fp16 replaces either kernel
+			if (cli_options.jsplit_threshold > 0) {
+				force_kernel[i] = num_particles < cli_options.jsplit_threshold ? ForceKernel::jsplit : two_pass;
+			} else if (ring || cli_options.precision != Precision::fp32) {
+				force_kernel[i] = two_pass;
+			} else {
+				const double jsplit_seconds = probe_force_kernel(funcs[i], dev[i], allocator[i], compute_queue[i], compute_cmd_pool[i], aux_desc_set_layout[i], aux_pipeline_layout[i], dev_buf[i], uniform_buf[i], storage_buf_size, uniform_buf_size, num_particles, ForceKernel::jsplit, force_specialization(ForceKernel::jsplit, false, subgroup_size, cli_options.block, force_law, cli_options.steps_per_submit));
+				const double two_pass_seconds = probe_force_kernel(funcs[i], dev[i], allocator[i], compute_queue[i], compute_cmd_pool[i], aux_desc_set_layout[i], aux_pipeline_layout[i], dev_buf[i], uniform_buf[i], storage_buf_size, uniform_buf_size, num_particles, two_pass, force_specialization(two_pass, false, subgroup_size, cli_options.block, force_law, cli_options.steps_per_submit));
+				std::printf("GPU:%zu Kernel probe: jsplit:%.03fms %s:%.03fms per step\n", i, jsplit_seconds * 1000.0, force_kernel_name(two_pass), two_pass_seconds * 1000.0);
+
+				force_kernel[i] = jsplit_seconds < two_pass_seconds ? ForceKernel::jsplit : two_pass;
+			}
+		} else if (force_kernel[i] == ForceKernel::subgroup && !subgroup_shuffle) {
+			std::printf("! GPU:%zu has no compute subgroup shuffle, falling back to the tiled kernel\n", i);
+			force_kernel[i] = ForceKernel::tiled;
+		}
+
+		// the owned range is only honoured by the fp32 two-pass kernels, and the j-block of a
+		// ring stage by the ones that keep a single partial slot
+		if (single_system && (force_kernel[i] == ForceKernel::legacy || force_kernel[i] == ForceKernel::persistent || (ring && force_kernel[i] == ForceKernel::jsplit))) {
+			std::printf("! GPU:%zu -multi-gpu %s cannot run the %s kernel, falling back to the tiled kernel\n", i, multi_gpu_name(cli_options.multi_gpu), force_kernel_name(force_kernel[i]));
+			force_kernel[i] = ForceKernel::tiled;
+		}
+
+		// the half kernels are tiled, they stand in for whichever kernel was picked
+		precision[i] = cli_options.precision;
+		if (single_system && precision[i] != Precision::fp32) {
+			std::printf("! GPU:%zu -multi-gpu %s only runs in fp32\n", i, multi_gpu_name(cli_options.multi_gpu));
+			precision[i] = Precision::fp32;
+		}
+
+		if (precision[i] != Precision::fp32 && force_kernel[i] == ForceKernel::legacy) {
+			std::printf("! GPU:%zu The legacy kernel only runs in fp32\n", i);
+			precision[i] = Precision::fp32;
+		}
+
+		if (precision[i] != Precision::fp32 && force_kernel[i] == ForceKernel::persistent) {
+			std::printf("! GPU:%zu The persistent kernel only runs in fp32, falling back to the tiled kernel\n", i);
+			force_kernel[i] = ForceKernel::tiled;
+		}
+
+		// more workgroups than the device can hold at once would deadlock in the grid barrier, and
+		// without a multiprocessor count only one is known to fit, orders of magnitude too slow
+		const std::uint32_t resident_groups = force_kernel[i] == ForceKernel::persistent ? query_resident_workgroups(physical_devs[i], instance_api_version) : 0;
+		if (force_kernel[i] == ForceKernel::persistent && resident_groups == 0) {
+			std::printf("! GPU:%zu reports no multiprocessor count to size the persistent kernel, falling back to the tiled kernel\n", i);
+			force_kernel[i] = ForceKernel::tiled;
+		}
+
+		const bool persistent = force_kernel[i] == ForceKernel::persistent;
+		const std::uint32_t persistent_groups = std::min<std::uint32_t>(resident_groups, static_cast<std::uint32_t>((num_particles + tiled_local_size - 1) / tiled_local_size));
+
+		// particle_attraction.comp reads delta_time from the UBO, one step per submit
+		steps_per_submit[i] = force_kernel[i] != ForceKernel::legacy ? cli_options.steps_per_submit : 1;
+		if (steps_per_submit[i] != cli_options.steps_per_submit)
+			std::printf("! GPU:%zu The legacy kernel runs one step per submit\n", i);
+
+		// the persistent kernel is only worth its grid barriers if it beats the same steps recorded
+		// back to back into one command buffer, time both so the run shows it
+		if (persistent) {
+			const ForceKernel multi_step = subgroup_shuffle ? ForceKernel::subgroup : ForceKernel::tiled;
+			const double persistent_seconds = probe_force_kernel(funcs[i], dev[i], allocator[i], compute_queue[i], compute_cmd_pool[i], aux_desc_set_layout[i], aux_pipeline_layout[i], dev_buf[i], uniform_buf[i], storage_buf_size, uniform_buf_size, num_particles, ForceKernel::persistent, force_specialization(ForceKernel::persistent, false, subgroup_size, cli_options.block, force_law, steps_per_submit[i]), persistent_groups);
+			const double multi_step_seconds = probe_force_kernel(funcs[i], dev[i], allocator[i], compute_queue[i], compute_cmd_pool[i], aux_desc_set_layout[i], aux_pipeline_layout[i], dev_buf[i], uniform_buf[i], storage_buf_size, uniform_buf_size, num_particles, multi_step, force_specialization(multi_step, false, subgroup_size, cli_options.block, force_law, steps_per_submit[i]));
+			std::printf("GPU:%zu Kernel probe: persistent:%.03fms %s:%.03fms per step, %u steps per submit\n", i, persistent_seconds * 1000.0, force_kernel_name(multi_step), multi_step_seconds * 1000.0, steps_per_submit[i]);
+		}
+
+		// the half and double-single passes need binding 3, which has no address path, the
+		// persistent kernel keeps its grid barrier there
+		const bool addresses = buffer_device_address[i] && force_kernel[i] != ForceKernel::legacy && !persistent && precision[i] == Precision::fp32;
+		if (buffer_device_address[i] && !addresses)
+			std::printf("! GPU:%zu -bda only covers the fp32 force and integrate passes, binding descriptor sets\n", i);
+
+		if (addresses)
+			create_address_pipeline_layout(funcs[i], dev[i], address_pipeline_layout[i]);
+
+		if (force_kernel[i] != ForceKernel::legacy) {
+			const bool half = precision[i] == Precision::fp16;
+			const bool jsplit = !half && force_kernel[i] == ForceKernel::jsplit;
+
+			const ForceSpecialization spec = force_specialization(force_kernel[i], half, subgroup_size, cli_options.block, force_law, steps_per_submit[i]);
+
+			const VkSpecializationInfo spec_info = {
+				.mapEntryCount = static_cast<std::uint32_t>(force_spec_entries.size()),
+				.pMapEntries = force_spec_entries.data(),
+				.dataSize = sizeof(spec),
+				.pData = &spec
+			};
+
+			if (half && shader_float16[i])
+				create_compute_pipeline(funcs[i], dev[i], aux_pipeline_layout[i], nbody_force_half_packed_code, sizeof(nbody_force_half_packed_code), pipeline_force[i], &spec_info);
+			else if (half)
+				create_compute_pipeline(funcs[i], dev[i], aux_pipeline_layout[i], nbody_force_half_code, sizeof(nbody_force_half_code), pipeline_force[i], &spec_info);
+			else if (persistent)
+				create_compute_pipeline(funcs[i], dev[i], aux_pipeline_layout[i], nbody_persistent_code, sizeof(nbody_persistent_code), pipeline_force[i], &spec_info);
+			else if (addresses && force_kernel[i] == ForceKernel::subgroup)
+				create_compute_pipeline(funcs[i], dev[i], address_pipeline_layout[i], nbody_force_subgroup_bda_code, sizeof(nbody_force_subgroup_bda_code), pipeline_force[i], &spec_info);
+			else if (addresses && jsplit)
+				create_compute_pipeline(funcs[i], dev[i], address_pipeline_layout[i], nbody_force_jsplit_bda_code, sizeof(nbody_force_jsplit_bda_code), pipeline_force[i], &spec_info);
+			else if (addresses)
+				create_compute_pipeline(funcs[i], dev[i], address_pipeline_layout[i], nbody_force_tiled_bda_code, sizeof(nbody_force_tiled_bda_code), pipeline_force[i], &spec_info);
+			else if (force_kernel[i] == ForceKernel::subgroup)
+				create_compute_pipeline(funcs[i], dev[i], aux_pipeline_layout[i], nbody_force_subgroup_code, sizeof(nbody_force_subgroup_code), pipeline_force[i], &spec_info);
+			else if (jsplit)
+				create_compute_pipeline(funcs[i], dev[i], aux_pipeline_layout[i], nbody_force_jsplit_code, sizeof(nbody_force_jsplit_code), pipeline_force[i], &spec_info);
+			else
+				create_compute_pipeline(funcs[i], dev[i], aux_pipeline_layout[i], nbody_force_tiled_code, sizeof(nbody_force_tiled_code), pipeline_force[i], &spec_info);
+
+			// the integrate pass adds up one partial acceleration per j-range slice, or per ring stage
+			const std::uint32_t splits = jsplit ? jsplit_split_count(num_particles) : 1;
+			const std::uint32_t accel_slots = ring ? static_cast<std::uint32_t>(physical_devs.size()) : splits;
+			const VkDeviceSize accel_buf_size = sizeof(vec4)*num_particles*accel_slots;
+
+			const VkSpecializationInfo integrate_spec_info = {
+				.mapEntryCount = 1,
+				.pMapEntries = &integrate_spec_entry,
+				.dataSize = sizeof(accel_slots),
+				.pData = &accel_slots
+			};
+
+			// every workgroup covers local_size * block bodies
+			const std::uint32_t bodies_per_group = spec.local_size * spec.block;
+
+			// the arguments pass sizes both dispatches from the active count, see DispatchArgs
+			const std::array<std::uint32_t, 3> dispatch_args_spec = { bodies_per_group, splits, integrate_local_size };
+
+			const VkSpecializationInfo dispatch_args_spec_info = {
+				.mapEntryCount = static_cast<std::uint32_t>(dispatch_args_spec_entries.size()),
+				.pMapEntries = dispatch_args_spec_entries.data(),
+				.dataSize = sizeof(dispatch_args_spec),
+				.pData = dispatch_args_spec.data()
+			};
+
+			// the persistent kernel is dispatched directly and reads the active count itself, it
+			// needs neither the arguments pass nor the integrate pass
+			if (addresses)
+				create_compute_pipeline(funcs[i], dev[i], address_pipeline_layout[i], nbody_dispatch_args_bda_code, sizeof(nbody_dispatch_args_bda_code), pipeline_dispatch_args[i], &dispatch_args_spec_info);
+			else if (!persistent)
+				create_compute_pipeline(funcs[i], dev[i], aux_pipeline_layout[i], nbody_dispatch_args_code, sizeof(nbody_dispatch_args_code), pipeline_dispatch_args[i], &dispatch_args_spec_info);
+
+			// nothing removes particles yet, so every one of them stays active
+			create_dev_buf(allocator[i], dispatch_buf[i], dispatch_buf_alloc[i], sizeof(DispatchArgs), address_usage | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+			fill_dev_buf(funcs[i], dev[i], compute_queue[i], compute_cmd_pool[i], dispatch_buf[i], sizeof(DispatchArgs::active_count), static_cast<std::uint32_t>(num_particles));
+
+			if (precision[i] == Precision::ds)
+				create_compute_pipeline(funcs[i], dev[i], aux_pipeline_layout[i], nbody_integrate_ds_code, sizeof(nbody_integrate_ds_code), pipeline_integrate[i], &integrate_spec_info);
+			else if (addresses)
+				create_compute_pipeline(funcs[i], dev[i], address_pipeline_layout[i], nbody_integrate_bda_code, sizeof(nbody_integrate_bda_code), pipeline_integrate[i], &integrate_spec_info);
+			else if (!persistent)
+				create_compute_pipeline(funcs[i], dev[i], aux_pipeline_layout[i], nbody_integrate_code, sizeof(nbody_integrate_code), pipeline_integrate[i], &integrate_spec_info);
+
+			create_dev_buf(allocator[i], accel_buf[i], accel_buf_alloc[i], accel_buf_size, address_usage);
+			if (!addresses)
+				create_desc_pool_and_set(funcs[i], dev[i], aux_desc_set_layout[i], force_desc_pool[i], force_desc_set[i], aux_storage_buf_count);
+
+			if (half) {
+				// the bounds pass writes the head of half_buf through binding 2 of its own set
+				create_compute_pipeline(funcs[i], dev[i], aux_pipeline_layout[i], snapshot_bounds_code, sizeof(snapshot_bounds_code), pipeline_half_bounds[i]);
+				create_compute_pipeline(funcs[i], dev[i], aux_pipeline_layout[i], nbody_pack_half_code, sizeof(nbody_pack_half_code), pipeline_pack_half[i]);
+				create_dev_buf(allocator[i], half_buf[i], half_buf_alloc[i], half_buf_size);
+				create_desc_pool_and_set(funcs[i], dev[i], aux_desc_set_layout[i], half_bounds_desc_pool[i], half_bounds_desc_set[i], aux_storage_buf_count);
+				update_aux_desc_set(funcs[i], dev[i], half_bounds_desc_set[i], dev_buf[i], uniform_buf[i], half_buf[i], storage_buf_size, uniform_buf_size, half_buf_size);
+				update_aux_desc_set(funcs[i], dev[i], force_desc_set[i], dev_buf[i], uniform_buf[i], accel_buf[i], storage_buf_size, uniform_buf_size, accel_buf_size, half_buf[i], half_buf_size);
+			} else if (precision[i] == Precision::ds) {
+				// the low words start out as 0, the initial positions are exact in fp32
+				create_dev_buf(allocator[i], position_lo_buf[i], position_lo_buf_alloc[i], position_lo_buf_size);
+				fill_dev_buf(funcs[i], dev[i], compute_queue[i], compute_cmd_pool[i], position_lo_buf[i], position_lo_buf_size);
+				update_aux_desc_set(funcs[i], dev[i], force_desc_set[i], dev_buf[i], uniform_buf[i], accel_buf[i], storage_buf_size, uniform_buf_size, accel_buf_size, position_lo_buf[i], position_lo_buf_size);
+			} else if (persistent) {
+				create_dev_buf(allocator[i], grid_buf[i], grid_buf_alloc[i], sizeof(GridBarrier));
+				update_aux_desc_set(funcs[i], dev[i], force_desc_set[i], dev_buf[i], uniform_buf[i], accel_buf[i], storage_buf_size, uniform_buf_size, accel_buf_size, grid_buf[i], sizeof(GridBarrier));
+			} else if (!addresses) {
+				update_aux_desc_set(funcs[i], dev[i], force_desc_set[i], dev_buf[i], uniform_buf[i], accel_buf[i], storage_buf_size, uniform_buf_size, accel_buf_size);
+			}
+
+			if (!addresses)
+				update_dispatch_desc(funcs[i], dev[i], force_desc_set[i], dispatch_buf[i]);
+
+			force_passes[i] = ForcePasses {
+				.dispatch_args = pipeline_dispatch_args[i],
+				.force = pipeline_force[i],
+				.integrate = pipeline_integrate[i],
+				.pipeline_layout = addresses ? address_pipeline_layout[i] : aux_pipeline_layout[i],
+				.desc_set = addresses ? VK_NULL_HANDLE : force_desc_set[i],
+				.dispatch_buf = dispatch_buf[i],
+				.bounds = half ? pipeline_half_bounds[i] : VK_NULL_HANDLE,
+				.pack = half ? pipeline_pack_half[i] : VK_NULL_HANDLE,
+				.bounds_desc_set = half ? half_bounds_desc_set[i] : VK_NULL_HANDLE,
+				.half_buf = half ? half_buf[i] : VK_NULL_HANDLE,
+				.pack_group_count = static_cast<std::uint32_t>((num_particles + quantize_local_size - 1) / quantize_local_size),
+				.bodies_addr = addresses ? get_buf_address(funcs[i], dev[i], dev_buf[i]) : 0,
+				.ubo_addr = addresses ? get_buf_address(funcs[i], dev[i], uniform_buf[i]) : 0,
+				.accel_addr = addresses ? get_buf_address(funcs[i], dev[i], accel_buf[i]) : 0,
+				.dispatch_addr = addresses ? get_buf_address(funcs[i], dev[i], dispatch_buf[i]) : 0,
+				.steps = steps_per_submit[i],
+				.grid_buf = persistent ? grid_buf[i] : VK_NULL_HANDLE,
+				.persistent_group_count = persistent_groups,
+				.owned_first = owned_first[i],
+				.owned_count = owned_count[i]
+			};
+
+			if (half && shader_float16[i])
+				std::printf("GPU:%zu Force kernel: half (fp16 positions, packed fp16 separations, fp32 accumulation)\n", i);
+			else if (half)
+				std::printf("GPU:%zu Force kernel: half (fp16 positions, fp32 math, no shaderFloat16)\n", i);
+			else if (force_kernel[i] == ForceKernel::subgroup)
+				std::printf("GPU:%zu Force kernel: subgroup (subgroup size %u, workgroup size %u, %u bodies per invocation)\n", i, subgroup_size, spec.local_size, spec.block);
+			else if (jsplit)
+				std::printf("GPU:%zu Force kernel: jsplit (%u slices of the j-range)\n", i, splits);
+			else if (persistent)
+				std::printf("GPU:%zu Force kernel: persistent (%u workgroups, %u steps per dispatch)\n", i, persistent_groups, steps_per_submit[i]);
+			else
+				std::printf("GPU:%zu Force kernel: %s (%u bodies per invocation)\n", i, force_kernel_name(force_kernel[i]), spec.block);
+
+			std::printf("GPU:%zu Force law: %s, G %g, softening %g, unit scale %g\n", i, force_law_name(cli_options.force_law), cli_options.gravity, cli_options.softening, cli_options.unit_scale);
+
+			if (steps_per_submit[i] > 1 && !persistent)
+				std::printf("GPU:%zu %u steps per command buffer\n", i, steps_per_submit[i]);
+
+			if (addresses)
+				std::printf("GPU:%zu Buffers: device addresses in push constants, no descriptor set\n", i);
+
+			if (single_system)
+				std::printf("GPU:%zu Owns bodies %u to %u\n", i, owned_first[i], owned_first[i] + owned_count[i] - 1);
+		} else {
+			std::printf("GPU:%zu Force kernel: legacy\n", i);
+		}
+
+		// the reductions read the active count, which the legacy kernel does not have
+		diagnostics[i] = cli_options.diagnostics && force_kernel[i] != ForceKernel::legacy;
+		if (cli_options.diagnostics && !diagnostics[i])
+			std::printf("! GPU:%zu -diagnostics needs a two-pass kernel\n", i);
+
+		if (diagnostics[i]) {
+			const std::array<std::uint32_t, 2> reduce_spec = { static_cast<std::uint32_t>(cli_options.force_law), cli_options.diagnostics_potential ? VK_TRUE : VK_FALSE };
+
+			const std::array<VkSpecializationMapEntry, 2> reduce_spec_entries = {
+				VkSpecializationMapEntry {
+					.constantID = 2,
+					.offset = 0,
+					.size = sizeof(std::uint32_t)
+				},
+				VkSpecializationMapEntry {
+					.constantID = 3,
+					.offset = sizeof(std::uint32_t),
+					.size = sizeof(VkBool32)
+				}
+			};
+
+			const VkSpecializationInfo reduce_spec_info = {
+				.mapEntryCount = static_cast<std::uint32_t>(reduce_spec_entries.size()),
+				.pMapEntries = reduce_spec_entries.data(),
+				.dataSize = sizeof(reduce_spec),
+				.pData = reduce_spec.data()
+			};
+
+			create_compute_pipeline(funcs[i], dev[i], aux_pipeline_layout[i], nbody_reduce_code, sizeof(nbody_reduce_code), pipeline_reduce[i], &reduce_spec_info);
+			create_compute_pipeline(funcs[i], dev[i], aux_pipeline_layout[i], nbody_reduce_final_code, sizeof(nbody_reduce_final_code), pipeline_reduce_final[i]);
+			create_desc_pool_and_set(funcs[i], dev[i], aux_desc_set_layout[i], reduce_desc_pool[i], reduce_desc_set[i], aux_storage_buf_count);
+
+			create_dev_buf(allocator[i], reduce_dev_buf[i], reduce_dev_buf_alloc[i], reduce_buf_size);
+			create_host_buf(allocator[i], reduce_host_buf[i], reduce_host_buf_alloc[i], reduction[i], sizeof(Reduction));
+
+			// binding 2 is not read, it only has to be valid
+			update_aux_desc_set(funcs[i], dev[i], reduce_desc_set[i], dev_buf[i], uniform_buf[i], accel_buf[i], storage_buf_size, uniform_buf_size, sizeof(vec4), reduce_dev_buf[i], reduce_buf_size);
+			update_dispatch_desc(funcs[i], dev[i], reduce_desc_set[i], dispatch_buf[i]);
+
+			reduce_passes[i] = ReducePasses {
+				.reduce = pipeline_reduce[i],
+				.reduce_final = pipeline_reduce_final[i],
+				.pipeline_layout = aux_pipeline_layout[i],
+				.desc_set = reduce_desc_set[i],
+				.buf = reduce_dev_buf[i],
+				.host_buf = reduce_host_buf[i],
+				.group_count = static_cast<std::uint32_t>((num_particles + reduce_local_size - 1) / reduce_local_size)
+			};
+
+			std::printf("GPU:%zu Diagnostics: kinetic energy, momentum, angular momentum, center of mass%s\n", i, cli_options.diagnostics_potential ? ", potential energy" : "");
+		}
+
+		// the compute command buffers are only recorded again for the two-pass kernels
+		roi[i] = !cli_options.roi_path.empty() && force_kernel[i] != ForceKernel::legacy;
+		if (!cli_options.roi_path.empty() && !roi[i])
+			std::printf("! GPU:%zu -roi needs a two-pass kernel\n", i);
+
+		if (roi[i]) {
+			create_compute_pipeline(funcs[i], dev[i], aux_pipeline_layout[i], roi_select_code, sizeof(roi_select_code), pipeline_roi_select[i]);
+			create_compute_pipeline(funcs[i], dev[i], aux_pipeline_layout[i], roi_scan_code, sizeof(roi_scan_code), pipeline_roi_scan[i]);
+			create_compute_pipeline(funcs[i], dev[i], aux_pipeline_layout[i], roi_compact_code, sizeof(roi_compact_code), pipeline_roi_compact[i]);
+			create_desc_pool_and_set(funcs[i], dev[i], aux_desc_set_layout[i], roi_desc_pool[i], roi_desc_set[i], aux_storage_buf_count);
+
+			create_dev_buf(allocator[i], roi_dev_buf[i], roi_dev_buf_alloc[i], roi_buf_size);
+			create_dev_buf(allocator[i], roi_scan_buf[i], roi_scan_buf_alloc[i], roi_scan_buf_size);
+			create_host_buf(allocator[i], roi_host_buf[i], roi_host_buf_alloc[i], roi_data[i], roi_buf_size);
+			update_aux_desc_set(funcs[i], dev[i], roi_desc_set[i], dev_buf[i], uniform_buf[i], roi_dev_buf[i], storage_buf_size, uniform_buf_size, roi_buf_size, roi_scan_buf[i], roi_scan_buf_size);
+
+			const auto &v = cli_options.roi_values;
+			RoiParams params = {
+				.kind = cli_options.roi_kind,
+				.capacity = roi_capacity,
+				.count = 0,
+				.stored = 0,
+				.a = {},
+				.b = {}
+			};
+
+			if (params.kind == RoiKind::box) {
+				params.a = vec4 { .data = { v[0], v[1], v[2], 0.f } };
+				params.b = vec4 { .data = { v[3], v[4], v[5], 0.f } };
+			} else if (params.kind == RoiKind::sphere) {
+				params.a = vec4 { .data = { v[0], v[1], v[2], v[3] } };
+			} else {
+				params.a = vec4 { .data = { v[0], 0.f, 0.f, 0.f } };
+			}
+
+			roi_passes[i] = RoiPasses {
+				.select = pipeline_roi_select[i],
+				.scan = pipeline_roi_scan[i],
+				.compact = pipeline_roi_compact[i],
+				.pipeline_layout = aux_pipeline_layout[i],
+				.desc_set = roi_desc_set[i],
+				.buf = roi_dev_buf[i],
+				.host_buf = roi_host_buf[i],
+				.copy_size = roi_buf_size,
+				.params = params,
+				.group_count = static_cast<std::uint32_t>((num_particles + roi_local_size - 1) / roi_local_size)
+			};
+
+			const std::string roi_file_path = cli_options.roi_path + "-gpu" + std::to_string(i) + ".roi";
+			roi_file[i] = std::fopen(roi_file_path.c_str(), "wb");
+			if (roi_file[i] == nullptr)
+				throw std::runtime_error("Cannot open " + roi_file_path + "!");
+
+			std::printf("GPU:%zu Region of interest: every %llu steps, up to %u particles into %s\n", i, static_cast<unsigned long long>(cli_options.roi_interval), roi_capacity, roi_file_path.c_str());
+		}
+
+		// recorded again before each submit for the two-pass kernels, see below
+		const ForcePasses *force = force_kernel[i] != ForceKernel::legacy ? &force_passes[i] : nullptr;
+		const ReducePasses *reduce = diagnostics[i] ? &reduce_passes[i] : nullptr;
+		const StepConstants initial_constants = { .delta_time = 0.f, .step = 0 };
+
+		record_cmd_buf_work(funcs[i], compute_cmd_bufs[i][0], pipeline_attraction[i], pipeline_layout[i], desc_set[i], dev_buf[i], storage_buf_size, zero_copy[i], particles_per_workgroup, compute_queue_family_idx[i], transfer_queue_family_idx[i], force, initial_constants, reduce);
+
+		if (quantize_bits != 0) {
+			const VkSpecializationMapEntry spec_entry = {
+				.constantID = 0,
+				.offset = 0,
+				.size = sizeof(quantize_bits)
+			};
+
+			const VkSpecializationInfo spec_info = {
+				.mapEntryCount = 1,
+				.pMapEntries = &spec_entry,
+				.dataSize = sizeof(quantize_bits),
+				.pData = &quantize_bits
+			};
+
+			create_compute_pipeline(funcs[i], dev[i], aux_pipeline_layout[i], snapshot_bounds_code, sizeof(snapshot_bounds_code), pipeline_bounds[i]);
+			create_compute_pipeline(funcs[i], dev[i], aux_pipeline_layout[i], snapshot_quantize_code, sizeof(snapshot_quantize_code), pipeline_quantize[i], &spec_info);
+			create_desc_pool_and_set(funcs[i], dev[i], aux_desc_set_layout[i], quantize_desc_pool[i], quantize_desc_set[i], aux_storage_buf_count);
+
+			create_dev_buf(allocator[i], quantize_dev_buf[i], quantize_dev_buf_alloc[i], quantize_buf_size);
+			create_host_buf(allocator[i], quantize_host_buf[i], quantize_host_buf_alloc[i], quantized[i], quantize_buf_size);
+			update_aux_desc_set(funcs[i], dev[i], quantize_desc_set[i], dev_buf[i], uniform_buf[i], quantize_dev_buf[i], storage_buf_size, uniform_buf_size, quantize_buf_size);
+
+			quantize_passes[i] = QuantizePasses {
+				.bounds = pipeline_bounds[i],
+				.quantize = pipeline_quantize[i],
+				.pipeline_layout = aux_pipeline_layout[i],
+				.desc_set = quantize_desc_set[i],
+				.buf = quantize_dev_buf[i],
+				.buf_size = quantize_buf_size,
+				.particle_count = static_cast<std::uint32_t>(num_particles)
+			};
+
+			record_cmd_buf_work(funcs[i], compute_cmd_bufs[i][1], pipeline_attraction[i], pipeline_layout[i], desc_set[i], dev_buf[i], storage_buf_size, zero_copy[i], particles_per_workgroup, compute_queue_family_idx[i], transfer_queue_family_idx[i], force, initial_constants, reduce, &quantize_passes[i]);
+			record_cmd_buf_copy_quantized_to_host(funcs[i], transfer_cmd_bufs[i][2], quantize_host_buf[i], quantize_dev_buf[i], dev_buf[i], quantize_buf_size, storage_buf_size, compute_queue_family_idx[i], transfer_queue_family_idx[i]);
+		}
 
 		create_fence(funcs[i], dev[i], compute_fence[i]);
 		create_fence(funcs[i], dev[i], dev_to_host_copy_fence[i]);
@@ -1006,21 +4029,39 @@ int main(int argc, char *argv[]) {
 	}
 
 	for (std::size_t i = 0; i < physical_devs.size(); i++) {
-		printf("GPU:%zu Creating random init data...\n", i);
-		for (std::size_t j = 0; j < num_particles; j++) {
-			particles[i][j].position.components.x = dist(rng);
-			particles[i][j].position.components.y = dist(rng);
-			particles[i][j].position.components.z = dist(rng);
-			particles[i][j].position.components.w = dist(rng);
-
-			particles[i][j].velocity.components.x = dist(rng);
-			particles[i][j].velocity.components.y = dist(rng);
-			particles[i][j].velocity.components.z = dist(rng);
-			particles[i][j].velocity.components.w = dist(rng);
+		if (init_buf[i] != VK_NULL_HANDLE) {
+			// read only, nothing on the host writes the initial state
+			printf("GPU:%zu Importing init data from %s...\n", i, cli_options.init_path.c_str());
+			particles[i] = static_cast<Particle *>(init_file.data);
+		} else if (init_file.data != nullptr) {
+			printf("GPU:%zu Loading init data from %s...\n", i, cli_options.init_path.c_str());
+			std::memcpy(particles[i], init_file.data, storage_buf_size);
+		} else if (!cli_options.init_path.empty()) {
+			printf("GPU:%zu Reading init data from %s...\n", i, cli_options.init_path.c_str());
+			read_init_file(cli_options.init_path, particles[i], storage_buf_size);
+		} else if (single_system && i > 0) {
+			// one system, every device starts from the same bodies
+			printf("GPU:%zu Sharing init data with GPU:0...\n", i);
+			std::memcpy(particles[i], particles[0], storage_buf_size);
+		} else {
+			printf("GPU:%zu Creating random init data...\n", i);
+			for (std::size_t j = 0; j < num_particles; j++) {
+				particles[i][j].position.components.x = dist(rng);
+				particles[i][j].position.components.y = dist(rng);
+				particles[i][j].position.components.z = dist(rng);
+				particles[i][j].position.components.w = dist(rng);
+
+				particles[i][j].velocity.components.x = dist(rng);
+				particles[i][j].velocity.components.y = dist(rng);
+				particles[i][j].velocity.components.z = dist(rng);
+				particles[i][j].velocity.components.w = dist(rng);
+			}
 		}
 
-		// copy init data
-		{
+		// the init data went straight into dev_buf, it only has to reach the device where the memory is not coherent
+		if (zero_copy[i]) {
+			vmaFlushAllocation(allocator[i], dev_buf_alloc[i], 0, storage_buf_size);
+		} else {
 			printf("GPU:%zu Copying init data...\n", i);
 
 			const VkSubmitInfo submit_info = {
@@ -1039,7 +4080,15 @@ int main(int argc, char *argv[]) {
 				throw std::runtime_error("Cannot copy init data!");
 		}
 
-		ubo[i]->particle_count = num_particles;
+		if (cli_options.energy)
+			initial_energy[i] = nbody_total_energy(particles[i], num_particles, force_params, *cpu_pool);
+
+		// the legacy kernel has no CPU mirror, lossy snapshot steps skip the full readback
+		if (cli_options.validate_steps > 0) {
+			validate[i] = force_kernel[i] != ForceKernel::legacy && quantize_bits == 0;
+			if (!validate[i])
+				std::printf("! GPU:%zu Validation needs a two-pass kernel and no -snapshot-quantize\n", i);
+		}
 	}
 
 	printf("Enter quit to end the program.\n");
@@ -1049,36 +4098,333 @@ int main(int argc, char *argv[]) {
 			if (line == "quit") {
 				break;
 			} else if (line == "dump") {
+				// printed once particle 0 of the next step has been read back
+				for (std::size_t i = 0; i < physical_devs.size(); i++)
+					dump_pending[i] = true;
+			}
+		}
+
+		// -multi-gpu steps every device at once, after the owned ranges have been gathered
+		if (single_system) {
+			bool all_ready = true;
+
+			for (std::size_t i = 0; i < physical_devs.size(); i++) {
+				if (!device_ready[i]) {
+					const auto compute_fence_status = funcs[i].vkGetFenceStatus(dev[i], compute_fence[i]);
+					const auto dev_to_host_copy_fence_status = funcs[i].vkGetFenceStatus(dev[i], dev_to_host_copy_fence[i]);
+
+					if (compute_fence_status == VK_SUCCESS && dev_to_host_copy_fence_status == VK_SUCCESS) {
+						device_ready[i] = true;
+						end_time[i] = std::chrono::high_resolution_clock::now();
+					} else if (compute_fence_status == VK_ERROR_DEVICE_LOST || dev_to_host_copy_fence_status == VK_ERROR_DEVICE_LOST) {
+						throw std::runtime_error("Failed to query device fence status!");
+					}
+				}
+
+				all_ready = all_ready && device_ready[i];
+			}
+
+			if (!all_ready)
+				continue;
+
+			// every device read back the range it owns into its own host_buf, the initial state is
+			// already everywhere. host_particles, the -init mapping particles may still point to is read only
+			if (!wait_for_copy[0]) {
+				for (std::size_t j = 0; j < physical_devs.size(); j++) {
+					for (std::size_t i = 0; i < physical_devs.size(); i++) {
+						if (i != j)
+							std::memcpy(host_particles[i] + owned_first[j], host_particles[j] + owned_first[j], sizeof(Particle) * owned_count[j]);
+					}
+				}
+
+				gather_bytes += storage_buf_size * (physical_devs.size() - 1);
+			}
+
+			// the bodies that drifted out of a device's region swap into the range of the one they are in
+			// now. only their slots change, they go to the other host_bufs and, on top of the foreign
+			// ranges every device takes anyway, into the owned range of the device they arrive on
+			if (morton && !wait_for_copy[0] && (step[0] + steps_per_submit[0]) % cli_options.decompose_interval == 0) {
+				const std::size_t migrated = domain_reorder_morton(host_particles[0], num_particles, domain_order, owned_first, moved_slots);
+				const std::vector<ReadbackRange> moved = slot_ranges(moved_slots);
+
+				std::uint64_t moved_bytes = 0;
+				for (const auto &range : moved) {
+					for (std::size_t i = 1; i < physical_devs.size(); i++)
+						std::memcpy(reinterpret_cast<unsigned char *>(host_particles[i]) + range.offset, reinterpret_cast<const unsigned char *>(host_particles[0]) + range.offset, range.size);
+
+					moved_bytes += range.size;
+				}
+
+				for (std::size_t i = 0; i < physical_devs.size() && migrated > 0; i++) {
+					const std::uint64_t owned_begin = sizeof(Particle) * owned_first[i];
+					const std::uint64_t owned_end = sizeof(Particle) * (owned_first[i] + owned_count[i]);
+
+					std::vector<ReadbackRange> ranges = foreign_ranges(i, owned_first, owned_count, storage_buf_size);
+					for (const auto &range : moved) {
+						const std::uint64_t begin = std::max(range.offset, owned_begin);
+						const std::uint64_t end = std::min(range.offset + range.size, owned_end);
+						if (begin < end)
+							ranges.push_back(ReadbackRange { .offset = begin, .size = end - begin });
+					}
+
+					record_cmd_buf_copy_host_to_dev(funcs[i], transfer_cmd_bufs[i][4], host_buf[i], dev_buf[i], storage_buf_size, ranges, compute_queue_family_idx[i], transfer_queue_family_idx[i]);
+					reupload[i] = true;
+				}
+
+				// the copies into the other host_bufs and the uploads into the owned ranges
+				gather_bytes += moved_bytes * physical_devs.size();
+
+				std::printf("Decomposition: Step:%llu Migrated:%zu (%.02f%%)\n", static_cast<unsigned long long>(step[0] + steps_per_submit[0]), migrated, 100.0 * migrated / num_particles);
+			}
+
+			const auto now = std::chrono::high_resolution_clock::now();
+			system_delta_time = std::chrono::duration_cast<std::chrono::duration<float>>(now - system_start).count();
+			system_start = now;
+
+			if (!wait_for_copy[0]) {
+				for (std::size_t i = 0; i < physical_devs.size(); i++)
+					busy_time[i] += std::chrono::duration_cast<std::chrono::duration<float>>(end_time[i] - start_time[i]).count();
+
+				system_duration += system_delta_time;
+				system_mean_sample += system_delta_time;
+				system_samples++;
+
+				if (balance && !balance_discard) {
+					for (std::size_t i = 0; i < physical_devs.size(); i++)
+						balance_busy[i] += std::chrono::duration_cast<std::chrono::duration<double>>(end_time[i] - start_time[i]).count();
+					balance_samples++;
+				}
+
+				balance_discard = false;
+			}
+
+			// the shares only move when the measured imbalance is past the threshold and the new ones
+			// are expected to take off at least half of it, so timing noise does not shuffle bodies
+			if (balance && balance_samples == balance_window) {
+				std::vector<double> busy(physical_devs.size());
 				for (std::size_t i = 0; i < physical_devs.size(); i++) {
-					std::printf("GPU:%zu Particle:0 Position:%.2f %.2f %.2f Velocity:%.2f %.2f %.2f %.2f\n",
-						i,
-						particles[i][0].position.components.x,
-						particles[i][0].position.components.y,
-						particles[i][0].position.components.z,
-						particles[i][0].velocity.components.x,
-						particles[i][0].velocity.components.y,
-						particles[i][0].velocity.components.z,
-						particles[i][0].velocity.components.w
-					);
+					busy[i] = balance_busy[i] / balance_samples;
+					balance_busy[i] = 0.0;
+				}
+
+				balance_samples = 0;
+
+				const double threshold = cli_options.balance_threshold / 100.0;
+				const double imbalance = domain_imbalance(busy);
+
+				if (imbalance > threshold) {
+					const std::uint32_t min_count = static_cast<std::uint32_t>(std::max<std::size_t>(1, num_particles / physical_devs.size() / balance_min_share));
+					const std::vector<std::uint32_t> shares = domain_balance(owned_count, busy, num_particles, min_count);
+
+					std::vector<double> expected(physical_devs.size());
+					for (std::size_t i = 0; i < physical_devs.size(); i++)
+						expected[i] = busy[i] * shares[i] / owned_count[i];
+
+					const double expected_imbalance = domain_imbalance(expected);
+
+					if (imbalance - expected_imbalance > threshold / 2.0) {
+						for (std::size_t i = 0; i < physical_devs.size(); i++) {
+							owned_first[i] = i == 0 ? 0 : owned_first[i - 1] + owned_count[i - 1];
+							owned_count[i] = shares[i];
+						}
+
+						// every device is idle and every host_buf holds the whole system, which goes up
+						// again with the next submit since a device's new range may not have been its own
+						for (std::size_t i = 0; i < physical_devs.size(); i++) {
+							force_passes[i].owned_first = owned_first[i];
+							force_passes[i].owned_count = owned_count[i];
+							record_cmd_buf_copy_host_to_dev(funcs[i], transfer_cmd_bufs[i][4], host_buf[i], dev_buf[i], storage_buf_size, { ReadbackRange { .offset = 0, .size = storage_buf_size } }, compute_queue_family_idx[i], transfer_queue_family_idx[i]);
+							record_owned_range_uploads(funcs[i], i, owned_first, owned_count, split ? transfer_cmd_bufs[i][3] : VK_NULL_HANDLE, ring_upload_cmd_bufs[i], host_buf[i], dev_buf[i], storage_buf_size, compute_queue_family_idx[i], transfer_queue_family_idx[i]);
+						}
+
+						std::fill(reupload.begin(), reupload.end(), true);
+
+						std::printf("Rebalance: Step:%llu Imbalance:%.01f%% ExpectedImbalance:%.01f%% Shares:", static_cast<unsigned long long>(step[0] + steps_per_submit[0]), 100.0 * imbalance, 100.0 * expected_imbalance);
+						for (std::size_t i = 0; i < physical_devs.size(); i++)
+							std::printf(" GPU:%zu:%u", i, owned_count[i]);
+						std::printf("\n");
+					}
+				}
+			}
+
+			if (system_duration >= 10.f) {
+				system_duration = 0.f;
+
+				// each device's own rate over the same submits says how long the system would take if
+				// the gather were free and nobody waited on the slowest device
+				double rate = 0.0, busy_max = 0.0, busy_sum = 0.0;
+				for (std::size_t i = 0; i < physical_devs.size(); i++) {
+					const double busy = busy_time[i] / system_samples;
+					rate += owned_count[i] / busy;
+					busy_max = std::max(busy_max, busy);
+					busy_sum += busy;
+					busy_time[i] = 0.f;
 				}
+
+				const double submit_time = system_mean_sample / system_samples;
+				const double avg_dt = submit_time / cli_options.steps_per_submit;
+				const double efficiency = num_particles / rate / submit_time;
+				const double imbalance = busy_max / (busy_sum / physical_devs.size()) - 1.0;
+
+				const auto t = time(NULL);
+				const std::tm* timest = std::localtime(&t);
+
+				std::printf("Date:%d-%02d-%02d Time:%02d:%02d:%02d MultiGPU:%s Devices:%zu AverageTime:%.04f sec AverageSimulationsPerSec:%.02f GInteractions/s:%.02f ScalingEfficiency:%.01f%% Imbalance:%.01f%% GatherMB:%.02f\n", 1900 + timest->tm_year, 1 + timest->tm_mon, timest->tm_mday, timest->tm_hour, timest->tm_min, timest->tm_sec, multi_gpu_name(cli_options.multi_gpu), physical_devs.size(), avg_dt, 1.0/avg_dt, static_cast<double>(num_particles) * num_particles / avg_dt / 1e9, 100.0 * efficiency, 100.0 * imbalance, static_cast<double>(gather_bytes) / (1024.0 * 1024.0));
+
+				system_mean_sample = 0.f;
+				system_samples = 0;
+				gather_bytes = 0;
 			}
+
+			std::fill(device_ready.begin(), device_ready.end(), false);
 		}
 
 		for (std::size_t i = 0; i < physical_devs.size(); i++) {
 			const auto compute_fence_status = funcs[i].vkGetFenceStatus(dev[i], compute_fence[i]);
-			const auto dev_to_host_copy_fence_status = funcs[i].vkGetFenceStatus(dev[i], dev_to_host_copy_fence[i]);
+			// zero-copy never submits the copy, its fence stays signalled from creation
+			const auto dev_to_host_copy_fence_status = zero_copy[i] ? VK_SUCCESS : funcs[i].vkGetFenceStatus(dev[i], dev_to_host_copy_fence[i]);
 
 			if (compute_fence_status == VK_SUCCESS && dev_to_host_copy_fence_status == VK_SUCCESS) {
 				if (funcs[i].vkResetFences(dev[i], 1, &compute_fence[i]) != VK_SUCCESS)
 					throw std::runtime_error("Failed to reset compute fence!");
 
-				if (funcs[i].vkResetFences(dev[i], 1, &dev_to_host_copy_fence[i]) != VK_SUCCESS)
+				if (!zero_copy[i] && funcs[i].vkResetFences(dev[i], 1, &dev_to_host_copy_fence[i]) != VK_SUCCESS)
 					throw std::runtime_error("Failed to reset compute fence!");
 
-				end_time[i] = std::chrono::high_resolution_clock::now();
-				const auto delta_time = std::chrono::duration_cast<std::chrono::duration<float>>(end_time[i] - start_time[i]).count();
+				// with -multi-gpu end_time is already set, and every device steps by the time since the last lock-step submit
+				if (!single_system)
+					end_time[i] = std::chrono::high_resolution_clock::now();
+				const auto delta_time = single_system ? system_delta_time : std::chrono::duration_cast<std::chrono::duration<float>>(end_time[i] - start_time[i]).count();
+
+				// -multi-gpu reports the one system from GPU 0, host_buf holds all of it after the gather
+				const bool reports = !single_system || i == 0;
+
+				// host_buf holds the requested ranges of the state after the step that just finished until the next DEV->HOST copy is submitted
+				if (!wait_for_copy[i])
+					step[i] += steps_per_submit[i];
+
+				// the HOST->DEV copy is long done and host_buf has been written, drop the imported initial conditions
+				if (!wait_for_copy[i] && init_buf[i] != VK_NULL_HANDLE) {
+					particles[i] = host_particles[i];
+					funcs[i].vkDestroyBuffer(dev[i], init_buf[i], nullptr);
+					funcs[i].vkFreeMemory(dev[i], init_buf_mem[i], nullptr);
+					init_buf[i] = VK_NULL_HANDLE;
+					init_buf_mem[i] = VK_NULL_HANDLE;
+				}
+
+				// with zero-copy every consumer reads dev_buf directly, nothing is planned or copied
+				if (zero_copy[i] && !wait_for_copy[i])
+					vmaInvalidateAllocation(allocator[i], dev_buf_alloc[i], 0, storage_buf_size);
+
+				if (!wait_for_copy[i] && !readback_plan[i].empty()) {
+					readback_count[i]++;
+					readback_bytes[i] += readback_plan[i].bytes();
+				}
+
+				if (reports && dump_pending[i] && (wait_for_copy[i] || zero_copy[i] || single_system || readback_plan[i].wants(ReadbackConsumer::dump))) {
+					// body 0 may have been reordered to another slot
+					const Particle &body = particles[i][morton ? domain_order.slot[0] : 0];
+
+					std::printf("GPU:%zu Particle:0 Position:%.2f %.2f %.2f Velocity:%.2f %.2f %.2f %.2f\n",
+						i,
+						body.position.components.x,
+						body.position.components.y,
+						body.position.components.z,
+						body.velocity.components.x,
+						body.velocity.components.y,
+						body.velocity.components.z,
+						body.velocity.components.w
+					);
+
+					dump_pending[i] = false;
+				}
+
+				if (energy_pending[i] && (zero_copy[i] || single_system || readback_plan[i].wants(ReadbackConsumer::energy))) {
+					const double energy = nbody_total_energy(particles[i], num_particles, force_params, *cpu_pool);
+					std::printf("GPU:%zu Step:%llu Energy:%.6e EnergyDrift:%.3e\n", i, static_cast<unsigned long long>(step[i]), energy, (energy - initial_energy[i]) / std::abs(initial_energy[i]));
+
+					energy_pending[i] = false;
+				}
+
+				if (roi_in_flight[i]) {
+					RoiParams params;
+					std::memcpy(&params, roi_data[i], sizeof(params));
+
+					const RoiRecordHeader header = {
+						.magic = { 'N', 'B', 'O', 'D', 'Y', 'R', 'O', 'I' },
+						.device = static_cast<std::uint32_t>(i),
+						.count = params.count,
+						.stored = params.stored,
+						.reserved = 0,
+						.step = step[i],
+						.sim_time = sim_time[i]
+					};
+
+					std::fwrite(&header, sizeof(header), 1, roi_file[i]);
+					std::fwrite(roi_data[i] + sizeof(RoiParams), sizeof(RoiParticle), params.stored, roi_file[i]);
+
+					roi_selected[i] = params.count;
+					roi_pending[i] = false;
+					roi_in_flight[i] = false;
+				}
+
+				// the reductions ran at the end of the same submit, the result stays put until the next one
+				if (diagnostics[i] && !wait_for_copy[i] && !has_initial_reduction[i]) {
+					initial_reduction[i] = *reduction[i];
+					has_initial_reduction[i] = true;
+				}
+
+				// the CPU mirror ran the step that just finished with the same delta_time
+				if (validate[i] && step[i] <= cli_options.validate_steps) {
+					if (step[i] == 0) {
+						cpu_particles[i].assign(particles[i], particles[i] + num_particles);
+						cpu_position_lo[i].assign(precision[i] == Precision::ds ? num_particles : 0, vec4 {});
+					} else {
+						// the mirror is fp32 under fp16, so the difference is what the half positions cost
+						const NbodyDifference diff = nbody_max_difference(particles[i], cpu_particles[i].data(), num_particles);
+						const Precision reference = precision[i] == Precision::ds ? Precision::ds : Precision::fp32;
+						std::printf("GPU:%zu Validate Step:%llu Precision:%s Reference:%s MaxPositionDiff:%.3e MaxVelocityDiff:%.3e\n", i, static_cast<unsigned long long>(step[i]), precision_name(precision[i]), precision_name(reference), diff.position, diff.velocity);
+					}
+				}
+
+				// lossy snapshots are taken from the step that ran the quantize passes, there is none for the initial state
+				const bool snapshot_due = quantize_bits != 0 ? quantize_in_flight[i] : step[i] % cli_options.snapshot_interval == 0;
+
+				if (snapshot_writer && snapshot_due && reports) {
+					SnapshotBuffer *snapshot = snapshot_writer->acquire();
+
+					if (snapshot != nullptr) {
+						snapshot->device = i;
+						snapshot->step = step[i];
+						snapshot->sim_time = sim_time[i];
+						snapshot->particle_count = static_cast<std::uint32_t>(num_particles);
+
+						// the trajectory keeps every body at its own index
+						if (quantize_bits != 0) {
+							std::memcpy(snapshot->quantized.data(), quantized[i], quantize_buf_size);
+						} else if (morton) {
+							for (std::size_t b = 0; b < num_particles; b++)
+								snapshot->particles[domain_order.body[b]] = particles[i][b];
+						} else {
+							std::memcpy(snapshot->particles.data(), particles[i], storage_buf_size);
+						}
+
+						snapshot_writer->submit(snapshot);
+					}
+				}
 
+				// only the legacy kernel still reads delta_time from the UBO, it is not in flight here
 				ubo[i]->delta_time = delta_time;
+
+				// the steps of a submit split its delta_time between them
+				const float step_delta_time = delta_time / static_cast<float>(steps_per_submit[i]);
+
+				if (validate[i] && step[i] < cli_options.validate_steps) {
+					for (std::uint32_t s = 0; s < steps_per_submit[i]; s++)
+						nbody_cpu_step(cpu_particles[i].data(), cpu_position_lo[i].empty() ? nullptr : cpu_position_lo[i].data(), num_particles, step_delta_time, force_params, *cpu_pool);
+				}
+
+				sim_time[i] += delta_time;
 				duration[i] += delta_time;
 				mean_sample[i] += delta_time;
 				num_samples[i]++;
@@ -1088,21 +4434,116 @@ int main(int argc, char *argv[]) {
 
 					const auto t = time(NULL);
 					const std::tm* timest = std::localtime(&t);
-					const float avg_dt = mean_sample[i] / num_samples[i];
+					const float avg_dt = mean_sample[i] / num_samples[i] / static_cast<float>(steps_per_submit[i]);
+					const int submits = num_samples[i];
 					mean_sample[i] = 0.f;
 					num_samples[i] = 0;
 
-					std::printf("Date:%d-%02d-%02d Time:%02d:%02d:%02d GPU:%zu AverageTime:%.04f sec AverageSimulationsPerSec:%.02f\n", 1900 + timest->tm_year, 1 + timest->tm_mon, timest->tm_mday, timest->tm_hour, timest->tm_min, timest->tm_sec, i, avg_dt, 1.f/avg_dt);
+					std::printf("Date:%d-%02d-%02d Time:%02d:%02d:%02d GPU:%zu AverageTime:%.04f sec AverageSimulationsPerSec:%.02f", 1900 + timest->tm_year, 1 + timest->tm_mon, timest->tm_mday, timest->tm_hour, timest->tm_min, timest->tm_sec, i, avg_dt, 1.f/avg_dt);
+					std::printf(" Precision:%s GInteractions/s:%.02f", precision_name(precision[i]), static_cast<double>(owned_count[i]) * num_particles / avg_dt / 1e9);
+
+					if (!zero_copy[i])
+						std::printf(" Readbacks:%d/%d ReadbackMB:%.02f", readback_count[i], submits, static_cast<double>(readback_bytes[i]) / (1024.0 * 1024.0));
+					readback_count[i] = 0;
+					readback_bytes[i] = 0;
+
+					if (roi[i])
+						std::printf(" ROISelected:%u", roi_selected[i]);
+
+					// the state of this step was most likely not read back, the energy gets its own line
+					// once the next step has been. the device sits idle meanwhile
+					if (cli_options.energy && reports)
+						energy_pending[i] = true;
+
+					if (diagnostics[i] && has_initial_reduction[i]) {
+						const Reduction &now = *reduction[i];
+						const Reduction &initial = initial_reduction[i];
+
+						if (cli_options.diagnostics_potential) {
+							const double energy = static_cast<double>(now.kinetic) + now.potential;
+							const double initial_energy = static_cast<double>(initial.kinetic) + initial.potential;
+							std::printf(" GPUEnergy:%.6e GPUEnergyDrift:%.3e", energy, (energy - initial_energy) / std::abs(initial_energy));
+						} else {
+							std::printf(" KineticEnergy:%.6e", now.kinetic);
+						}
+
+						std::printf(" MomentumDrift:%.3e AngularMomentumDrift:%.3e CenterOfMassDrift:%.3e", vec3_distance(now.momentum, initial.momentum), vec3_distance(now.angular_momentum, initial.angular_momentum), vec3_distance(now.center_of_mass, initial.center_of_mass));
+					}
+
+					// -multi-gpu writes the one system from GPU 0, the writer only knows that device
+					if (snapshot_writer && reports) {
+						const SnapshotStats snapshot_stats = snapshot_writer->get_stats(i);
+						std::printf(" SnapshotWriteMB/s:%.02f SnapshotQueue:%zu/%zu SnapshotsWritten:%llu SnapshotsFailed:%llu SnapshotsDropped:%llu", snapshot_stats.mb_per_sec, snapshot_stats.queue_depth, snapshot_stats.queue_capacity, static_cast<unsigned long long>(snapshot_stats.written), static_cast<unsigned long long>(snapshot_stats.failed), static_cast<unsigned long long>(snapshot_stats.dropped));
+						if (cli_options.snapshot_compress || quantize_bits != 0)
+							std::printf(" SnapshotRatio:%.02f SnapshotEncodeMB/s:%.02f", snapshot_stats.compression_ratio, snapshot_stats.encode_mb_per_sec);
+					}
+
+					std::printf("\n");
+				}
+
+				// the steps about to be submitted end at step[i] + steps_per_submit[i]
+				quantize_in_flight[i] = quantize_bits != 0 && (step[i] + steps_per_submit[i]) % cli_options.snapshot_interval == 0;
+
+				// a selection that lands on a lossy snapshot step waits for the next one, both go through
+				// the transfer queue and the snapshot has its own copy command buffer
+				if (roi[i] && (step[i] + steps_per_submit[i]) % cli_options.roi_interval == 0)
+					roi_pending[i] = true;
+
+				roi_in_flight[i] = roi_pending[i] && !quantize_in_flight[i];
+
+				// the consumers ask for the parts of dev_buf they need after the steps about to be submitted.
+				// a lossy snapshot step copies the quantized buffer instead, dump and energy wait a step
+				readback_plan[i].clear();
+				if (single_system) {
+					// the consumers read the gathered host_buf, dev_buf stays with the transfer queue for the HOST->DEV copy
+					readback_plan[i].request(ReadbackConsumer::gather, sizeof(Particle) * owned_first[i], sizeof(Particle) * owned_count[i]);
+					record_cmd_buf_copy_dev_to_host(funcs[i], transfer_cmd_bufs[i][1], host_buf[i], dev_buf[i], storage_buf_size, readback_plan[i].ranges(), compute_queue_family_idx[i], transfer_queue_family_idx[i], nullptr, false);
+				} else if (!zero_copy[i] && !quantize_in_flight[i]) {
+					if (snapshot_writer && quantize_bits == 0 && (step[i] + steps_per_submit[i]) % cli_options.snapshot_interval == 0)
+						readback_plan[i].request(ReadbackConsumer::snapshot, 0, storage_buf_size);
+
+					if (validate[i] && step[i] < cli_options.validate_steps)
+						readback_plan[i].request(ReadbackConsumer::validate, 0, storage_buf_size);
+
+					if (dump_pending[i])
+						readback_plan[i].request(ReadbackConsumer::dump, 0, sizeof(Particle));
+
+					if (energy_pending[i])
+						readback_plan[i].request(ReadbackConsumer::energy, 0, storage_buf_size);
+
+					// the copy fence has signalled as well
+					record_cmd_buf_copy_dev_to_host(funcs[i], transfer_cmd_bufs[i][1], host_buf[i], dev_buf[i], storage_buf_size, readback_plan[i].ranges(), compute_queue_family_idx[i], transfer_queue_family_idx[i], roi_in_flight[i] ? &roi_passes[i] : nullptr);
+				}
+
+				// the compute fence has signalled, so the command buffer is free to record again
+				if (ring) {
+					const StepConstants constants = {
+						.delta_time = step_delta_time,
+						.step = static_cast<std::uint32_t>(step[i] + 1)
+					};
+
+					const std::size_t stages = ring_cmd_bufs[i].size();
+					for (std::size_t s = 0; s < stages; s++) {
+						const std::size_t block = (i + stages - s) % stages;
+						record_cmd_buf_ring_stage(funcs[i], ring_cmd_bufs[i][s], force_passes[i], constants, static_cast<std::uint32_t>(s), static_cast<std::uint32_t>(stages), owned_first[block], owned_count[block]);
+					}
+				} else if (force_kernel[i] != ForceKernel::legacy) {
+					const StepConstants constants = {
+						.delta_time = step_delta_time,
+						.step = static_cast<std::uint32_t>(step[i] + 1)
+					};
+
+					record_cmd_buf_work(funcs[i], compute_cmd_bufs[i][quantize_in_flight[i] ? 1 : 0], pipeline_attraction[i], pipeline_layout[i], desc_set[i], dev_buf[i], storage_buf_size, zero_copy[i], particles_per_workgroup, compute_queue_family_idx[i], transfer_queue_family_idx[i], &force_passes[i], constants, diagnostics[i] ? &reduce_passes[i] : nullptr, quantize_in_flight[i] ? &quantize_passes[i] : nullptr, roi_in_flight[i] ? &roi_passes[i] : nullptr);
 				}
 
 				const VkSubmitInfo compute_submit_info = {
 					.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
 					.pNext = nullptr,
-					.waitSemaphoreCount = 1u,
-					.pWaitSemaphores = wait_for_copy[i] ? &copy_host_to_dev_semaphore[i] : &copy_dev_to_host_semaphore[i],
-					.pWaitDstStageMask = &wait_stage_transfer,
+					.waitSemaphoreCount = zero_copy[i] ? 0u : 1u,
+					.pWaitSemaphores = wait_for_copy[i] || single_system ? &copy_host_to_dev_semaphore[i] : &copy_dev_to_host_semaphore[i],
+					.pWaitDstStageMask = transfer_queue_family_idx[i] != compute_queue_family_idx[i] ? &wait_stage_transfer : &wait_stage_shared,
 					.commandBufferCount = 1u,
-					.pCommandBuffers = &compute_cmd_bufs[i][0],
+					.pCommandBuffers = &compute_cmd_bufs[i][quantize_in_flight[i] ? 1 : 0],
 					.signalSemaphoreCount = 1u,
 					.pSignalSemaphores = &compute_fin_semaphore[i]
 				};
@@ -1112,21 +4553,82 @@ int main(int argc, char *argv[]) {
 					.pNext = nullptr,
 					.waitSemaphoreCount = 1u,
 					.pWaitSemaphores = &compute_fin_semaphore[i],
-					.pWaitDstStageMask = &wait_stage_compute,
+					.pWaitDstStageMask = transfer_queue_family_idx[i] != compute_queue_family_idx[i] ? &wait_stage_compute : &wait_stage_shared,
 					.commandBufferCount = 1u,
-					.pCommandBuffers = &transfer_cmd_bufs[i][1],
+					.pCommandBuffers = &transfer_cmd_bufs[i][quantize_in_flight[i] ? 2 : 1],
 					.signalSemaphoreCount = 1u,
 					.pSignalSemaphores = &copy_dev_to_host_semaphore[i]
 				};
 
+				// the other devices' ranges go in once the DEV->HOST copy they were gathered next to is done,
+				// with the slots a reorder moved in or all of host_buf after a repartition
+				const VkSubmitInfo gather_submit_info = {
+					.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+					.pNext = nullptr,
+					.waitSemaphoreCount = 1u,
+					.pWaitSemaphores = &copy_dev_to_host_semaphore[i],
+					.pWaitDstStageMask = &wait_stage_transfer,
+					.commandBufferCount = 1u,
+					.pCommandBuffers = &transfer_cmd_bufs[i][reupload[i] ? 4 : 3],
+					.signalSemaphoreCount = 1u,
+					.pSignalSemaphores = &copy_host_to_dev_semaphore[i]
+				};
+
+				// the ring uploads its j-blocks one after the other, each stage waits only for its own so the
+				// force pass on one block runs while the next one is in flight. the first step and the one
+				// after a reorder or a repartition take them in one upload
+				const bool whole_system = wait_for_copy[i] || reupload[i];
+				std::vector<VkSubmitInfo> ring_upload_submit_infos, ring_submit_infos;
+				if (ring) {
+					for (std::size_t s = 0; s < ring_cmd_bufs[i].size(); s++) {
+						if (s > 0) {
+							ring_upload_submit_infos.push_back(VkSubmitInfo {
+								.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+								.pNext = nullptr,
+								.waitSemaphoreCount = s == 1 ? 1u : 0u,
+								.pWaitSemaphores = &copy_dev_to_host_semaphore[i],
+								.pWaitDstStageMask = &wait_stage_transfer,
+								.commandBufferCount = 1u,
+								.pCommandBuffers = &ring_upload_cmd_bufs[i][s - 1],
+								.signalSemaphoreCount = 1u,
+								.pSignalSemaphores = &ring_semaphore[i][s - 1]
+							});
+						}
+
+						ring_submit_infos.push_back(VkSubmitInfo {
+							.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+							.pNext = nullptr,
+							.waitSemaphoreCount = (s == 0) == whole_system ? 1u : 0u,
+							.pWaitSemaphores = s == 0 ? &copy_host_to_dev_semaphore[i] : &ring_semaphore[i][s - 1],
+							.pWaitDstStageMask = s == 0 ? &wait_stage_shared : &wait_stage_compute,
+							.commandBufferCount = 1u,
+							.pCommandBuffers = &ring_cmd_bufs[i][s],
+							.signalSemaphoreCount = s + 1 == ring_cmd_bufs[i].size() ? 1u : 0u,
+							.pSignalSemaphores = &compute_fin_semaphore[i]
+						});
+					}
+				}
+
 				start_time[i] = std::chrono::high_resolution_clock::now();
-				if (funcs[i].vkQueueSubmit(compute_queue[i], 1, &compute_submit_info, compute_fence[i]) != VK_SUCCESS)
+				if ((split || reupload[i]) && !wait_for_copy[i] && funcs[i].vkQueueSubmit(transfer_queue[i], 1, &gather_submit_info, VK_NULL_HANDLE) != VK_SUCCESS)
+					throw std::runtime_error("Failed to submit HOST->DEV copy!");
+
+				if (ring && !whole_system && funcs[i].vkQueueSubmit(transfer_queue[i], static_cast<std::uint32_t>(ring_upload_submit_infos.size()), ring_upload_submit_infos.data(), VK_NULL_HANDLE) != VK_SUCCESS)
+					throw std::runtime_error("Failed to submit HOST->DEV copy!");
+
+				if (ring) {
+					if (funcs[i].vkQueueSubmit(compute_queue[i], static_cast<std::uint32_t>(ring_submit_infos.size()), ring_submit_infos.data(), compute_fence[i]) != VK_SUCCESS)
+						throw std::runtime_error("Failed to submit work!");
+				} else if (funcs[i].vkQueueSubmit(compute_queue[i], 1, &compute_submit_info, compute_fence[i]) != VK_SUCCESS) {
 					throw std::runtime_error("Failed to submit work!");
+				}
 
-				if (funcs[i].vkQueueSubmit(transfer_queue[i], 1, &transfer_submit_info, dev_to_host_copy_fence[i]) != VK_SUCCESS)
+				if (!zero_copy[i] && funcs[i].vkQueueSubmit(transfer_queue[i], 1, &transfer_submit_info, dev_to_host_copy_fence[i]) != VK_SUCCESS)
 					throw std::runtime_error("Failed to submit DEV->CPU copy!");
 
+				balance_discard = balance_discard || reupload[i];
 				wait_for_copy[i] = false;
+				reupload[i] = false;
 			} else if (compute_fence_status == VK_ERROR_DEVICE_LOST || dev_to_host_copy_fence_status == VK_ERROR_DEVICE_LOST) {
 				throw std::runtime_error("Failed to query device fence status!");
 			}
@@ -1139,10 +4641,20 @@ int main(int argc, char *argv[]) {
 		funcs[i].vkDeviceWaitIdle(dev[i]);
 	}
 
+	// flushes the queued snapshots and joins the writer thread
+	snapshot_writer.reset();
+
+	for (auto file : roi_file) {
+		if (file != nullptr)
+			std::fclose(file);
+	}
+
 	for (std::size_t i = 0; i < physical_devs.size(); i++) {
 		funcs[i].vkDestroySemaphore(dev[i], copy_host_to_dev_semaphore[i], nullptr);
 		funcs[i].vkDestroySemaphore(dev[i], copy_dev_to_host_semaphore[i], nullptr);
 		funcs[i].vkDestroySemaphore(dev[i], compute_fin_semaphore[i], nullptr);
+		for (auto semaphore : ring_semaphore[i])
+			funcs[i].vkDestroySemaphore(dev[i], semaphore, nullptr);
 		funcs[i].vkDestroyFence(dev[i], compute_fence[i], nullptr);
 		funcs[i].vkDestroyFence(dev[i], dev_to_host_copy_fence[i], nullptr);
 		funcs[i].vkDestroyCommandPool(dev[i], compute_cmd_pool[i], nullptr);
@@ -1151,8 +4663,49 @@ int main(int argc, char *argv[]) {
 
 	for (std::size_t i = 0; i < physical_devs.size(); i++) {
 		vmaDestroyBuffer(allocator[i], uniform_buf[i], uniform_buf_alloc[i]);
-		vmaDestroyBuffer(allocator[i], host_buf[i], host_buf_alloc[i]);
+		if (host_buf_mem[i] != VK_NULL_HANDLE) {
+			funcs[i].vkDestroyBuffer(dev[i], host_buf[i], nullptr);
+			funcs[i].vkFreeMemory(dev[i], host_buf_mem[i], nullptr);
+			hugepage_free(hugepage_buf[i], hugepage_size[i]);
+		} else if (!zero_copy[i]) {
+			vmaDestroyBuffer(allocator[i], host_buf[i], host_buf_alloc[i]);
+		}
+
+		if (init_buf[i] != VK_NULL_HANDLE) {
+			funcs[i].vkDestroyBuffer(dev[i], init_buf[i], nullptr);
+			funcs[i].vkFreeMemory(dev[i], init_buf_mem[i], nullptr);
+		}
+
 		vmaDestroyBuffer(allocator[i], dev_buf[i], dev_buf_alloc[i]);
+
+		if (force_kernel[i] != ForceKernel::legacy) {
+			vmaDestroyBuffer(allocator[i], accel_buf[i], accel_buf_alloc[i]);
+			vmaDestroyBuffer(allocator[i], dispatch_buf[i], dispatch_buf_alloc[i]);
+		}
+
+		if (force_kernel[i] == ForceKernel::persistent)
+			vmaDestroyBuffer(allocator[i], grid_buf[i], grid_buf_alloc[i]);
+
+		if (precision[i] == Precision::fp16)
+			vmaDestroyBuffer(allocator[i], half_buf[i], half_buf_alloc[i]);
+		else if (precision[i] == Precision::ds)
+			vmaDestroyBuffer(allocator[i], position_lo_buf[i], position_lo_buf_alloc[i]);
+
+		if (diagnostics[i]) {
+			vmaDestroyBuffer(allocator[i], reduce_host_buf[i], reduce_host_buf_alloc[i]);
+			vmaDestroyBuffer(allocator[i], reduce_dev_buf[i], reduce_dev_buf_alloc[i]);
+		}
+
+		if (roi[i]) {
+			vmaDestroyBuffer(allocator[i], roi_host_buf[i], roi_host_buf_alloc[i]);
+			vmaDestroyBuffer(allocator[i], roi_scan_buf[i], roi_scan_buf_alloc[i]);
+			vmaDestroyBuffer(allocator[i], roi_dev_buf[i], roi_dev_buf_alloc[i]);
+		}
+
+		if (quantize_bits != 0) {
+			vmaDestroyBuffer(allocator[i], quantize_host_buf[i], quantize_host_buf_alloc[i]);
+			vmaDestroyBuffer(allocator[i], quantize_dev_buf[i], quantize_dev_buf_alloc[i]);
+		}
 	}
 
 	for (std::size_t i = 0; i < physical_devs.size(); i++) {
@@ -1160,6 +4713,42 @@ int main(int argc, char *argv[]) {
 		funcs[i].vkDestroyPipeline(dev[i], pipeline_attraction[i], nullptr);
 		funcs[i].vkDestroyPipelineLayout(dev[i], pipeline_layout[i], nullptr);
 		funcs[i].vkDestroyDescriptorSetLayout(dev[i], desc_set_layout[i], nullptr);
+
+		if (force_kernel[i] != ForceKernel::legacy) {
+			funcs[i].vkDestroyDescriptorPool(dev[i], force_desc_pool[i], nullptr);
+			funcs[i].vkDestroyPipeline(dev[i], pipeline_force[i], nullptr);
+			funcs[i].vkDestroyPipeline(dev[i], pipeline_integrate[i], nullptr);
+			funcs[i].vkDestroyPipeline(dev[i], pipeline_dispatch_args[i], nullptr);
+		}
+
+		if (precision[i] == Precision::fp16) {
+			funcs[i].vkDestroyDescriptorPool(dev[i], half_bounds_desc_pool[i], nullptr);
+			funcs[i].vkDestroyPipeline(dev[i], pipeline_half_bounds[i], nullptr);
+			funcs[i].vkDestroyPipeline(dev[i], pipeline_pack_half[i], nullptr);
+		}
+
+		if (diagnostics[i]) {
+			funcs[i].vkDestroyDescriptorPool(dev[i], reduce_desc_pool[i], nullptr);
+			funcs[i].vkDestroyPipeline(dev[i], pipeline_reduce[i], nullptr);
+			funcs[i].vkDestroyPipeline(dev[i], pipeline_reduce_final[i], nullptr);
+		}
+
+		if (roi[i]) {
+			funcs[i].vkDestroyDescriptorPool(dev[i], roi_desc_pool[i], nullptr);
+			funcs[i].vkDestroyPipeline(dev[i], pipeline_roi_select[i], nullptr);
+			funcs[i].vkDestroyPipeline(dev[i], pipeline_roi_scan[i], nullptr);
+			funcs[i].vkDestroyPipeline(dev[i], pipeline_roi_compact[i], nullptr);
+		}
+
+		if (quantize_bits != 0) {
+			funcs[i].vkDestroyDescriptorPool(dev[i], quantize_desc_pool[i], nullptr);
+			funcs[i].vkDestroyPipeline(dev[i], pipeline_bounds[i], nullptr);
+			funcs[i].vkDestroyPipeline(dev[i], pipeline_quantize[i], nullptr);
+		}
+
+		funcs[i].vkDestroyPipelineLayout(dev[i], aux_pipeline_layout[i], nullptr);
+		funcs[i].vkDestroyPipelineLayout(dev[i], address_pipeline_layout[i], nullptr);
+		funcs[i].vkDestroyDescriptorSetLayout(dev[i], aux_desc_set_layout[i], nullptr);
 	}
 
 	for (std::size_t i = 0; i < physical_devs.size(); i++) {
@@ -1167,6 +4756,8 @@ int main(int argc, char *argv[]) {
 		funcs[i].vkDestroyDevice(dev[i], nullptr);
 	}
 
+	unmap_file(init_file);
+
 	if (debug_msgr != VK_NULL_HANDLE)
 		vkDestroyDebugUtilsMessengerEXT(inst, debug_msgr, nullptr);
 